@@ -0,0 +1,116 @@
+/**
+ * dcoy/aot.c
+ *
+ * Loading and running ahead-of-time compiled DCPU images - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/aot.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Loaded images */
+
+dcoy_aot *dcoy_aot_load (const char *filename, const char **error) {
+    void *handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        if (error) *error = dlerror();
+        return NULL;
+    }
+
+    const dcoy_aot_image *image = dlsym(handle, DCOY_AOT_SYMBOL);
+    if (image == NULL) {
+        if (error) *error = "Not a compiled DCPU image";
+        dlclose(handle);
+        return NULL;
+    }
+
+    if (image->abi != DCOY_AOT_ABI ||
+            image->dcpu_size != sizeof(dcoy_dcpu16)) {
+        if (error) *error = "Compiled for a different version of dcoy";
+        dlclose(handle);
+        return NULL;
+    }
+
+    dcoy_aot *aot = calloc(1, sizeof(dcoy_aot));
+    if (aot == NULL) {
+        if (error) *error = "Out of memory";
+        dlclose(handle);
+        return NULL;
+    }
+
+    aot->handle = handle;
+    aot->image = image;
+    for (unsigned int i = 0; i < image->block_count; i++) {
+        aot->index[image->blocks[i].start] = &image->blocks[i];
+    }
+
+    return aot;
+}
+
+
+void dcoy_aot_unload (dcoy_aot *aot) {
+    dlclose(aot->handle);
+    free(aot);
+}
+
+
+/* Execution */
+
+/* Blocks don't check traps, so one with a trap anywhere in it is left
+ * to the interpreter. */
+static bool block_trapped (const dcoy_dcpu16 *d, const dcoy_aot_block *block) {
+    for (unsigned int i = 0; i < block->size; i++) {
+        if (dcoy_dcpu_trapped(d, block->start + i)) return true;
+    }
+    return false;
+}
+
+
+unsigned int dcoy_aot_run (dcoy_dcpu16 *d, const dcoy_aot *aot,
+                           unsigned int cycles) {
+    unsigned int start = d->cycles;
+
+    while (dcoy_dcpu_ready(d) && d->cycles - start < cycles) {
+        /* stop just where dcoy_dcpu_run would */
+        if (dcoy_dcpu_trapped(d, d->pc)) {
+            dcoy_dcpu_yield(d);
+            break;
+        }
+
+        const dcoy_aot_block *block = aot->index[d->pc];
+
+        if (block && memcmp(d->mem + block->start, block->code,
+                            block->size * sizeof(dcoy_word)) == 0 &&
+                !(d->traps && block_trapped(d, block))) {
+            if (d->ex_op) {
+                dcoy_dcpu_ex_resolve(d);
+            }
+            /* blocks only record the edge into them */
+            if (d->coverage) {
+                dcoy_dcpu_coverage_edge(d);
+            }
+            block->run(d);
+
+            /* exactly what dcoy_dcpu_run does after its instruction */
+            if (!dcoy_dcpu_yielded(d)) {
+                dcoy_dcpu_interrupt_trigger(d);
+            }
+            if (dcoy_dcpu_events_due(d)) {
+                dcoy_dcpu_events_run(d);
+            }
+        } else {
+            /* not compiled, modified since, or trapped */
+            dcoy_dcpu_step(d);
+        }
+    }
+
+    return d->cycles - start;
+}
@@ -0,0 +1,79 @@
+/**
+ * dcoy/aot.h
+ *
+ * Loading and running ahead-of-time compiled DCPU images - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_aot_h
+#define _dcoy_aot_h
+
+#include <stdbool.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/dcpu/arith.h"
+#include "dcoy/specs.h"
+
+/* Compiled images
+ * dcoy-aot emits a C file defining one of these under the name
+ * DCOY_AOT_SYMBOL. Each block is a run of instructions starting at a
+ * known address; it is only run while the memory it was compiled from
+ * still holds the same code. */
+
+#define DCOY_AOT_ABI        7
+#define DCOY_AOT_SYMBOL     "dcoy_aot_compiled"
+
+typedef void (*dcoy_aot_fn) (dcoy_dcpu16 *d);
+
+typedef struct dcoy_aot_block {
+    dcoy_word start;
+    dcoy_word size;
+    const dcoy_word *code;
+    dcoy_aot_fn run;
+} dcoy_aot_block;
+
+typedef struct dcoy_aot_image {
+    unsigned int abi;
+    unsigned int dcpu_size;
+    unsigned int block_count;
+    const dcoy_aot_block *blocks;
+} dcoy_aot_image;
+
+
+/* Helpers for generated code
+ * Blocks don't call into the library. They return to dcoy_aot_run
+ * whenever an interrupt or timed event might need handling, or when
+ * they have written over their own code, and add the instructions they
+ * ran to d->retired before they do. They compute EX eagerly, and
+ * expect it to have been resolved before they are entered. */
+
+#define DCOY_AOT_HITS(addr, start, size) \
+    ((dcoy_word)((addr) - (start)) < (size))
+
+#define DCOY_AOT_PENDING(d) \
+    ((d)->int_queue_count || dcoy_dcpu_events_due(d))
+
+
+/* Loaded images */
+
+typedef struct dcoy_aot {
+    void *handle;
+    const dcoy_aot_image *image;
+    const dcoy_aot_block *index[DCOY_MEM_WORDS];
+} dcoy_aot;
+
+dcoy_aot *dcoy_aot_load (const char *filename, const char **error);
+void dcoy_aot_unload (dcoy_aot *aot);
+
+
+/* Execution
+ * Runs compiled blocks where possible and dcoy_dcpu_step everywhere
+ * else, until at least `cycles` have passed or the DCPU halts. Like
+ * dcoy_dcpu_run, it yields before an instruction at a trapped address.
+ * Returns the number of cycles that passed. */
+
+unsigned int dcoy_aot_run (dcoy_dcpu16 *d, const dcoy_aot *aot,
+                           unsigned int cycles);
+
+#endif
@@ -0,0 +1,786 @@
+/**
+ * dcoy/asm.c
+ *
+ * In-process, incremental DCPU-16 assembler - implementation
+ *
+ * Each line is parsed straight from the source text as it is scanned,
+ * with no token list, and its words go straight into the output. Label
+ * references are recorded as fixups and patched once every line has
+ * been seen.
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/asm.h"
+#include "dcoy/code.h"
+#include "dcoy/dcpu.h"
+
+#define FNV_OFFSET      2166136261u
+#define FNV_PRIME       16777619u
+
+/* registers in operands, besides A to J */
+#define REG_NONE        -1
+#define REG_SP          8
+
+/* what a parsed operand encodes to */
+typedef struct operand {
+    unsigned int lead;
+    bool has_word;
+    dcoy_word word;
+    int label;          /* index, or -1 */
+} operand;
+
+/* where parsing is up to */
+typedef struct parser {
+    dcoy_asm *a;
+    const char *p;
+    const char *end;    /* of the line */
+    bool emit;          /* false when just measuring */
+    unsigned int line;
+    unsigned int addr;
+} parser;
+
+#define FAIL(ps, message) do { \
+    (ps)->a->error = (message); \
+    (ps)->a->error_line = (ps)->line + 1; \
+    return false; \
+} while (0)
+
+
+/* Instance management */
+
+static uint32_t pack (const char *name, unsigned int length) {
+    if (length != 3) return 0;
+    return (uint32_t)(name[0] & ~0x20) << 16 |
+           (uint32_t)(name[1] & ~0x20) << 8 |
+           (uint32_t)(name[2] & ~0x20);
+}
+
+
+dcoy_asm *dcoy_asm_create () {
+    dcoy_asm *a = calloc(1, sizeof(dcoy_asm));
+    if (a == NULL) return a;
+
+    for (unsigned int i = 0; i < 32; i++) {
+        if (dcoy_opcode_names[i] && i != DCOY_OP_SPEC) {
+            a->op_keys[i] = pack(dcoy_opcode_names[i], 3);
+        }
+        if (dcoy_spec_opcode_names[i]) {
+            a->sop_keys[i] = pack(dcoy_spec_opcode_names[i], 3);
+        }
+    }
+    return a;
+}
+
+
+void dcoy_asm_destroy (dcoy_asm *a) {
+    free(a->lines);
+    free(a->labels);
+    free(a->slots);
+    free(a->names);
+    free(a->fixups);
+    free(a);
+}
+
+
+static bool grow (void **list, unsigned int *size, unsigned int needed,
+                  size_t item) {
+    if (needed <= *size) return true;
+
+    unsigned int new_size = *size ? *size : 64;
+    while (new_size < needed) new_size *= 2;
+
+    void *new_list = realloc(*list, new_size * item);
+    if (new_list == NULL) return false;
+    *list = new_list;
+    *size = new_size;
+    return true;
+}
+
+
+/* Labels */
+
+static uint32_t hash (const char *name, unsigned int length) {
+    uint32_t h = FNV_OFFSET;
+    for (unsigned int i = 0; i < length; i++) {
+        h = (h ^ (uint8_t)name[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+
+static unsigned int *slot (const dcoy_asm *a, const char *name,
+                           unsigned int length, uint32_t h) {
+    unsigned int mask = a->slot_size - 1;
+
+    for (unsigned int i = h & mask; ; i = (i + 1) & mask) {
+        unsigned int *s = &a->slots[i];
+        if (*s == 0) return s;
+
+        const dcoy_asm_label *l = &a->labels[*s - 1];
+        if (l->hash == h && l->length == length &&
+            memcmp(a->names + l->name, name, length) == 0) {
+            return s;
+        }
+    }
+}
+
+
+static bool rehash (dcoy_asm *a) {
+    unsigned int size = a->slot_size ? a->slot_size * 2 : 256;
+    unsigned int *slots = calloc(size, sizeof(unsigned int));
+    if (slots == NULL) return false;
+
+    free(a->slots);
+    a->slots = slots;
+    a->slot_size = size;
+
+    for (unsigned int i = 0; i < a->label_count; i++) {
+        const dcoy_asm_label *l = &a->labels[i];
+        *slot(a, a->names + l->name, l->length, l->hash) = i + 1;
+    }
+    return true;
+}
+
+
+/* returns the label's index, adding it if it's new, or -1 */
+static int intern (dcoy_asm *a, const char *name, unsigned int length) {
+    if ((a->label_count + 1) * 2 > a->slot_size && !rehash(a)) {
+        return -1;
+    }
+
+    uint32_t h = hash(name, length);
+    unsigned int *s = slot(a, name, length, h);
+    if (*s) return *s - 1;
+
+    if (!grow((void **)&a->labels, &a->label_size, a->label_count + 1,
+              sizeof(dcoy_asm_label)) ||
+        !grow((void **)&a->names, &a->names_size, a->names_used + length,
+              1)) {
+        return -1;
+    }
+
+    dcoy_asm_label *l = &a->labels[a->label_count];
+    l->name = a->names_used;
+    l->length = length;
+    l->hash = h;
+    l->defined = false;
+
+    memcpy(a->names + a->names_used, name, length);
+    a->names_used += length;
+
+    *s = ++a->label_count;
+    return a->label_count - 1;
+}
+
+
+bool dcoy_asm_label_find (const dcoy_asm *a, const char *name,
+                          dcoy_word *value) {
+    if (a->slot_size == 0) return false;
+
+    unsigned int length = strlen(name);
+    unsigned int *s = slot(a, name, length, hash(name, length));
+    if (*s == 0 || !a->labels[*s - 1].defined) return false;
+
+    *value = a->labels[*s - 1].value;
+    return true;
+}
+
+
+bool dcoy_asm_write_symbols (const dcoy_asm *a, FILE *out) {
+    for (unsigned int i = 0; i < a->label_count; i++) {
+        const dcoy_asm_label *l = &a->labels[i];
+        if (l->defined) {
+            fprintf(out, "%.*s 0x%04x\n", (int)l->length, a->names + l->name,
+                    l->value);
+        }
+    }
+    return !ferror(out);
+}
+
+
+/* Scanning */
+
+static bool is_space (char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+static bool is_ident (char c, bool first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+           c == '.' || (!first && c >= '0' && c <= '9');
+}
+
+
+static void skip_space (parser *ps) {
+    while (ps->p < ps->end && is_space(*ps->p)) ps->p++;
+}
+
+
+static bool at (parser *ps, char c) {
+    skip_space(ps);
+    return ps->p < ps->end && *ps->p == c;
+}
+
+
+static bool accept (parser *ps, char c) {
+    if (!at(ps, c)) return false;
+    ps->p++;
+    return true;
+}
+
+
+static bool at_end (parser *ps) {
+    skip_space(ps);
+    return ps->p == ps->end || *ps->p == ';';
+}
+
+
+static unsigned int ident (parser *ps, const char **name) {
+    skip_space(ps);
+    *name = ps->p;
+    if (ps->p < ps->end && is_ident(*ps->p, true)) {
+        while (ps->p < ps->end && is_ident(*ps->p, false)) ps->p++;
+    }
+    return ps->p - *name;
+}
+
+
+static bool keyword (const char *name, unsigned int length,
+                     const char *word) {
+    for (unsigned int i = 0; i < length; i++) {
+        char c = name[i] >= 'a' && name[i] <= 'z' ? name[i] - 0x20 : name[i];
+        if (word[i] == '\0' || c != word[i]) return false;
+    }
+    return word[length] == '\0';
+}
+
+
+static int reg (const char *name, unsigned int length) {
+    if (length == 1) {
+        const char *r = strchr(dcoy_register_names, name[0] & ~0x20);
+        if (r && *r) return r - dcoy_register_names;
+    } else if (keyword(name, length, "SP")) {
+        return REG_SP;
+    }
+    return REG_NONE;
+}
+
+
+/* Expressions */
+
+static bool escape (parser *ps, dcoy_word *value) {
+    char c = *ps->p++;
+    if (c != '\\') {
+        *value = (uint8_t)c;
+        return true;
+    }
+    if (ps->p == ps->end) FAIL(ps, "unfinished escape");
+
+    switch (*ps->p++) {
+        case 'n':   *value = '\n';  return true;
+        case 't':   *value = '\t';  return true;
+        case 'r':   *value = '\r';  return true;
+        case '0':   *value = 0;     return true;
+        case '\\':  *value = '\\';  return true;
+        case '\'':  *value = '\'';  return true;
+        case '"':   *value = '"';   return true;
+        default:    FAIL(ps, "unknown escape");
+    }
+}
+
+
+static bool number (parser *ps, dcoy_word *value) {
+    unsigned int base = 10;
+    unsigned long n = 0;
+    bool digits = false;
+
+    if (ps->end - ps->p > 2 && ps->p[0] == '0') {
+        char x = ps->p[1] | 0x20;
+        if (x == 'x') base = 16;
+        if (x == 'b') base = 2;
+        if (base != 10) ps->p += 2;
+    }
+
+    for (; ps->p < ps->end; ps->p++) {
+        char c = *ps->p | 0x20;
+        unsigned int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else break;
+        if (digit >= base) FAIL(ps, "bad digit in number");
+
+        n = n * base + digit;
+        if (n > 0xffff) FAIL(ps, "number doesn't fit in a word");
+        digits = true;
+    }
+
+    if (!digits || (ps->p < ps->end && is_ident(*ps->p, false))) {
+        FAIL(ps, "bad number");
+    }
+    *value = n;
+    return true;
+}
+
+
+/* Parses a sum of numbers, with at most one label (and, if r isn't
+ * NULL, register), in any order. */
+static bool expression (parser *ps, dcoy_word *value, int *label, int *r) {
+    bool negative = accept(ps, '-');
+
+    *value = 0;
+    *label = -1;
+    if (r) *r = REG_NONE;
+
+    do {
+        const char *name;
+        unsigned int length = ident(ps, &name);
+        dcoy_word term;
+
+        if (length) {
+            int rn = reg(name, length);
+            if (rn != REG_NONE) {
+                if (!r) FAIL(ps, "register outside brackets");
+                if (*r != REG_NONE) FAIL(ps, "more than one register");
+                if (negative) FAIL(ps, "can't subtract a register");
+                *r = rn;
+                continue;
+            }
+
+            if (*label != -1) FAIL(ps, "more than one label");
+            if (negative) FAIL(ps, "can't subtract a label");
+
+            /* it only needs to be known once the words are written */
+            *label = ps->emit ? intern(ps->a, name, length) : 0;
+            if (*label < 0) FAIL(ps, "out of memory");
+            continue;
+        }
+
+        if (ps->p < ps->end && *ps->p == '\'') {
+            ps->p++;
+            if (ps->p == ps->end) FAIL(ps, "unfinished character");
+            if (!escape(ps, &term)) return false;
+            if (ps->p == ps->end || *ps->p++ != '\'') {
+                FAIL(ps, "unfinished character");
+            }
+        } else if (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+            if (!number(ps, &term)) return false;
+        } else {
+            FAIL(ps, "expected a value");
+        }
+
+        *value += negative ? -term : term;
+    } while ((negative = accept(ps, '-')) || accept(ps, '+'));
+
+    return true;
+}
+
+
+/* Operands */
+
+static bool operand_parse (parser *ps, operand *o, bool is_a) {
+    const char *name;
+    unsigned int length;
+    dcoy_word value;
+    int r;
+
+    o->has_word = false;
+    o->label = -1;
+
+    skip_space(ps);
+    const char *start = ps->p;
+
+    if ((length = ident(ps, &name))) {
+        /* keywords first, then it must be the start of a value */
+        r = reg(name, length);
+        if (r != REG_NONE && (at(ps, '+') || at(ps, '-'))) {
+            /* an error, but expression says so */
+        } else if (r == REG_SP) {
+            o->lead = DCOY_ARG_SP;
+            return true;
+        } else if (r != REG_NONE) {
+            o->lead = DCOY_ARG_RVALUE + r;
+            return true;
+        } else if (keyword(name, length, "PC")) {
+            o->lead = DCOY_ARG_PC;
+            return true;
+        } else if (keyword(name, length, "EX")) {
+            o->lead = DCOY_ARG_EX;
+            return true;
+        } else if (keyword(name, length, "PEEK")) {
+            o->lead = DCOY_ARG_PEEK;
+            return true;
+        } else if (keyword(name, length, "PUSH")) {
+            if (is_a) FAIL(ps, "PUSH can only be written to");
+            o->lead = DCOY_ARG_PUSHPOP;
+            return true;
+        } else if (keyword(name, length, "POP")) {
+            if (!is_a) FAIL(ps, "POP can only be read from");
+            o->lead = DCOY_ARG_PUSHPOP;
+            return true;
+        } else if (keyword(name, length, "PICK")) {
+            /* bare, as dcoy_inst_write prints PEEK */
+            if (at(ps, ',') || at_end(ps)) {
+                o->lead = DCOY_ARG_PEEK;
+                return true;
+            }
+            if (!expression(ps, &o->word, &o->label, NULL)) return false;
+            o->lead = DCOY_ARG_PICK;
+            o->has_word = true;
+            return true;
+        }
+        ps->p = start;
+    }
+
+    if (accept(ps, '[')) {
+        if (accept(ps, '-')) {
+            if (!accept(ps, '-') || !(length = ident(ps, &name)) ||
+                reg(name, length) != REG_SP || !accept(ps, ']')) {
+                FAIL(ps, "expected [--SP]");
+            }
+            if (is_a) FAIL(ps, "[--SP] can only be written to");
+            o->lead = DCOY_ARG_PUSHPOP;
+            return true;
+        }
+
+        start = ps->p;
+        length = ident(ps, &name);
+        if (length && reg(name, length) == REG_SP && accept(ps, '+') &&
+            accept(ps, '+')) {
+            if (!accept(ps, ']')) FAIL(ps, "expected [SP++]");
+            if (!is_a) FAIL(ps, "[SP++] can only be read from");
+            o->lead = DCOY_ARG_PUSHPOP;
+            return true;
+        }
+        ps->p = start;
+
+        /* anything else is a sum, which only needs a word if there's
+         * more to it than a register */
+        if (!expression(ps, &value, &o->label, &r)) return false;
+        if (!accept(ps, ']')) FAIL(ps, "expected ]");
+
+        bool offset = r == REG_NONE || value != 0 || o->label != -1;
+
+        if (r == REG_NONE) {
+            o->lead = DCOY_ARG_LOOKUP;
+        } else if (r == REG_SP) {
+            o->lead = offset ? DCOY_ARG_PICK : DCOY_ARG_PEEK;
+        } else {
+            o->lead = (offset ? DCOY_ARG_ROFFSET : DCOY_ARG_RLOOKUP) + r;
+        }
+        o->has_word = offset;
+        o->word = value;
+        return true;
+    }
+
+    if (!expression(ps, &value, &o->label, NULL)) return false;
+
+    /* short literals only go in a, and never for labels */
+    if (is_a && o->label == -1 && (value == 0xffff || value <= 30)) {
+        o->lead = 0x20 + (dcoy_word)(value + 1);
+    } else {
+        o->lead = DCOY_ARG_VALUE;
+        o->has_word = true;
+        o->word = value;
+    }
+    return true;
+}
+
+
+/* Output */
+
+static bool put (parser *ps, dcoy_word word, int label) {
+    dcoy_asm *a = ps->a;
+
+    if (ps->emit) {
+        if (label >= 0) {
+            if (!grow((void **)&a->fixups, &a->fixup_size,
+                      a->fixup_count + 1, sizeof(dcoy_asm_fixup))) {
+                FAIL(ps, "out of memory");
+            }
+            dcoy_asm_fixup *f = &a->fixups[a->fixup_count++];
+            f->addr = ps->addr;
+            f->label = label;
+            f->addend = word;
+            f->line = ps->line;
+        }
+        a->out[ps->addr] = word;
+    }
+
+    if (++ps->addr > a->out_size) FAIL(ps, "out of room");
+    return true;
+}
+
+
+static bool instruction (parser *ps, uint32_t key) {
+    dcoy_asm *a = ps->a;
+    operand oa, ob;
+
+    if (key == 0) FAIL(ps, "unknown instruction");
+
+    for (unsigned int op = 0; op < 32; op++) {
+        if (a->sop_keys[op] == key) {
+            if (!operand_parse(ps, &oa, true)) return false;
+
+            return put(ps, op << 5 | oa.lead << 10, -1) &&
+                   (!oa.has_word || put(ps, oa.word, oa.label));
+        }
+
+        if (a->op_keys[op] == key) {
+            if (!operand_parse(ps, &ob, false)) return false;
+            if (!accept(ps, ',')) FAIL(ps, "expected ,");
+            if (!operand_parse(ps, &oa, true)) return false;
+
+            return put(ps, op | ob.lead << 5 | oa.lead << 10, -1) &&
+                   (!oa.has_word || put(ps, oa.word, oa.label)) &&
+                   (!ob.has_word || put(ps, ob.word, ob.label));
+        }
+    }
+
+    FAIL(ps, "unknown instruction");
+}
+
+
+static bool data (parser *ps) {
+    do {
+        if (accept(ps, '"')) {
+            dcoy_word c;
+            while (ps->p < ps->end && *ps->p != '"') {
+                if (!escape(ps, &c) || !put(ps, c, -1)) return false;
+            }
+            if (!accept(ps, '"')) FAIL(ps, "unfinished string");
+        } else {
+            dcoy_word value;
+            int label;
+            if (!expression(ps, &value, &label, NULL) ||
+                !put(ps, value, label)) {
+                return false;
+            }
+        }
+    } while (accept(ps, ','));
+    return true;
+}
+
+
+static bool define (parser *ps, const char *name, unsigned int length) {
+    if (length == 0) FAIL(ps, "expected a label");
+    if (!ps->emit) return true;
+
+    int index = intern(ps->a, name, length);
+    if (index < 0) FAIL(ps, "out of memory");
+
+    dcoy_asm_label *l = &ps->a->labels[index];
+    if (l->defined) FAIL(ps, "label defined twice");
+
+    l->defined = true;
+    l->value = ps->addr;
+    l->line = ps->line;
+    return true;
+}
+
+
+static bool statement (parser *ps) {
+    const char *name;
+    unsigned int length;
+
+    if (accept(ps, ':')) {
+        length = ident(ps, &name);
+        if (!define(ps, name, length)) return false;
+    }
+
+    length = ident(ps, &name);
+    if (length && ps->p < ps->end && *ps->p == ':') {
+        ps->p++;
+        if (!define(ps, name, length)) return false;
+        length = ident(ps, &name);
+    }
+
+    if (length == 0) {
+        if (!at_end(ps)) FAIL(ps, "expected an instruction");
+        return true;
+    }
+
+    bool ok = keyword(name, length, "DAT") || keyword(name, length, ".DAT")
+            ? data(ps)
+            : instruction(ps, pack(name, length));
+
+    if (ok && !at_end(ps)) FAIL(ps, "unexpected text after statement");
+    return ok;
+}
+
+
+/* Parses up to `count` lines from `offset`, and returns how many it
+ * did, or -1 on error. A last line without a newline is taken to end
+ * one past the source, as if it had one, so that a line added after it
+ * starts where the new version puts it. */
+static long lines (parser *ps, const char *src, size_t length,
+                   size_t *offset, unsigned int count) {
+    dcoy_asm *a = ps->a;
+    const char *end = src + length;
+    size_t at = *offset;
+    unsigned int n;
+
+    for (n = 0; n < count && at < length; n++, ps->line++) {
+        const char *p = src + at;
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+
+        if (ps->emit) {
+            a->lines[ps->line].offset = at;
+            a->lines[ps->line].addr = ps->addr;
+        }
+
+        ps->p = p;
+        ps->end = eol;
+        if (!statement(ps)) return -1;
+
+        at = eol - src + 1;
+    }
+
+    *offset = at;
+    return n;
+}
+
+
+/* Assembly */
+
+static bool patch (dcoy_asm *a) {
+    bool ok = true;
+
+    for (unsigned int i = 0; i < a->fixup_count; i++) {
+        const dcoy_asm_fixup *f = &a->fixups[i];
+        const dcoy_asm_label *l = &a->labels[f->label];
+
+        if (l->defined) {
+            a->out[f->addr] = l->value + f->addend;
+        } else if (ok) {
+            a->error = "undefined label";
+            a->error_line = f->line + 1;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+bool dcoy_asm_update (dcoy_asm *a, const char *src, size_t length,
+                      unsigned int first, unsigned int removed,
+                      unsigned int added) {
+    a->error = NULL;
+    a->error_line = 0;
+
+    if (first + removed > a->line_count) {
+        a->error = "lines out of range";
+        return false;
+    }
+
+    unsigned int last = first + removed;
+    unsigned int base = a->lines[first].addr;
+    unsigned int old_size = a->lines[last].addr - base;
+
+    /* measure the new lines first, so nothing changes if they're bad */
+    parser ps = {a, NULL, NULL, false, first, base};
+    size_t offset = a->lines[first].offset;
+    long count = lines(&ps, src, length, &offset, added);
+    if (count < 0) return false;
+
+    if (added != DCOY_ASM_ALL_LINES && count != added) {
+        a->error = "source has fewer lines than that";
+        return false;
+    }
+    added = count;
+
+    unsigned int new_size = ps.addr - base;
+    long delta = (long)new_size - old_size;
+    long bytes = (long)offset - a->lines[last].offset;
+    long moved = (long)added - removed;
+
+    if (a->end + delta > a->out_size) {
+        a->error = "out of room";
+        return false;
+    }
+    if (!grow((void **)&a->lines, &a->line_size, a->line_count + moved + 1,
+              sizeof(dcoy_asm_line))) {
+        a->error = "out of memory";
+        return false;
+    }
+
+    /* everything after the new lines moves along */
+    memmove(&a->lines[first + added], &a->lines[last],
+            (a->line_count + 1 - last) * sizeof(dcoy_asm_line));
+    a->line_count += moved;
+    for (unsigned int i = first + added; i <= a->line_count; i++) {
+        a->lines[i].offset += bytes;
+        a->lines[i].addr += delta;
+    }
+
+    memmove(a->out + base + new_size, a->out + base + old_size,
+            (a->end - base - old_size) * sizeof(dcoy_word));
+    a->end += delta;
+
+    for (unsigned int i = 0; i < a->label_count; i++) {
+        dcoy_asm_label *l = &a->labels[i];
+        if (!l->defined || l->line < first) continue;
+
+        if (l->line < last) {
+            l->defined = false;
+        } else {
+            l->line += moved;
+            l->value += delta;
+        }
+    }
+
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < a->fixup_count; i++) {
+        dcoy_asm_fixup f = a->fixups[i];
+        if (f.line >= first && f.line < last) continue;
+
+        if (f.line >= last) {
+            f.line += moved;
+            f.addr += delta;
+        }
+        a->fixups[kept++] = f;
+    }
+    a->fixup_count = kept;
+
+    /* then write them for real */
+    ps = (parser){a, NULL, NULL, true, first, base};
+    offset = a->lines[first].offset;
+    if (lines(&ps, src, length, &offset, added) < 0) return false;
+
+    return patch(a);
+}
+
+
+bool dcoy_asm_assemble (dcoy_asm *a, const char *src, size_t length,
+                        dcoy_word *out, unsigned int size) {
+    if (!grow((void **)&a->lines, &a->line_size, 1, sizeof(dcoy_asm_line))) {
+        a->error = "out of memory";
+        a->error_line = 0;
+        return false;
+    }
+
+    a->out = out;
+    a->out_size = size < DCOY_MEM_WORDS ? size : DCOY_MEM_WORDS;
+    a->end = 0;
+
+    a->line_count = 0;
+    a->lines[0].offset = 0;
+    a->lines[0].addr = 0;
+
+    a->label_count = 0;
+    a->names_used = 0;
+    a->fixup_count = 0;
+    if (a->slots) {
+        memset(a->slots, 0, a->slot_size * sizeof(unsigned int));
+    }
+
+    return dcoy_asm_update(a, src, length, 0, 0, DCOY_ASM_ALL_LINES);
+}
@@ -0,0 +1,138 @@
+/**
+ * dcoy/asm.h
+ *
+ * In-process, incremental DCPU-16 assembler - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_asm_h
+#define _dcoy_asm_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Syntax
+ * One statement per line, in the usual notation (as dcoy_inst_write
+ * prints it), case-insensitive except for labels:
+ *
+ *     :label  or  label:       defines label as the current address
+ *     SET [A + 2], label + 1   instructions, with operands b then a
+ *     DAT 1, "text", label     data words, and a word per character
+ *     ; ...                    comments
+ *
+ * Operands can be A-J, SP, PC, EX, PUSH, POP, PEEK (or bare PICK),
+ * PICK n, [--SP], [SP++], [SP + n], [reg], [reg + n], [n] or n, where n
+ * adds up numbers (decimal, 0x hex, 0b binary, 'c'), and at most one
+ * label.
+ *
+ * Labels always take a word of their own, even if they would fit in a
+ * short literal, so the size of every line depends only on its text.
+ * That is what makes reassembling part of a file cheap. */
+
+
+/* Internal tables - each grows as needed and is reused by the next
+ * assembly, so after the first, assembling allocates nothing. */
+
+typedef struct dcoy_asm_line {
+    unsigned int offset;    /* in the source */
+    unsigned int addr;
+} dcoy_asm_line;
+
+typedef struct dcoy_asm_label {
+    unsigned int name;      /* offset into names */
+    unsigned int length;
+    uint32_t hash;
+    unsigned int line;      /* where it's defined */
+    dcoy_word value;
+    bool defined;
+} dcoy_asm_label;
+
+typedef struct dcoy_asm_fixup {
+    unsigned int addr;      /* the word that holds the label */
+    unsigned int label;
+    dcoy_word addend;
+    unsigned int line;
+} dcoy_asm_fixup;
+
+typedef struct dcoy_asm {
+    dcoy_word *out;
+    unsigned int out_size;
+    unsigned int end;
+
+    /* with an extra one past the last line, for the end of the source */
+    dcoy_asm_line *lines;
+    unsigned int line_count;
+    unsigned int line_size;
+
+    /* labels are open addressed by name through slots, which hold
+     * label indexes plus one, and never go away once they're referred
+     * to, so fixups can keep their index */
+    dcoy_asm_label *labels;
+    unsigned int label_count;
+    unsigned int label_size;
+    unsigned int *slots;
+    unsigned int slot_size;
+
+    char *names;
+    unsigned int names_used;
+    unsigned int names_size;
+
+    dcoy_asm_fixup *fixups;
+    unsigned int fixup_count;
+    unsigned int fixup_size;
+
+    /* opcode names packed into integers, for quick lookup */
+    uint32_t op_keys[32];
+    uint32_t sop_keys[32];
+
+    const char *error;
+    unsigned int error_line;    /* counting from 1 */
+} dcoy_asm;
+
+
+/* Instance management */
+
+dcoy_asm *dcoy_asm_create ();
+void dcoy_asm_destroy (dcoy_asm *a);
+
+
+/* Assembly
+ * assemble writes the whole source into out, which can be a buffer or
+ * a DCPU's memory. On error, it returns false and sets error and
+ * error_line. Afterwards, end is the number of words written.
+ *
+ * update reassembles part of the same file after it's been edited:
+ * lines first to first + removed - 1 of the last version were replaced
+ * with `added` lines, and src is the whole new version (a newline at
+ * the very end doesn't start another line). Only those lines are
+ * parsed again - the rest of the output is moved along if their size
+ * changed, and every label is patched again. If update fails, the
+ * output is left alone when the error was in the new lines' syntax, but
+ * otherwise needs assembling again. */
+
+#define DCOY_ASM_ALL_LINES      ((unsigned int)-1)
+
+bool dcoy_asm_assemble (dcoy_asm *a, const char *src, size_t length,
+                        dcoy_word *out, unsigned int size);
+bool dcoy_asm_update (dcoy_asm *a, const char *src, size_t length,
+                      unsigned int first, unsigned int removed,
+                      unsigned int added);
+
+#define dcoy_asm_assemble_dcpu(a, src, length, d) \
+    dcoy_asm_assemble((a), (src), (length), (d)->mem, DCOY_MEM_WORDS)
+
+
+/* Labels - find returns false if it isn't defined. The symbol map has a
+ * "label 0xaddr" line per label, as dcoy_profile_symbols_load reads. */
+
+bool dcoy_asm_label_find (const dcoy_asm *a, const char *name,
+                          dcoy_word *value);
+bool dcoy_asm_write_symbols (const dcoy_asm *a, FILE *out);
+
+#endif
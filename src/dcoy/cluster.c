@@ -0,0 +1,261 @@
+/**
+ * dcoy/cluster.c
+ *
+ * Deterministic parallel simulation of connected DCPUs - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "dcoy/cluster.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/hardware/link.h"
+
+/* Instance management */
+
+dcoy_cluster *dcoy_cluster_create () {
+    dcoy_cluster *c = calloc(1, sizeof(dcoy_cluster));
+    if (c == NULL) return c;
+    c->quantum = DCOY_CLUSTER_QUANTUM;
+    return c;
+}
+
+
+void dcoy_cluster_destroy (dcoy_cluster *c) {
+    /* nodes belong to the host, links and channels to the cluster */
+    for (unsigned int i = 0; i < c->link_count; i++) {
+        dcoy_link_destroy(c->links[i].link);
+    }
+    for (unsigned int i = 0; i < c->channel_count; i++) {
+        dcoy_link_channel_destroy(c->channels[i]);
+    }
+    free(c->channels);
+    free(c->links);
+    free(c->nodes);
+    free(c);
+}
+
+
+/* Building */
+
+int dcoy_cluster_add (dcoy_cluster *c, dcoy_dcpu16 *d) {
+    if (c->node_count == c->node_size) {
+        unsigned int size = c->node_size ? c->node_size * 2 : 4;
+        dcoy_dcpu16 **list = realloc(c->nodes, size * sizeof(dcoy_dcpu16 *));
+        if (list == NULL) return -1;
+        c->nodes = list;
+        c->node_size = size;
+    }
+
+    if (c->node_count == 0) {
+        c->time = d->cycles;
+    }
+    c->nodes[c->node_count] = d;
+    return c->node_count++;
+}
+
+
+static bool add_link (dcoy_cluster *c, unsigned int node,
+                      dcoy_link_channel *out, dcoy_link_channel *in,
+                      unsigned int latency) {
+    dcoy_link *link = dcoy_link_create(out, in, latency);
+    if (link == NULL) return false;
+
+    if (!dcoy_link_attach(c->nodes[node], link)) {
+        dcoy_link_destroy(link);
+        return false;
+    }
+
+    c->links[c->link_count].link = link;
+    c->links[c->link_count].node = node;
+    c->link_count++;
+    return true;
+}
+
+
+/* Undoes the last add_link. Its device was the last one attached to
+ * its node, so it comes off the end of that node's list. */
+static void remove_link (dcoy_cluster *c) {
+    dcoy_cluster_link *last = &c->links[--c->link_count];
+    c->nodes[last->node]->hardware_count--;
+    dcoy_link_destroy(last->link);
+}
+
+
+bool dcoy_cluster_connect (dcoy_cluster *c, unsigned int a, unsigned int b,
+                           unsigned int latency) {
+    if (a >= c->node_count || b >= c->node_count || latency == 0) {
+        return false;
+    }
+
+    /* grow both lists up front, so nothing fails halfway through */
+    if (c->link_count + 2 > c->link_size) {
+        unsigned int size = c->link_size ? c->link_size * 2 : 8;
+        dcoy_cluster_link *list = realloc(c->links,
+                                          size * sizeof(dcoy_cluster_link));
+        if (list == NULL) return false;
+        c->links = list;
+        c->link_size = size;
+    }
+
+    dcoy_link_channel **channels = realloc(c->channels,
+        (c->channel_count + 2) * sizeof(dcoy_link_channel *));
+    if (channels == NULL) return false;
+    c->channels = channels;
+
+    dcoy_link_channel *ab = dcoy_link_channel_create(DCOY_CLUSTER_CHANNEL_WORDS);
+    dcoy_link_channel *ba = dcoy_link_channel_create(DCOY_CLUSTER_CHANNEL_WORDS);
+    if (ab == NULL || ba == NULL) {
+        if (ab) dcoy_link_channel_destroy(ab);
+        if (ba) dcoy_link_channel_destroy(ba);
+        return false;
+    }
+
+    /* if b can't take its end, take a's back off again */
+    bool linked = add_link(c, a, ab, ba, latency);
+    if (linked && !add_link(c, b, ba, ab, latency)) {
+        remove_link(c);
+        linked = false;
+    }
+    if (!linked) {
+        dcoy_link_channel_destroy(ab);
+        dcoy_link_channel_destroy(ba);
+        return false;
+    }
+    c->channels[c->channel_count++] = ab;
+    c->channels[c->channel_count++] = ba;
+
+    if (c->link_count == 2 || latency < c->quantum) {
+        c->quantum = latency;
+    }
+    return true;
+}
+
+
+/* Running
+ * Each thread owns a contiguous range of nodes, and the links attached
+ * to them. Within a quantum a thread only touches its own nodes, and
+ * the channels' published indices are only read after the barrier that
+ * follows their writes. */
+
+typedef struct worker {
+    dcoy_cluster *c;
+    unsigned int first;
+    unsigned int last;
+    unsigned int quanta;
+    pthread_mutex_t *start;
+    pthread_barrier_t *barrier;     /* NULL if this is the only thread */
+} worker;
+
+
+static void run_node (dcoy_dcpu16 *d, unsigned int end) {
+    while (dcoy_dcpu_ready(d) && !dcoy_dcpu_cycles_reached(d, end)) {
+        /* instructions take at least a cycle, and usually a few more,
+         * so this rarely goes more than one instruction past the end */
+        dcoy_dcpu_run(d, (end - d->cycles) / 4 + 1);
+    }
+}
+
+
+static void *work (void *arg) {
+    worker *w = arg;
+    dcoy_cluster *c = w->c;
+
+    /* wait until every thread's range and the barrier are settled */
+    pthread_mutex_lock(w->start);
+    pthread_mutex_unlock(w->start);
+
+    for (unsigned int q = 0; q < w->quanta; q++) {
+        unsigned int quantum = c->quanta + q;
+        unsigned int end = c->time + (q + 1) * c->quantum;
+
+        for (unsigned int i = 0; i < c->link_count; i++) {
+            dcoy_cluster_link *l = &c->links[i];
+            if (l->node >= w->first && l->node < w->last) {
+                dcoy_link_begin(l->link, c->nodes[l->node], quantum);
+            }
+        }
+
+        for (unsigned int n = w->first; n < w->last; n++) {
+            run_node(c->nodes[n], end);
+        }
+
+        for (unsigned int i = 0; i < c->link_count; i++) {
+            dcoy_cluster_link *l = &c->links[i];
+            if (l->node >= w->first && l->node < w->last) {
+                dcoy_link_end(l->link, quantum);
+            }
+        }
+
+        if (w->barrier) {
+            pthread_barrier_wait(w->barrier);
+        }
+    }
+
+    return NULL;
+}
+
+
+void dcoy_cluster_run (dcoy_cluster *c, unsigned int cycles,
+                       unsigned int threads) {
+    if (c->node_count == 0) {
+        return;
+    }
+    if (threads == 0) threads = 1;
+    if (threads > c->node_count) threads = c->node_count;
+
+    unsigned int quanta = (cycles + c->quantum - 1) / c->quantum;
+
+    pthread_mutex_t start = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t barrier;
+    worker workers[threads];
+    pthread_t ids[threads];
+
+    for (unsigned int t = 0; t < threads; t++) {
+        workers[t].c = c;
+        workers[t].first = (unsigned long)c->node_count * t / threads;
+        workers[t].last = (unsigned long)c->node_count * (t + 1) / threads;
+        workers[t].quanta = quanta;
+        workers[t].start = &start;
+        workers[t].barrier = &barrier;
+    }
+
+    /* The calling thread takes the last range, along with any whose
+     * thread couldn't be started. Then the results are the same. */
+    pthread_mutex_lock(&start);
+    unsigned int started = 0;
+    while (started + 1 < threads &&
+           pthread_create(&ids[started], NULL, work,
+                          &workers[started]) == 0) {
+        started++;
+    }
+
+    worker *mine = &workers[started];
+    mine->last = c->node_count;
+
+    if (started == 0) {
+        mine->barrier = NULL;
+    } else if (pthread_barrier_init(&barrier, NULL, started + 1) != 0) {
+        for (unsigned int t = 0; t < started; t++) {
+            workers[t].quanta = 0;
+        }
+        mine->first = 0;
+        mine->barrier = NULL;
+    }
+    pthread_mutex_unlock(&start);
+
+    work(mine);
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    if (mine->barrier) {
+        pthread_barrier_destroy(&barrier);
+    }
+
+    c->quanta += quanta;
+    c->time += quanta * c->quantum;
+}
@@ -0,0 +1,77 @@
+/**
+ * dcoy/cluster.h
+ *
+ * Deterministic parallel simulation of connected DCPUs - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_cluster_h
+#define _dcoy_cluster_h
+
+#include <stdbool.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/hardware/link.h"
+
+/* Nodes are DCPUs connected to each other by links (see
+ * dcoy/hardware/link.h). The cluster runs them in quanta of cycles,
+ * spread over a number of threads, with a barrier after each quantum.
+ * A quantum is never longer than the shortest link latency, so nothing
+ * a node sends can arrive before the quantum after it was sent - which
+ * is when the receiver first gets to see it. The results are the same
+ * for any number of threads.
+ *
+ * Nodes must count cycles (so no variants without them), and should
+ * start with the same cycle count. They stay owned by the host. */
+
+#define DCOY_CLUSTER_QUANTUM        1000    /* if nothing is connected */
+#define DCOY_CLUSTER_CHANNEL_WORDS  64
+
+typedef struct dcoy_cluster_link {
+    dcoy_link *link;
+    unsigned int node;
+} dcoy_cluster_link;
+
+typedef struct dcoy_cluster {
+    dcoy_dcpu16 **nodes;
+    unsigned int node_count;
+    unsigned int node_size;
+
+    dcoy_cluster_link *links;
+    unsigned int link_count;
+    unsigned int link_size;
+
+    dcoy_link_channel **channels;
+    unsigned int channel_count;
+
+    /* may be lowered, but not raised past the shortest latency */
+    unsigned int quantum;
+    unsigned int quanta;
+    unsigned int time;
+} dcoy_cluster;
+
+
+/* Instance management */
+
+dcoy_cluster *dcoy_cluster_create ();
+void dcoy_cluster_destroy (dcoy_cluster *c);
+
+
+/* Building - add returns the new node's index, or -1 on error.
+ * connect attaches a link device to each of two nodes, and returns
+ * false on error. */
+
+int dcoy_cluster_add (dcoy_cluster *c, dcoy_dcpu16 *d);
+bool dcoy_cluster_connect (dcoy_cluster *c, unsigned int a, unsigned int b,
+                           unsigned int latency);
+
+
+/* Running - runs every node for at least `cycles` more cycles, rounded
+ * up to whole quanta, on up to `threads` threads (including the calling
+ * one). If threads can't be started, the calling thread does more. */
+
+void dcoy_cluster_run (dcoy_cluster *c, unsigned int cycles,
+                       unsigned int threads);
+
+#endif
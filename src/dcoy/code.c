@@ -148,7 +148,7 @@ const char *dcoy_opcode_names[] = {
     NULL,   NULL,   "ADX",  "SBX",  NULL,   NULL,   "STI",  "STD"
 };
 
-const char *dcoy_special_opcode_names[] = {
+const char *dcoy_spec_opcode_names[] = {
     NULL,   "JSR",  NULL,   NULL,   NULL,   NULL,   NULL,   NULL,
     "INT",  "IAG",  "IAS",  "RFI",  "IAQ",  NULL,   NULL,   NULL,
     "HWN",  "HWQ",  "HWI",  NULL,   NULL,   NULL,   NULL,   NULL,
@@ -193,7 +193,7 @@ void dcoy_inst_write (dcoy_inst inst, char *out) {
     unsigned int op = inst.opcode;
 
     if (inst.special) {
-        const char *mnemonic = op < 0x20 ? dcoy_special_opcode_names[op] : NULL;
+        const char *mnemonic = op < 0x20 ? dcoy_spec_opcode_names[op] : NULL;
 
         char a_dis[32];
         dcoy_arg_write(inst.a, false, a_dis);
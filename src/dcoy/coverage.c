@@ -0,0 +1,81 @@
+/**
+ * dcoy/coverage.c
+ *
+ * Edge coverage maps - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/coverage.h"
+#include "dcoy/dcpu.h"
+
+uint8_t *dcoy_coverage_create () {
+    return calloc(DCOY_COVERAGE_SIZE, 1);
+}
+
+
+void dcoy_coverage_destroy (uint8_t *map) {
+    free(map);
+}
+
+
+void dcoy_coverage_clear (uint8_t *map) {
+    memset(map, 0, DCOY_COVERAGE_SIZE);
+}
+
+
+/* Merging and summaries */
+
+/* Adds map's counts into total, saturating rather than wrapping.
+ * Returns true if map hit any edge total hadn't seen yet. */
+bool dcoy_coverage_merge (uint8_t *total, const uint8_t *map) {
+    bool new_edges = false;
+
+    for (unsigned int i = 0; i < DCOY_COVERAGE_SIZE; i++) {
+        if (map[i] == 0) continue;
+
+        if (total[i] == 0) new_edges = true;
+        unsigned int sum = total[i] + map[i];
+        total[i] = sum > 0xff ? 0xff : sum;
+    }
+
+    return new_edges;
+}
+
+
+unsigned int dcoy_coverage_count (const uint8_t *map) {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < DCOY_COVERAGE_SIZE; i++) {
+        if (map[i]) count++;
+    }
+    return count;
+}
+
+
+/* Export */
+
+bool dcoy_coverage_write (const uint8_t *map, FILE *out) {
+    return fwrite(map, 1, DCOY_COVERAGE_SIZE, out) == DCOY_COVERAGE_SIZE;
+}
+
+
+bool dcoy_coverage_read (uint8_t *map, FILE *in) {
+    return fread(map, 1, DCOY_COVERAGE_SIZE, in) == DCOY_COVERAGE_SIZE;
+}
+
+
+bool dcoy_coverage_write_text (const uint8_t *map, FILE *out) {
+    for (unsigned int i = 0; i < DCOY_COVERAGE_SIZE; i++) {
+        if (map[i] && fprintf(out, "%04x %u\n", i, map[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+/**
+ * dcoy/coverage.h
+ *
+ * Edge coverage maps - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_coverage_h
+#define _dcoy_coverage_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+
+/* A map is DCOY_COVERAGE_SIZE hit counters, indexed by hashed edge.
+ * Counters wrap around, as in AFL. */
+
+uint8_t *dcoy_coverage_create ();
+void dcoy_coverage_destroy (uint8_t *map);
+void dcoy_coverage_clear (uint8_t *map);
+
+#define dcoy_coverage_attach(d, map) \
+    ((d)->coverage = (map), (d)->coverage_prev = 0)
+#define dcoy_coverage_detach(d) ((d)->coverage = NULL)
+
+
+/* Merging and summaries */
+
+bool dcoy_coverage_merge (uint8_t *total, const uint8_t *map);
+unsigned int dcoy_coverage_count (const uint8_t *map);
+
+
+/* Export - raw maps, or text with one "edge count" line per hit edge */
+
+bool dcoy_coverage_write (const uint8_t *map, FILE *out);
+bool dcoy_coverage_read (uint8_t *map, FILE *in);
+bool dcoy_coverage_write_text (const uint8_t *map, FILE *out);
+
+#endif
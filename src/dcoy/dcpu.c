@@ -7,6 +7,7 @@
  * Released under the MIT license - see LICENSE for details
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -33,11 +34,42 @@ dcoy_dcpu16 *dcoy_dcpu_create () {
 
 
 void dcoy_dcpu_initialize (dcoy_dcpu16 *d) {
+    /* Note that this forgets any attached hardware without freeing it */
     memset(d, 0, sizeof(dcoy_dcpu16));
     initialize(d);
 }
 
 
+void dcoy_dcpu_destroy (dcoy_dcpu16 *d) {
+    /* Devices belong to the host, only our list of them is freed */
+    free(d->hardware);
+    free(d);
+}
+
+
+int dcoy_dcpu_load_image (dcoy_word *mem, unsigned int size,
+                          const char *filename) {
+    FILE *fd = fopen(filename, "r");
+    if (!fd) {
+        return -1;
+    }
+
+    size_t bytes = fread(mem, 1, (size_t)size * sizeof(dcoy_word), fd);
+    int failed = ferror(fd) ? errno : 0;
+    fclose(fd);
+
+    if (failed) {
+        errno = failed;
+        return -1;
+    }
+    if (bytes % sizeof(dcoy_word)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return bytes / sizeof(dcoy_word);
+}
+
+
 /* Errors */
 
 void dcoy_dcpu_error_set (dcoy_dcpu16 *d, unsigned int code,
@@ -73,27 +105,84 @@ unsigned int dcoy_dcpu_step (dcoy_dcpu16 *d) {
     dcoy_inst inst;
     unsigned int inst_size = dcoy_dcpu_read_pc(&inst, d);
     d->pc += inst_size;
+    dcoy_word next = d->pc;
 
     /* Run the instruction and incur the cost. */
     unsigned int cost = dcoy_dcpu_exec(d, inst);
     d->cycles += cost;
+    d->retired++;
 
     /* Trigger one interrupt after each instruction.
      * This provides the most predictable behavior, since it means
      * INT instructions take effect immediately, and the host will
-     * be able to see the interrupted state. */
-    dcoy_dcpu_interrupt_trigger(d);
+     * be able to see the interrupted state. Not if the instruction
+     * yielded, though, since the host should see the guest's. */
+    if (!dcoy_dcpu_yielded(d)) {
+        dcoy_dcpu_interrupt_trigger(d);
+    }
+
+    dcoy_dcpu_coverage(d, inst, next);
+
+    /* Fire any timed events that have come due. Interrupts they raise
+     * are delivered after the next instruction. */
+    if (dcoy_dcpu_events_due(d)) {
+        dcoy_dcpu_events_run(d);
+    }
 
     return cost;
 }
 
 
+/* Interpreter variants */
+
+static unsigned int (*const runners[DCOY_DCPU_VARIANT_COUNT])
+        (dcoy_dcpu16 *d, unsigned int steps) = {
+    dcoy_dcpu_run_full,
+    dcoy_dcpu_run_no_cycles,
+    dcoy_dcpu_run_no_interrupts,
+    dcoy_dcpu_run_trap,
+    dcoy_dcpu_run_fast
+};
+
+
+const char *const dcoy_dcpu_variant_names[DCOY_DCPU_VARIANT_COUNT] = {
+    "full", "no-cycles", "no-interrupts", "trap", "fast"
+};
+
+
+unsigned int dcoy_dcpu_run (dcoy_dcpu16 *d, unsigned int steps) {
+    unsigned int v = d->variant < DCOY_DCPU_VARIANT_COUNT
+                   ? d->variant : DCOY_DCPU_VARIANT_FULL;
+    return runners[v](d, steps);
+}
+
+
+int dcoy_dcpu_variant_find (const char *name) {
+    char *end;
+    unsigned long v = strtoul(name, &end, 0);
+    if (*name && *end == '\0') {
+        return v < DCOY_DCPU_VARIANT_COUNT ? (int)v : -1;
+    }
+
+    for (int i = 0; i < DCOY_DCPU_VARIANT_COUNT; i++) {
+        const char *a = name, *b = dcoy_dcpu_variant_names[i];
+        while (*a && (*a == *b || (*a == '_' && *b == '-'))) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') return i;
+    }
+    return -1;
+}
+
+
 /* Interrupts */
 
 bool dcoy_dcpu_interrupt (dcoy_dcpu16 *d, dcoy_word message) {
     if (d->int_queue_count == DCOY_INT_QUEUE_SIZE) {
         /* queue's already full - ignite the DCPU instead */
         dcoy_dcpu_flag_set(d, DCOY_DCPU_FLAG_ON_FIRE);
+        d->int_dropped++;
         return false;
     } else {
         /* store it at the end of the queue */
@@ -101,6 +190,7 @@ bool dcoy_dcpu_interrupt (dcoy_dcpu16 *d, dcoy_word message) {
                                 % DCOY_INT_QUEUE_SIZE;
         d->int_queue[end] = message;
         d->int_queue_count++;
+        d->int_queued++;
         return true;
     }
 }
@@ -125,10 +215,15 @@ unsigned int dcoy_dcpu_interrupt_trigger (dcoy_dcpu16 *d) {
         dcoy_dcpu_flag_set(d, DCOY_DCPU_FLAG_IAQ);
         /* push PC and A to the stack, in that order */
         d->mem[--d->sp] = d->pc;
+        dcoy_dcpu_dirty(d, d->sp);
+        dcoy_dcpu_heat(d, d->sp, true);
         d->mem[--d->sp] = d->reg[A];
+        dcoy_dcpu_dirty(d, d->sp);
+        dcoy_dcpu_heat(d, d->sp, true);
         /* set A to the message and jump to IA */
         d->reg[A] = message;
         d->pc = d->ia;
+        d->int_delivered++;
         /* the interrupt will be handled when the interpreter resumes */
         return DCOY_DCPU_INT_TRIGGERED;
     } else {
@@ -11,14 +11,17 @@
 #define _dcoy_dcpu_h
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "dcoy/code.h"
 #include "dcoy/specs.h"
+#include "dcoy/dcpu/hardware.h"
 
 /* Execution flags */
 
 #define DCOY_DCPU_FLAG_IAQ          (1 << 0)
 #define DCOY_DCPU_FLAG_HALT         (1 << 4)
 #define DCOY_DCPU_FLAG_ON_FIRE      (1 << 5)
+#define DCOY_DCPU_FLAG_YIELD        (1 << 6)    /* see dcoy/session.h */
 
 #define dcoy_dcpu_flag(d, flag)         ((d)->flags & (flag))
 #define dcoy_dcpu_flag_set(d, flag)     ((d)->flags |= (flag))
@@ -30,6 +33,7 @@
 typedef struct dcoy_dcpu16 {
     unsigned int cycles;
     unsigned int flags;
+    unsigned int variant;
 
     dcoy_word reg[DCOY_REG_COUNT];
     dcoy_word pc;
@@ -37,12 +41,36 @@ typedef struct dcoy_dcpu16 {
     dcoy_word ex;
     dcoy_word ia;
 
+    /* EX is computed lazily - see dcoy_dcpu_ex */
+    unsigned int ex_op;
+    dcoy_word ex_a;
+    dcoy_word ex_b;
+
     dcoy_word mem[DCOY_MEM_WORDS];
 
     dcoy_word int_queue[DCOY_INT_QUEUE_SIZE];
     unsigned int int_queue_start;
     unsigned int int_queue_count;
 
+    dcoy_hardware **hardware;
+    unsigned int hardware_count;
+    unsigned int hardware_size;
+
+    dcoy_dcpu_event *events;
+
+    uint8_t *coverage;
+    dcoy_word coverage_prev;
+
+    uint8_t *dirty;
+    uint8_t *traps;
+    struct dcoy_heatmap *heat;
+
+    /* running totals, which wrap like cycles - see dcoy/metrics.h */
+    unsigned int retired;
+    unsigned int int_queued;
+    unsigned int int_delivered;
+    unsigned int int_dropped;
+
     unsigned int error_code;
     const char *error_message;
     dcoy_word error_data;
@@ -55,6 +83,13 @@ typedef struct dcoy_dcpu16 {
 
 dcoy_dcpu16 *dcoy_dcpu_create ();
 void dcoy_dcpu_initialize (dcoy_dcpu16 *d);
+void dcoy_dcpu_destroy (dcoy_dcpu16 *d);
+
+/* Reads an image of raw words, in host byte order, into up to `size`
+ * words of `mem`. Returns the number of words read, or -1 with errno
+ * set if the file couldn't be read or ends partway through a word. */
+int dcoy_dcpu_load_image (dcoy_word *mem, unsigned int size,
+                          const char *filename);
 
 
 /* Errors */
@@ -82,15 +117,149 @@ void dcoy_dcpu_error_clear (dcoy_dcpu16 *d);
 unsigned int dcoy_dcpu_exec (dcoy_dcpu16 *d, dcoy_inst inst);
 
 
+/* EX
+ * Arithmetic instructions only record their opcode in ex_op and their
+ * operands in ex_a/ex_b, since EX is usually overwritten before anyone
+ * reads it. While ex_op is nonzero, the ex field is stale, so hosts
+ * should always read EX through dcoy_dcpu_ex. */
+
+/* implemented in dcoy/dcpu/exec.c */
+dcoy_word dcoy_dcpu_ex_resolve (dcoy_dcpu16 *d);
+
+#define dcoy_dcpu_ex(d) ((d)->ex_op ? dcoy_dcpu_ex_resolve(d) : (d)->ex)
+#define dcoy_dcpu_ex_set(d, value)  ((d)->ex_op = 0, (d)->ex = (value))
+
+
 /* Interpreter loop */
 
 unsigned int dcoy_dcpu_step (dcoy_dcpu16 *d);
 
+
+/* Dirty pages
+ * While d->dirty points to DCOY_DCPU_PAGES bytes, every write to memory
+ * by the DCPU (or by a device, through dcoy_dcpu_dirty_range) sets the
+ * byte for the page it landed in. The host clears them. */
+
+#define DCOY_DCPU_PAGE_WORDS    256
+#define DCOY_DCPU_PAGES         (DCOY_MEM_WORDS / DCOY_DCPU_PAGE_WORDS)
+
+#define dcoy_dcpu_dirty(d, addr) do { \
+    if ((d)->dirty) (d)->dirty[(dcoy_word)(addr) / DCOY_DCPU_PAGE_WORDS] = 1; \
+} while (0)
+
+#define dcoy_dcpu_dirty_range(d, addr, words) do { \
+    if ((d)->dirty) { \
+        for (unsigned int i_ = 0; i_ < (words); i_ += DCOY_DCPU_PAGE_WORDS) \
+            dcoy_dcpu_dirty((d), (addr) + i_); \
+        dcoy_dcpu_dirty((d), (addr) + (words) - 1); \
+    } \
+} while (0)
+
+
+/* Heatmaps
+ * While d->heat points to a heatmap (see dcoy/heatmap.h), every read
+ * and write of memory by an operand, stack push or pop, or interrupt is
+ * counted in it. Instruction fetches are not. */
+
+struct dcoy_heatmap;
+
+/* implemented in dcoy/heatmap.c */
+void dcoy_heatmap_access (struct dcoy_heatmap *h, dcoy_word addr,
+                          unsigned int cycles, bool write);
+
+#define dcoy_dcpu_heat(d, addr, write) do { \
+    if ((d)->heat) \
+        dcoy_heatmap_access((d)->heat, (addr), (d)->cycles, (write)); \
+} while (0)
+
+
+/* Traps
+ * While d->traps points to a DCOY_DCPU_TRAPS_SIZE byte bitmap with a
+ * bit per address, dcoy_dcpu_run yields just before running an
+ * instruction at any address whose bit is set. dcoy_dcpu_step ignores
+ * them, so the host can step past the one it stopped at. */
+
+#define DCOY_DCPU_TRAPS_SIZE    (DCOY_MEM_WORDS / 8)
+
+#define dcoy_dcpu_trapped(d, addr) ((d)->traps && \
+    (d)->traps[(dcoy_word)(addr) / 8] >> ((addr) % 8) & 1)
+
+
+/* Coverage
+ * While d->coverage points to a DCOY_COVERAGE_SIZE byte map (see
+ * dcoy/coverage.h), the interpreter counts hits on each edge between
+ * basic blocks in it, AFL style. An edge is recorded whenever control
+ * doesn't simply fall through to the next instruction, and after every
+ * IF, since both of its outcomes start a new block. */
+
+#define DCOY_COVERAGE_SIZE  0x10000
+#define DCOY_COVERAGE_HASH  40503u  /* scatters nearby addresses */
+
+#define dcoy_dcpu_coverage_branch(inst) (!(inst).special && \
+    (inst).opcode >= DCOY_OP_IFB && (inst).opcode <= DCOY_OP_IFU)
+
+#define dcoy_dcpu_coverage_edge(d) do { \
+    dcoy_word cur_ = (dcoy_word)((d)->pc * DCOY_COVERAGE_HASH); \
+    (d)->coverage[cur_ ^ (d)->coverage_prev]++; \
+    (d)->coverage_prev = cur_ >> 1; \
+} while (0)
+
+#define dcoy_dcpu_coverage(d, inst, next) do { \
+    if ((d)->coverage && ((d)->pc != (next) || \
+                          dcoy_dcpu_coverage_branch(inst))) { \
+        dcoy_dcpu_coverage_edge(d); \
+    } \
+} while (0)
+
+
+/* Interpreter variants
+ * dcoy_dcpu_run executes up to `steps` instructions (stopping early if
+ * the DCPU halts or yields) with the variant selected by d->variant, and returns
+ * how many it executed. Each variant is a separate build of
+ * dcoy/dcpu/exec.c, specialized to leave out what it doesn't need. */
+
+#define DCOY_DCPU_VARIANT_FULL          0   /* same as dcoy_dcpu_step */
+#define DCOY_DCPU_VARIANT_NO_CYCLES     1   /* no cycles or timed events */
+#define DCOY_DCPU_VARIANT_NO_INTERRUPTS 2   /* interrupts never trigger */
+#define DCOY_DCPU_VARIANT_TRAP          3   /* errors set only code and PC */
+#define DCOY_DCPU_VARIANT_FAST          4   /* all of the above */
+#define DCOY_DCPU_VARIANT_COUNT         5
+
+unsigned int dcoy_dcpu_run (dcoy_dcpu16 *d, unsigned int steps);
+
+/* A variant out of range runs as DCOY_DCPU_VARIANT_FULL. find looks up
+ * a variant by name, or by number, and returns -1 if there's no such
+ * variant; names may be spelled with - or _. */
+extern const char *const dcoy_dcpu_variant_names[DCOY_DCPU_VARIANT_COUNT];
+int dcoy_dcpu_variant_find (const char *name);
+
+#define dcoy_dcpu_variant_set(d, v) ((d)->variant = (v))
+#define dcoy_dcpu_variant_counts_cycles(v) \
+    ((v) != DCOY_DCPU_VARIANT_NO_CYCLES && (v) != DCOY_DCPU_VARIANT_FAST)
+#define dcoy_dcpu_variant_takes_interrupts(v) \
+    ((v) != DCOY_DCPU_VARIANT_NO_INTERRUPTS && (v) != DCOY_DCPU_VARIANT_FAST)
+#define dcoy_dcpu_variant_reports_errors(v) \
+    ((v) != DCOY_DCPU_VARIANT_TRAP && (v) != DCOY_DCPU_VARIANT_FAST)
+
+/* implemented in dcoy/dcpu/exec.c, once per variant */
+unsigned int dcoy_dcpu_run_full (dcoy_dcpu16 *d, unsigned int steps);
+unsigned int dcoy_dcpu_run_no_cycles (dcoy_dcpu16 *d, unsigned int steps);
+unsigned int dcoy_dcpu_run_no_interrupts (dcoy_dcpu16 *d, unsigned int steps);
+unsigned int dcoy_dcpu_run_trap (dcoy_dcpu16 *d, unsigned int steps);
+unsigned int dcoy_dcpu_run_fast (dcoy_dcpu16 *d, unsigned int steps);
+
 #define dcoy_dcpu_running(d)    (!dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_HALT))
 #define dcoy_dcpu_halted(d)     dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_HALT)
 #define dcoy_dcpu_halt(d)       dcoy_dcpu_flag_set(d, DCOY_DCPU_FLAG_HALT)
 #define dcoy_dcpu_unhalt(d)     dcoy_dcpu_flag_clear(d, DCOY_DCPU_FLAG_CLEAR)
 
+/* Yielding hands control back to the host after the current
+ * instruction, without triggering interrupts, until it clears the flag */
+#define dcoy_dcpu_yield(d)      dcoy_dcpu_flag_set(d, DCOY_DCPU_FLAG_YIELD)
+#define dcoy_dcpu_yielded(d)    dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_YIELD)
+#define dcoy_dcpu_ready(d) \
+    (!dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_HALT | DCOY_DCPU_FLAG_YIELD))
+
 
 /* Interrupts */
 
@@ -106,4 +275,26 @@ unsigned int dcoy_dcpu_interrupt_trigger (dcoy_dcpu16 *d);
     (d)->int_queue_count && !dcoy_dcpu_flag((d), DCOY_DCPU_FLAG_IAQ) \
 )
 
+
+/* Hardware - implemented in dcoy/dcpu/hardware.c */
+
+bool dcoy_dcpu_hardware_attach (dcoy_dcpu16 *d, dcoy_hardware *hw);
+
+#define dcoy_dcpu_hardware(d, index) \
+    ((index) < (d)->hardware_count ? (d)->hardware[(index)] : NULL)
+
+
+/* Timed events - implemented in dcoy/dcpu/hardware.c */
+
+void dcoy_dcpu_schedule (dcoy_dcpu16 *d, dcoy_dcpu_event *ev,
+                         unsigned int delay);
+void dcoy_dcpu_unschedule (dcoy_dcpu16 *d, dcoy_dcpu_event *ev);
+void dcoy_dcpu_events_run (dcoy_dcpu16 *d);
+
+/* The cycle counter is allowed to wrap, so compare by difference */
+#define dcoy_dcpu_cycles_reached(d, at) ((int)((d)->cycles - (at)) >= 0)
+
+#define dcoy_dcpu_events_due(d) \
+    ((d)->events && dcoy_dcpu_cycles_reached((d), (d)->events->at))
+
 #endif
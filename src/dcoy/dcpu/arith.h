@@ -0,0 +1,37 @@
+/**
+ * dcoy/dcpu/arith.h
+ *
+ * Arithmetic helpers shared by the interpreter and compiled code
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_dcpu_arith_h
+#define _dcoy_dcpu_arith_h
+
+#include "dcoy/specs.h"
+
+/* Operands are promoted to int, so shifting them can overflow or shift
+ * by more than the width of the type. These spell out what the
+ * interpreter has always done on x86: shift amounts are taken modulo 32,
+ * and left shifts wrap around. That way the same expression gives the
+ * same answer whether its operands are known at compile time or not.
+ * DCOY_ASHR only sees the sign of 32 bit values, so a word - promoted
+ * to a positive int - is always shifted logically. */
+
+#define DCOY_SIGN(word)     ((dcoy_sword) (word))
+
+#define DCOY_SHL(v, by)     ((dcoy_sdword) ((dcoy_dword) (v) << ((by) & 31)))
+#define DCOY_SHR(v, by)     ((v) >> ((by) & 31))
+#define DCOY_ASHR(v, by)    (((dcoy_dword) (v) >> 31 && (by) > 0) \
+                                ? DCOY_SHR(v, by) | ((v) & 0x8000) \
+                                : DCOY_SHR(v, by))
+
+#define DCOY_MUL(b, a)      ((dcoy_dword) (b) * (a))
+
+/* signed division, except that -2^31 / -1 wraps instead of trapping */
+#define DCOY_SDIV(n, d)     ((d) == -1 ? (dcoy_sdword) (0u - (dcoy_dword) (n)) \
+                                       : (n) / (d))
+
+#endif
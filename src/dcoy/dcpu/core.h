@@ -0,0 +1,390 @@
+/**
+ * dcoy/dcpu/core.h
+ *
+ * What each instruction does - shared by the interpreter variants in
+ * dcoy/dcpu/exec.c and the C++ front end in dcoy/machine.hpp
+ *
+ * This is not an ordinary header: it defines get, set, skip and exec,
+ * and is included once wherever they're needed - at file scope in C,
+ * where they're static, or inside a class template in C++, where they
+ * become members. Anything that touches memory or hardware goes
+ * through these macros, which the includer may define first:
+ *
+ *   DCOY_CORE_LOAD(d, addr)            the word an operand reads
+ *   DCOY_CORE_STORE(d, addr, value)    stores a word an operand writes
+ *   DCOY_CORE_HARDWARE_COUNT(d)        what HWN returns
+ *   DCOY_CORE_HARDWARE(d, index)       the dcoy_hardware for HWQ, or NULL
+ *   DCOY_CORE_HWI(d, index, hw)        sends HWI, returning extra cycles
+ *
+ * The JSR push and the RFI pops use them too. The defaults use d's
+ * memory and hardware list, just as the rest of the library does.
+ * DCOY_EXEC_NO_CYCLES and DCOY_EXEC_TRAP work as in exec.c. All of
+ * these macros, and the ones it uses internally, are undefined at the
+ * end, so C++ users don't see them.
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifdef __cplusplus
+#define DCOY_CORE_FUNCTION  inline
+#else
+#define DCOY_CORE_FUNCTION  static inline
+#endif
+
+#ifndef DCOY_CORE_LOAD
+#define DCOY_CORE_LOAD(d, addr)             ((d)->mem[(addr)])
+#endif
+#ifndef DCOY_CORE_STORE
+#define DCOY_CORE_STORE(d, addr, value)     ((d)->mem[(addr)] = (value))
+#endif
+#ifndef DCOY_CORE_HARDWARE_COUNT
+#define DCOY_CORE_HARDWARE_COUNT(d)         ((d)->hardware_count)
+#endif
+#ifndef DCOY_CORE_HARDWARE
+#define DCOY_CORE_HARDWARE(d, index)        dcoy_dcpu_hardware((d), (index))
+#endif
+#ifndef DCOY_CORE_HWI
+#define DCOY_CORE_HWI(d, index, hw)         ((hw)->interrupt((d), (hw)))
+#endif
+
+#ifdef DCOY_EXEC_TRAP
+#undef dcoy_dcpu_error
+#define dcoy_dcpu_error(d, error, data) do { \
+    (d)->error_code = DCOY_DCPU_ERROR_##error; (d)->error_pc = (d)->pc; \
+    dcoy_dcpu_halt(d); \
+} while (0)
+#endif
+
+DCOY_CORE_FUNCTION dcoy_word get (dcoy_dcpu16 *d, dcoy_arg arg) {
+    dcoy_word addr;
+
+    /* registers and literals are returned right away, memory below */
+    switch (arg.type) {
+        case DCOY_ARG_RVALUE:   return d->reg[arg.reg];
+        case DCOY_ARG_RLOOKUP:  addr = d->reg[arg.reg];                 break;
+        case DCOY_ARG_ROFFSET:  addr = d->reg[arg.reg] + arg.data;      break;
+        case DCOY_ARG_PUSHPOP:  addr = d->sp++;                         break;
+        case DCOY_ARG_PEEK:     addr = d->sp;                           break;
+        case DCOY_ARG_PICK:     addr = d->sp + arg.data;                break;
+        case DCOY_ARG_SP:       return d->sp;
+        case DCOY_ARG_PC:       return d->pc;
+        case DCOY_ARG_EX:       return dcoy_dcpu_ex(d);
+        case DCOY_ARG_LOOKUP:   addr = arg.data;                        break;
+        case DCOY_ARG_VALUE:
+        case DCOY_ARG_IVALUE:   return arg.data;
+        default:                dcoy_dcpu_error(d, INVALID_ARG_TYPE, arg.type);
+                                return 0;
+    }
+
+    dcoy_dcpu_heat(d, addr, false);
+    return DCOY_CORE_LOAD(d, addr);
+}
+
+
+DCOY_CORE_FUNCTION void set (dcoy_dcpu16 *d, dcoy_arg arg,
+                             dcoy_word value) {
+    dcoy_word addr;
+
+    /* registers are set right away, memory below */
+    switch (arg.type) {
+        case DCOY_ARG_RVALUE:   d->reg[arg.reg] = value;                return;
+        case DCOY_ARG_RLOOKUP:  addr = d->reg[arg.reg];                 break;
+        case DCOY_ARG_ROFFSET:  addr = d->reg[arg.reg] + arg.data;      break;
+        case DCOY_ARG_PUSHPOP:  addr = --d->sp;                         break;
+        case DCOY_ARG_PEEK:     addr = d->sp;                           break;
+        case DCOY_ARG_PICK:     addr = d->sp + arg.data;                break;
+        case DCOY_ARG_SP:       d->sp = value;                          return;
+        case DCOY_ARG_PC:       d->pc = value;                          return;
+        case DCOY_ARG_EX:       dcoy_dcpu_ex_set(d, value);             return;
+        case DCOY_ARG_LOOKUP:   addr = arg.data;                        break;
+        case DCOY_ARG_VALUE:
+        case DCOY_ARG_IVALUE:   return;
+        default:                dcoy_dcpu_error(d, INVALID_ARG_TYPE, arg.type);
+                                return;
+    }
+
+    DCOY_CORE_STORE(d, addr, value);
+    dcoy_dcpu_dirty(d, addr);
+    dcoy_dcpu_heat(d, addr, true);
+}
+
+
+DCOY_CORE_FUNCTION void skip (dcoy_dcpu16 *d, unsigned int *cost) {
+    dcoy_inst next;
+    unsigned int skipped = 0;
+
+    do {
+        d->pc += dcoy_dcpu_read_pc(&next, d);
+        skipped++;
+    } while (next.opcode >= DCOY_OP_IFB && next.opcode <= DCOY_OP_IFU);
+
+    *cost += skipped - 1;
+}
+
+
+#ifdef DCOY_EXEC_TRAP
+#define GUARD_ERROR do {} while (0)
+#else
+#define GUARD_ERROR if ((d)->error_code) return 0
+#endif
+
+#define SIGN(word)  DCOY_SIGN(word)
+#define ashr(v, by) DCOY_ASHR(v, by)
+
+#define USE_A do {a = get(d, inst.a); GUARD_ERROR;} while (0)
+#define USE_B do {b = get(d, inst.b); GUARD_ERROR;} while (0)
+
+/* break_res sets b to res and breaks */
+#define break_res set(d, inst.b, res); GUARD_ERROR; break
+/* break_lazy sets b to res, then leaves EX to be computed from a and b */
+#define break_lazy set(d, inst.b, res); GUARD_ERROR; \
+                   d->ex_op = inst.opcode; d->ex_a = a; d->ex_b = b; break
+/* break_math sets b to res, then EX to ex, and breaks */
+#define break_math set(d, inst.b, res); GUARD_ERROR; \
+                   dcoy_dcpu_ex_set(d, ex); break
+
+#ifndef DCOY_EXEC_NO_CYCLES
+#define BASE_COST(inst) dcoy_inst_base_cost(inst)
+#else
+#define BASE_COST(inst) 0
+#endif
+
+#define OP(name)    DCOY_OP_##name
+#define SOP(name)   DCOY_SOP_##name
+#define REG(name)   d->reg[DCOY_REG_##name]
+
+
+DCOY_CORE_FUNCTION unsigned int exec (dcoy_dcpu16 *d, dcoy_inst inst) {
+    unsigned int cost = BASE_COST(inst);
+
+    if (!inst.special) {
+        /* Standard opcode */
+        dcoy_word a = 0, b = 0;
+        dcoy_dword res = 0;
+        dcoy_word ex = 0;
+
+        switch (inst.opcode) {
+            case OP(SET):   USE_A;
+                            set(d, inst.b, a);
+                            break;
+
+            case OP(ADD):   USE_A; USE_B;
+                            res = a + b;
+                            break_lazy;
+
+            case OP(SUB):   USE_A; USE_B;
+                            res = b - a;
+                            break_lazy;
+
+            case OP(MUL):   USE_A; USE_B;
+                            res = DCOY_MUL(b, a);
+                            break_lazy;
+
+            case OP(MLI):   USE_A; USE_B;
+                            res = SIGN(b) * SIGN(a);
+                            break_lazy;
+
+            case OP(DIV):   USE_A; USE_B;
+                            if (a == 0) {
+                                res = 0;
+                            } else {
+                                res = b / a;
+                            }
+                            break_lazy;
+
+            case OP(DVI):   USE_A; USE_B;
+                            if (a == 0) {
+                                res = 0;
+                            } else {
+                                dcoy_sword sa = SIGN(a), sb = SIGN(b);
+                                res = sb / sa;
+                            }
+                            break_lazy;
+
+            case OP(MOD):   USE_A; USE_B;
+                            res = a == 0 ? 0 : b % a;
+                            break_res;
+
+            case OP(MDI):   USE_A; USE_B;
+                            res = a == 0 ? 0 : SIGN(b) % SIGN(a);
+                            break_res;
+
+            case OP(AND):   USE_A; USE_B;
+                            res = b & a;
+                            break_res;
+
+            case OP(BOR):   USE_A; USE_B;
+                            res = b | a;
+                            break_res;
+
+            case OP(XOR):   USE_A; USE_B;
+                            res = b ^ a;
+                            break_res;
+
+            case OP(SHR):   USE_A; USE_B;
+                            res = DCOY_SHR(b, a);
+                            break_lazy;
+
+            case OP(ASR):   USE_A; USE_B;
+                            res = ashr(b, a);
+                            break_lazy;
+
+            case OP(SHL):   USE_A; USE_B;
+                            res = DCOY_SHL(b, a);
+                            break_lazy;
+
+            case OP(IFB):   USE_A; USE_B;
+                            if (!(b & a)) skip(d, &cost);
+                            break;
+
+            case OP(IFC):   USE_A; USE_B;
+                            if (b & a) skip(d, &cost);
+                            break;
+
+            case OP(IFE):   USE_A; USE_B;
+                            if (b != a) skip(d, &cost);
+                            break;
+
+            case OP(IFN):   USE_A; USE_B;
+                            if (b == a) skip(d, &cost);
+                            break;
+
+            case OP(IFG):   USE_A; USE_B;
+                            if (b <= a) skip(d, &cost);
+                            break;
+
+            case OP(IFA):   USE_A; USE_B;
+                            if (SIGN(b) <= SIGN(a)) skip(d, &cost);
+                            break;
+
+            case OP(IFL):   USE_A; USE_B;
+                            if (b >= a) skip(d, &cost);
+                            break;
+
+            case OP(IFU):   USE_A; USE_B;
+                            if (SIGN(b) >= SIGN(a)) skip(d, &cost);
+                            break;
+
+            case OP(ADX):   USE_A; USE_B;
+                            res = a + b + dcoy_dcpu_ex(d);
+                            ex = res >> 16;
+                            break_math;
+
+            case OP(SBX):   USE_A; USE_B;
+                            res = b - a + dcoy_dcpu_ex(d);
+                            ex = res >> 16;
+                            break_math;
+
+            case OP(STI):   USE_A;
+                            set(d, inst.b, a);
+                            REG(I)++;
+                            REG(J)++;
+                            break;
+
+            case OP(STD):   USE_A;
+                            set(d, inst.b, a);
+                            REG(I)--;
+                            REG(J)--;
+                            break;
+
+            default:        dcoy_dcpu_error(d, INVALID_OPCODE, inst.opcode);
+                            break;
+        }
+
+    } else {
+        dcoy_word a = 0;
+        dcoy_hardware *hw;
+
+        switch (inst.opcode) {
+            case SOP(JSR):  USE_A;
+                            --d->sp;
+                            DCOY_CORE_STORE(d, d->sp, d->pc);
+                            dcoy_dcpu_dirty(d, d->sp);
+                            dcoy_dcpu_heat(d, d->sp, true);
+                            d->pc = a;
+                            break;
+
+            case SOP(INT):  USE_A;
+                            dcoy_dcpu_interrupt(d, a);
+                            break;
+
+            case SOP(IAG):  set(d, inst.a, d->ia);
+                            break;
+
+            case SOP(IAS):  USE_A;
+                            d->ia = a;
+                            break;
+
+            case SOP(RFI):  dcoy_dcpu_flag_unset(d, DCOY_DCPU_FLAG_IAQ);
+                            /* pop A, then PC */
+                            dcoy_dcpu_heat(d, d->sp, false);
+                            REG(A) = DCOY_CORE_LOAD(d, d->sp);
+                            d->sp++;
+                            dcoy_dcpu_heat(d, d->sp, false);
+                            d->pc = DCOY_CORE_LOAD(d, d->sp);
+                            d->sp++;
+                            break;
+
+            case SOP(IAQ):  USE_A;
+                            if (a) {
+                                dcoy_dcpu_flag_set(d, DCOY_DCPU_FLAG_IAQ);
+                            } else {
+                                dcoy_dcpu_flag_unset(d, DCOY_DCPU_FLAG_IAQ);
+                            }
+                            break;
+
+            case SOP(HWN):  set(d, inst.a, DCOY_CORE_HARDWARE_COUNT(d));
+                            break;
+
+            case SOP(HWQ):  USE_A;
+                            hw = DCOY_CORE_HARDWARE(d, a);
+                            if (hw == NULL) {
+                                dcoy_dcpu_error(d, NO_HARDWARE, a);
+                                break;
+                            }
+                            REG(A) = hw->id & 0xffff;
+                            REG(B) = hw->id >> 16;
+                            REG(C) = hw->version;
+                            REG(X) = hw->manufacturer & 0xffff;
+                            REG(Y) = hw->manufacturer >> 16;
+                            break;
+
+            case SOP(HWI):  USE_A;
+                            hw = DCOY_CORE_HARDWARE(d, a);
+                            if (hw == NULL) {
+                                dcoy_dcpu_error(d, NO_HARDWARE, a);
+                                break;
+                            }
+                            cost += DCOY_CORE_HWI(d, a, hw);
+                            break;
+
+            default:        dcoy_dcpu_error(d, INVALID_SPEC_OPCODE,
+                                            inst.opcode);
+                            break;
+        }
+    }
+
+    return d->error_code ? 0 : cost;
+}
+
+
+#undef DCOY_CORE_FUNCTION
+#undef DCOY_CORE_LOAD
+#undef DCOY_CORE_STORE
+#undef DCOY_CORE_HARDWARE_COUNT
+#undef DCOY_CORE_HARDWARE
+#undef DCOY_CORE_HWI
+
+#undef GUARD_ERROR
+#undef SIGN
+#undef ashr
+#undef USE_A
+#undef USE_B
+#undef break_res
+#undef break_lazy
+#undef break_math
+#undef BASE_COST
+#undef OP
+#undef SOP
+#undef REG
@@ -23,4 +23,8 @@
 #define DCOY_DCPU_ERROR_INVALID_ARG_TYPE        0x14    /* data: argument type */
 #define DCOY_DCPU_ERROR_MSG_INVALID_ARG_TYPE    "Invalid argument type"
 
+/* 0x2_: Hardware errors */
+#define DCOY_DCPU_ERROR_NO_HARDWARE             0x20    /* data: device index */
+#define DCOY_DCPU_ERROR_MSG_NO_HARDWARE         "No such hardware device"
+
 #endif
@@ -3,6 +3,20 @@
  *
  * The core of the interpreter loop - implementation
  *
+ * This file is compiled once for each interpreter variant, with
+ * DCOY_EXEC_VARIANT naming the variant and these flags selecting what
+ * it leaves out (see the Makefile):
+ *
+ *   DCOY_EXEC_NO_CYCLES        no cycle accounting, and so no timed events
+ *   DCOY_EXEC_NO_INTERRUPTS    interrupts are queued but never triggered
+ *   DCOY_EXEC_TRAP             errors only set error_code and error_pc
+ *                              and halt, and are not checked for after
+ *                              every operand
+ *
+ * Without DCOY_EXEC_VARIANT, it builds the full interpreter, which also
+ * provides dcoy_dcpu_exec and everything else public in here. The
+ * instructions themselves are in dcoy/dcpu/core.h.
+ *
  * (C) 2013, Matthew Frazier
  * Released under the MIT license - see LICENSE for details
  */
@@ -11,270 +25,121 @@
 
 #include "dcoy/code.h"
 #include "dcoy/dcpu.h"
+#include "dcoy/dcpu/arith.h"
 #include "dcoy/constants.h"
 #include "dcoy/opcodes.h"
 
-static dcoy_word get (dcoy_dcpu16 *d, dcoy_arg arg) {
-    switch (arg.type) {
-        case DCOY_ARG_RVALUE:   return d->reg[arg.reg];
-        case DCOY_ARG_RLOOKUP:  return d->mem[d->reg[arg.reg]];
-        case DCOY_ARG_ROFFSET:  return d->mem[
-                                    (dcoy_word)(d->reg[arg.reg] + arg.data)
-                                ];
-        case DCOY_ARG_PUSHPOP:  return d->mem[d->sp++];
-        case DCOY_ARG_PEEK:     return d->mem[d->sp];
-        case DCOY_ARG_PICK:     return d->mem[(dcoy_word)(d->sp + arg.data)];
-        case DCOY_ARG_SP:       return d->sp;
-        case DCOY_ARG_PC:       return d->pc;
-        case DCOY_ARG_EX:       return d->ex;
-        case DCOY_ARG_LOOKUP:   return d->mem[arg.data];
-        case DCOY_ARG_VALUE:
-        case DCOY_ARG_IVALUE:   return arg.data;
-        default:                dcoy_dcpu_error(d, INVALID_ARG_TYPE, arg.type);
-                                return 0;
-    }
-}
+#ifndef DCOY_EXEC_VARIANT
+#define DCOY_EXEC_VARIANT full
+#define DCOY_EXEC_FULL
+#endif
+
+#include "dcoy/dcpu/core.h"
+
+
+#ifdef DCOY_EXEC_FULL
+dcoy_word dcoy_dcpu_ex_resolve (dcoy_dcpu16 *d) {
+    dcoy_word a = d->ex_a, b = d->ex_b;
+    dcoy_dword res = 0;
+    dcoy_word ex = 0;
+
+    switch (d->ex_op) {
+        case ADD:   res = a + b;
+                    ex = res >> 16;
+                    break;
+
+        case SUB:   res = b - a;
+                    ex = res >> 16;
+                    break;
+
+        case MUL:   res = DCOY_MUL(b, a);
+                    ex = (res >> 16) & 0xffff;
+                    break;
+
+        case MLI:   res = DCOY_SIGN(b) * DCOY_SIGN(a);
+                    ex = (res >> 16) & 0xffff;
+                    break;
+
+        case DIV:   if (a != 0) {
+                        ex = (DCOY_SHL(b, 16) / a) & 0xffff;
+                    }
+                    break;
 
+        case DVI:   if (a != 0) {
+                        dcoy_sword sa = DCOY_SIGN(a), sb = DCOY_SIGN(b);
+                        ex = DCOY_SDIV(DCOY_SHL(sb, 16), sa) & 0xffff;
+                    }
+                    break;
 
-static void set (dcoy_dcpu16 *d, dcoy_arg arg, dcoy_word value) {
-    switch (arg.type) {
-        case DCOY_ARG_RVALUE:   d->reg[arg.reg] = value;                break;
-        case DCOY_ARG_RLOOKUP:  d->mem[d->reg[arg.reg]] = value;        break;
-        case DCOY_ARG_ROFFSET:  d->mem[
-                                    (dcoy_word)(d->reg[arg.reg] + arg.data)
-                                ] = value;
-                                break;
-        case DCOY_ARG_PUSHPOP:  d->mem[--d->sp] = value;                break;
-        case DCOY_ARG_PEEK:     d->mem[d->sp] = value;                  break;
-        case DCOY_ARG_PICK:     d->mem[(dcoy_word)(d->sp + arg.data)] = value;
-                                break;
-        case DCOY_ARG_SP:       d->sp = value;                          break;
-        case DCOY_ARG_PC:       d->pc = value;                          break;
-        case DCOY_ARG_EX:       d->ex = value;                          break;
-        case DCOY_ARG_LOOKUP:   d->mem[arg.data] = value;               break;
-        case DCOY_ARG_VALUE:
-        case DCOY_ARG_IVALUE:   break;
-        default:                dcoy_dcpu_error(d, INVALID_ARG_TYPE, arg.type);
-                                break;
+        case SHR:   ex = DCOY_ASHR(DCOY_SHL(b, 16), a) & 0xffff;
+                    break;
+
+        case ASR:   ex = DCOY_SHR(DCOY_SHL(b, 16), a) & 0xffff;
+                    break;
+
+        case SHL:   ex = DCOY_ASHR(DCOY_SHL(b, 16), a) & 0xffff;
+                    break;
+
+        default:    return d->ex;
     }
-}
 
+    dcoy_dcpu_ex_set(d, ex);
+    return ex;
+}
 
-static void skip (dcoy_dcpu16 *d, unsigned int *cost) {
-    dcoy_inst next;
-    unsigned int skipped = 0;
+#endif
 
-    do {
-        d->pc += dcoy_dcpu_read_pc(&next, d);
-        skipped++;
-    } while (next.opcode >= IFB && next.opcode <= IFU);
 
-    *cost += skipped - 1;
+#ifdef DCOY_EXEC_FULL
+unsigned int dcoy_dcpu_exec (dcoy_dcpu16 *d, dcoy_inst inst) {
+    return exec(d, inst);
 }
+#endif
 
 
-#define GUARD_ERROR if ((d)->error_code) return 0
+/* Interpreter loop
+ * Each pass does just what dcoy_dcpu_step does, minus whatever the
+ * variant leaves out. */
 
-#define SIGN(word)  ((dcoy_sword) (word))
-#define ashr(v, by) (((v) < 0 && (by) > 0) ? ((v) >> (by)) | ((v) & 0x8000) \
-                                           : (v) >> (by))
+#define RUN_FUNCTION(variant)   RUN_FUNCTION_(variant)
+#define RUN_FUNCTION_(variant)  dcoy_dcpu_run_##variant
 
-#define USE_A do {a = get(d, inst.a); GUARD_ERROR;} while (0)
-#define USE_B do {b = get(d, inst.b); GUARD_ERROR;} while (0)
+unsigned int RUN_FUNCTION(DCOY_EXEC_VARIANT) (dcoy_dcpu16 *d,
+                                              unsigned int steps) {
+    unsigned int done;
 
-/* break_res sets b to res and breaks */
-#define break_res set(d, inst.b, res); GUARD_ERROR; break
-/* break_res sets b to res, then EX to ex, and breaks */
-#define break_math set(d, inst.b, res); GUARD_ERROR; d->ex = ex; break
+    for (done = 0; done < steps && dcoy_dcpu_ready(d); done++) {
+        if (dcoy_dcpu_trapped(d, d->pc)) {
+            dcoy_dcpu_yield(d);
+            break;
+        }
 
-unsigned int dcoy_dcpu_exec (dcoy_dcpu16 *d, dcoy_inst inst) {
-    unsigned int cost = dcoy_inst_base_cost(inst);
-
-    if (!inst.special) {
-        /* Standard opcode */
-        dcoy_word a = 0, b = 0;
-        dcoy_dword res = 0;
-        dcoy_word ex = 0;
-
-        switch (inst.opcode) {
-            case SET:   USE_A;
-                        set(d, inst.b, a);
-                        break;
-
-            case ADD:   USE_A; USE_B;
-                        res = a + b;
-                        ex = res >> 16;
-                        break_math;
-
-            case SUB:   USE_A; USE_B;
-                        res = b - a;
-                        ex = res >> 16;
-                        break_math;
-
-            case MUL:   USE_A; USE_B;
-                        res = b * a;
-                        ex = (res >> 16) & 0xffff;
-                        break_math;
-
-            case MLI:   USE_A; USE_B;
-                        res = SIGN(b) * SIGN(a);
-                        ex = (res >> 16) & 0xffff;
-                        break_math;
-
-            case DIV:   USE_A; USE_B;
-                        if (a == 0) {
-                            res = 0; ex = 0;
-                        } else {
-                            res = b / a;
-                            ex = ((b << 16) / a) & 0xffff;
-                        }
-                        break_math;
-
-            case DVI:   USE_A; USE_B;
-                        if (a == 0) {
-                            res = 0; ex = 0;
-                        } else {
-                            dcoy_sword sa = SIGN(a), sb = SIGN(b);
-                            res = sb / sa;
-                            ex = ((sb << 16) / sa) & 0xffff;
-                        }
-                        break_math;
-
-            case MOD:   USE_A; USE_B;
-                        res = a == 0 ? 0 : b % a;
-                        break_res;
-
-            case MDI:   USE_A; USE_B;
-                        res = a == 0 ? 0 : SIGN(b) % SIGN(a);
-                        break_res;
-
-            case AND:   USE_A; USE_B;
-                        res = b & a;
-                        break_res;
-
-            case BOR:   USE_A; USE_B;
-                        res = b | a;
-                        break_res;
-
-            case XOR:   USE_A; USE_B;
-                        res = b ^ a;
-                        break_res;
-
-            case SHR:   USE_A; USE_B;
-                        res = b >> a;
-                        ex = ashr((b << 16), a) & 0xffff;
-                        break_math;
-
-            case ASR:   USE_A; USE_B;
-                        res = ashr(b, a);
-                        ex = ((b << 16) >> a) & 0xffff;
-                        break_math;
-
-            case SHL:   USE_A; USE_B;
-                        res = b << a;
-                        ex = ashr((b << 16), a) & 0xffff;
-                        break_math;
-
-            case IFB:   USE_A; USE_B;
-                        if (!(b & a)) skip(d, &cost);
-                        break;
-
-            case IFC:   USE_A; USE_B;
-                        if (b & a) skip(d, &cost);
-                        break;
-
-            case IFE:   USE_A; USE_B;
-                        if (b != a) skip(d, &cost);
-                        break;
-
-            case IFN:   USE_A; USE_B;
-                        if (b == a) skip(d, &cost);
-                        break;
-
-            case IFG:   USE_A; USE_B;
-                        if (b <= a) skip(d, &cost);
-                        break;
-
-            case IFA:   USE_A; USE_B;
-                        if (SIGN(b) <= SIGN(a)) skip(d, &cost);
-                        break;
-
-            case IFL:   USE_A; USE_B;
-                        if (b >= a) skip(d, &cost);
-                        break;
-
-            case IFU:   USE_A; USE_B;
-                        if (SIGN(b) >= SIGN(a)) skip(d, &cost);
-                        break;
-
-            case ADX:   USE_A; USE_B;
-                        res = a + b + d->ex;
-                        ex = res >> 16;
-                        break_math;
-
-            case SBX:   USE_A; USE_B;
-                        res = b - a + d->ex;
-                        ex = res >> 16;
-                        break_math;
-
-            case STI:   USE_A;
-                        set(d, inst.b, a);
-                        d->reg[I]++;
-                        d->reg[J]++;
-                        break;
-
-            case STD:   USE_A;
-                        set(d, inst.b, a);
-                        d->reg[I]--;
-                        d->reg[J]--;
-                        break;
-
-            default:    dcoy_dcpu_error(d, INVALID_OPCODE, inst.opcode);
-                        break;
+        dcoy_inst inst;
+        d->pc += dcoy_dcpu_read_pc(&inst, d);
+        dcoy_word next = d->pc;
+
+        unsigned int cost = exec(d, inst);
+        (void)cost;
+
+#ifndef DCOY_EXEC_NO_CYCLES
+        d->cycles += cost;
+#endif
+
+#ifndef DCOY_EXEC_NO_INTERRUPTS
+        if (d->int_queue_count && !dcoy_dcpu_yielded(d)) {
+            dcoy_dcpu_interrupt_trigger(d);
         }
+#endif
+
+        dcoy_dcpu_coverage(d, inst, next);
 
-    } else {
-        dcoy_word a = 0;
-
-        switch (inst.opcode) {
-            case JSR:   USE_A;
-                        d->mem[--d->sp] = d->pc;
-                        d->pc = a;
-                        break;
-
-            case INT:   USE_A;
-                        dcoy_dcpu_interrupt(d, a);
-                        break;
-
-            case IAG:   set(d, inst.a, d->ia);
-                        break;
-
-            case IAS:   USE_A;
-                        d->ia = a;
-                        break;
-
-            case RFI:   dcoy_dcpu_flag_unset(d, DCOY_DCPU_FLAG_IAQ);
-                        /* pop A, then PC */
-                        d->reg[A] = d->mem[d->sp++];
-                        d->pc = d->mem[d->sp++];
-                        break;
-
-            case IAQ:   USE_A;
-                        if (a) {
-                            dcoy_dcpu_flag_set(d, DCOY_DCPU_FLAG_IAQ);
-                        } else {
-                            dcoy_dcpu_flag_unset(d, DCOY_DCPU_FLAG_IAQ);
-                        }
-                        break;
-
-            case HWN:   break;
-            case HWQ:   break;
-            case HWI:   break;
-
-            default:    dcoy_dcpu_error(d, INVALID_SPEC_OPCODE, inst.opcode);
-                        break;
+#ifndef DCOY_EXEC_NO_CYCLES
+        if (dcoy_dcpu_events_due(d)) {
+            dcoy_dcpu_events_run(d);
         }
+#endif
     }
 
-    return d->error_code ? 0 : cost;
+    d->retired += done;
+    return done;
 }
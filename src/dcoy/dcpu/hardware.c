@@ -0,0 +1,86 @@
+/**
+ * dcoy/dcpu/hardware.c
+ *
+ * Hardware devices and timed events - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Hardware */
+
+bool dcoy_dcpu_hardware_attach (dcoy_dcpu16 *d, dcoy_hardware *hw) {
+    if (d->hardware_count == DCOY_HARDWARE_LIMIT) {
+        return false;
+    }
+
+    if (d->hardware_count == d->hardware_size) {
+        unsigned int size = d->hardware_size ? d->hardware_size * 2 : 4;
+        dcoy_hardware **list = realloc(d->hardware,
+                                       size * sizeof(dcoy_hardware *));
+        if (list == NULL) return false;
+        d->hardware = list;
+        d->hardware_size = size;
+    }
+
+    d->hardware[d->hardware_count++] = hw;
+    return true;
+}
+
+
+/* Timed events
+ * Pending events are kept in a list sorted by due time, so checking
+ * whether anything is due only ever looks at the head. */
+
+void dcoy_dcpu_schedule (dcoy_dcpu16 *d, dcoy_dcpu_event *ev,
+                         unsigned int delay) {
+    if (ev->scheduled) {
+        dcoy_dcpu_unschedule(d, ev);
+    }
+
+    ev->at = d->cycles + delay;
+    ev->scheduled = true;
+
+    /* events due at the same time fire in the order they were scheduled */
+    dcoy_dcpu_event **link = &d->events;
+    while (*link && (int)((*link)->at - ev->at) <= 0) {
+        link = &(*link)->next;
+    }
+
+    ev->next = *link;
+    *link = ev;
+}
+
+
+void dcoy_dcpu_unschedule (dcoy_dcpu16 *d, dcoy_dcpu_event *ev) {
+    dcoy_dcpu_event **link = &d->events;
+    while (*link) {
+        if (*link == ev) {
+            *link = ev->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    ev->next = NULL;
+    ev->scheduled = false;
+}
+
+
+void dcoy_dcpu_events_run (dcoy_dcpu16 *d) {
+    while (dcoy_dcpu_events_due(d)) {
+        dcoy_dcpu_event *ev = d->events;
+        d->events = ev->next;
+        ev->next = NULL;
+        ev->scheduled = false;
+
+        /* the event is free to reschedule itself from here */
+        ev->fire(d, ev);
+    }
+}
@@ -0,0 +1,53 @@
+/**
+ * dcoy/dcpu/hardware.h
+ *
+ * Hardware devices and timed events - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_dcpu_hardware_h
+#define _dcoy_dcpu_hardware_h
+
+#include <stdbool.h>
+#include "dcoy/specs.h"
+
+struct dcoy_dcpu16;
+struct dcoy_snapshot;
+
+
+/* Timed events
+ * An event fires once the DCPU's cycle counter reaches `at`.
+ * The structure is owned by whoever schedules it (usually a device),
+ * so scheduling never allocates. */
+
+typedef struct dcoy_dcpu_event {
+    unsigned int at;
+    bool scheduled;
+    void (*fire) (struct dcoy_dcpu16 *d, struct dcoy_dcpu_event *ev);
+    void *data;
+    struct dcoy_dcpu_event *next;
+} dcoy_dcpu_event;
+
+
+/* Hardware devices
+ * Device implementations embed this as their first member.
+ * `interrupt` is called for HWI, and returns any extra cycles
+ * the interrupt costs beyond the base cost of HWI.
+ * `save` and `load` write and read the device's state in a snapshot
+ * (see dcoy/snapshot.h), and may be NULL if it has none. */
+
+typedef struct dcoy_hardware {
+    dcoy_hardware_id_t id;
+    dcoy_hardware_version_t version;
+    dcoy_hardware_mfid_t manufacturer;
+    unsigned int (*interrupt) (struct dcoy_dcpu16 *d,
+                               struct dcoy_hardware *hw);
+    void (*save) (struct dcoy_dcpu16 *d, struct dcoy_hardware *hw,
+                  struct dcoy_snapshot *snap);
+    bool (*load) (struct dcoy_dcpu16 *d, struct dcoy_hardware *hw,
+                  struct dcoy_snapshot *snap);
+} dcoy_hardware;
+
+#endif
@@ -0,0 +1,417 @@
+/**
+ * dcoy/diff.c
+ *
+ * Lockstep differential checking of execution engines against the
+ * reference interpreter - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/diff.h"
+#include "dcoy/aot.h"
+#include "dcoy/code.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/opcodes.h"
+
+/* flags that are part of the machine's state, rather than the host's */
+#define STATE_FLAGS     (DCOY_DCPU_FLAG_IAQ | DCOY_DCPU_FLAG_HALT | \
+                         DCOY_DCPU_FLAG_ON_FIRE)
+
+#define PAGE_BYTES      (DCOY_DCPU_PAGE_WORDS * sizeof(dcoy_word))
+
+
+/* Engines */
+
+static unsigned int run_variant (dcoy_dcpu16 *d, unsigned int amount,
+                                 void *data) {
+    (void)data;
+    return dcoy_dcpu_run(d, amount);
+}
+
+
+static unsigned int run_aot (dcoy_dcpu16 *d, unsigned int amount,
+                             void *data) {
+    dcoy_aot_run(d, data, amount);
+    return 0;
+}
+
+
+void dcoy_diff_engine_variant (dcoy_diff_engine *e, unsigned int variant) {
+    e->name = variant < DCOY_DCPU_VARIANT_COUNT
+            ? dcoy_dcpu_variant_names[variant] : "variant";
+    e->variant = variant;
+    e->by_cycles = false;
+    e->run = run_variant;
+    e->data = NULL;
+}
+
+
+void dcoy_diff_engine_aot (dcoy_diff_engine *e, const dcoy_aot *aot) {
+    e->name = "aot";
+    e->variant = DCOY_DCPU_VARIANT_FULL;
+    e->by_cycles = true;
+    e->run = run_aot;
+    e->data = (void *)aot;
+}
+
+
+/* The reference - dcoy_dcpu_step, leaving out what the variant does */
+
+static void reference_step (dcoy_dcpu16 *d) {
+    unsigned int v = d->variant;
+
+    if (v == DCOY_DCPU_VARIANT_FULL) {
+        dcoy_dcpu_step(d);
+        return;
+    }
+    if (dcoy_dcpu_halted(d)) {
+        return;
+    }
+
+    dcoy_inst inst;
+    d->pc += dcoy_dcpu_read_pc(&inst, d);
+    unsigned int cost = dcoy_dcpu_exec(d, inst);
+
+    if (dcoy_dcpu_variant_counts_cycles(v)) {
+        d->cycles += cost;
+    }
+    if (dcoy_dcpu_variant_takes_interrupts(v)) {
+        dcoy_dcpu_interrupt_trigger(d);
+    }
+    if (dcoy_dcpu_variant_counts_cycles(v) && dcoy_dcpu_events_due(d)) {
+        dcoy_dcpu_events_run(d);
+    }
+}
+
+
+/* Instance management */
+
+dcoy_diff *dcoy_diff_create (unsigned int quantum) {
+    dcoy_diff *df = calloc(1, sizeof(dcoy_diff));
+    if (df == NULL) return df;
+    df->quantum = quantum ? quantum : DCOY_DIFF_QUANTUM;
+    return df;
+}
+
+
+void dcoy_diff_destroy (dcoy_diff *df) {
+    free(df);
+}
+
+
+static void prepare (dcoy_dcpu16 *d, const dcoy_dcpu16 *start,
+                     unsigned int variant, uint8_t *dirty) {
+    memcpy(d, start, sizeof(dcoy_dcpu16));
+
+    d->variant = variant;
+    d->hardware = NULL;
+    d->hardware_count = d->hardware_size = 0;
+    d->events = NULL;
+    d->coverage = NULL;
+    d->traps = NULL;
+    d->heat = NULL;
+    d->dirty = dirty;
+
+    dcoy_dcpu_flag_unset(d, DCOY_DCPU_FLAG_YIELD);
+    memset(dirty, 0, DCOY_DCPU_PAGES);
+}
+
+
+/* Checkpoints
+ * The two only need one between them, since they're the same whenever
+ * it's taken. Like dcoy/fuzz.c, it only copies pages that changed. */
+
+static void checkpoint (dcoy_diff *df) {
+    const size_t mem = offsetof(dcoy_dcpu16, mem);
+    const size_t rest = mem + sizeof(df->reference.mem);
+    uint8_t *to = (uint8_t *)&df->checkpoint;
+    const uint8_t *from = (const uint8_t *)&df->reference;
+
+    memcpy(to, from, mem);
+    memcpy(to + rest, from + rest, sizeof(dcoy_dcpu16) - rest);
+
+    for (unsigned int p = 0; p < DCOY_DCPU_PAGES; p++) {
+        if (df->reference_dirty[p]) {
+            memcpy(df->checkpoint.mem + p * DCOY_DCPU_PAGE_WORDS,
+                   df->reference.mem + p * DCOY_DCPU_PAGE_WORDS, PAGE_BYTES);
+        }
+    }
+
+    memset(df->reference_dirty, 0, DCOY_DCPU_PAGES);
+    memset(df->candidate_dirty, 0, DCOY_DCPU_PAGES);
+}
+
+
+static void restore (dcoy_diff *df) {
+    memcpy(&df->reference, &df->checkpoint, sizeof(dcoy_dcpu16));
+    memcpy(&df->candidate, &df->checkpoint, sizeof(dcoy_dcpu16));
+    df->reference.dirty = df->reference_dirty;
+    df->candidate.dirty = df->candidate_dirty;
+
+    memset(df->reference_dirty, 0, DCOY_DCPU_PAGES);
+    memset(df->candidate_dirty, 0, DCOY_DCPU_PAGES);
+}
+
+
+/* Comparison */
+
+static bool differ (dcoy_diff_result *r, const char *field,
+                    unsigned int index, unsigned int expected,
+                    unsigned int actual) {
+    r->diverged = true;
+    r->field = field;
+    r->index = index;
+    r->expected = expected;
+    r->actual = actual;
+    return false;
+}
+
+#define CHECK(field, index, expected, actual) do { \
+    unsigned int e_ = (expected), a_ = (actual); \
+    if (e_ != a_) return differ(r, (field), (index), e_, a_); \
+} while (0)
+
+
+static bool compare (dcoy_diff *df, dcoy_diff_result *r) {
+    dcoy_dcpu16 *ref = &df->reference, *cand = &df->candidate;
+
+    for (unsigned int i = 0; i < DCOY_REG_COUNT; i++) {
+        CHECK("register", i, ref->reg[i], cand->reg[i]);
+    }
+    CHECK("PC", 0, ref->pc, cand->pc);
+    CHECK("SP", 0, ref->sp, cand->sp);
+    CHECK("EX", 0, dcoy_dcpu_ex(ref), dcoy_dcpu_ex(cand));
+    CHECK("IA", 0, ref->ia, cand->ia);
+    CHECK("flags", 0, ref->flags & STATE_FLAGS, cand->flags & STATE_FLAGS);
+    CHECK("cycles", 0, ref->cycles, cand->cycles);
+    CHECK("error", 0, ref->error_code, cand->error_code);
+
+    CHECK("queue length", 0, ref->int_queue_count, cand->int_queue_count);
+    for (unsigned int i = 0; i < ref->int_queue_count; i++) {
+        CHECK("queue", i,
+              ref->int_queue[(ref->int_queue_start + i) % DCOY_INT_QUEUE_SIZE],
+              cand->int_queue[(cand->int_queue_start + i) %
+                              DCOY_INT_QUEUE_SIZE]);
+    }
+
+    for (unsigned int p = 0; p < DCOY_DCPU_PAGES; p++) {
+        if (!df->reference_dirty[p] && !df->candidate_dirty[p]) continue;
+
+        unsigned int base = p * DCOY_DCPU_PAGE_WORDS;
+        if (memcmp(ref->mem + base, cand->mem + base, PAGE_BYTES) == 0) {
+            continue;
+        }
+        for (unsigned int i = base; i < base + DCOY_DCPU_PAGE_WORDS; i++) {
+            CHECK("memory", i, ref->mem[i], cand->mem[i]);
+        }
+    }
+
+    return true;
+}
+
+
+/* Running */
+
+/* Runs the engine, then the reference to the same point, and returns
+ * how far the engine got */
+static unsigned int advance (dcoy_diff *df, const dcoy_diff_engine *e,
+                             unsigned int amount, unsigned long *insts) {
+    dcoy_dcpu16 *ref = &df->reference, *cand = &df->candidate;
+    unsigned int start = cand->cycles;
+    unsigned int ran = e->run(cand, amount, e->data);
+
+    if (e->by_cycles) {
+        /* Instructions that halt on an error take no cycles, so once
+         * the engine has halted, the reference goes on until its cycles
+         * pass the engine's, to get to the halt as well */
+        unsigned int until = cand->cycles + !dcoy_dcpu_running(cand);
+
+        while (dcoy_dcpu_running(ref) &&
+               !dcoy_dcpu_cycles_reached(ref, until)) {
+            reference_step(ref);
+            (*insts)++;
+        }
+        return cand->cycles - start;
+    }
+
+    for (unsigned int i = 0; i < ran && dcoy_dcpu_running(ref); i++) {
+        reference_step(ref);
+        (*insts)++;
+    }
+    return ran;
+}
+
+
+/* Goes back to the checkpoint and runs forward a step at a time. If the
+ * divergence doesn't happen again before `end`, the result is left as
+ * it was found at the end of the quantum. */
+static void locate (dcoy_diff *df, const dcoy_diff_engine *e,
+                    unsigned long insts, unsigned long end,
+                    dcoy_diff_result *r) {
+    dcoy_diff_result found = *r;
+    restore(df);
+
+    while (insts < end && dcoy_dcpu_running(&df->reference)) {
+        dcoy_inst inst;
+        dcoy_word pc = df->reference.pc;
+        unsigned long before = insts;
+
+        dcoy_dcpu_read_inst(&inst, &df->reference, pc);
+        dcoy_inst_write(inst, r->inst);
+
+        if (advance(df, e, 1, &insts) == 0 && insts == before) break;
+
+        if (!compare(df, r)) {
+            r->pc = pc;
+            r->instructions = before;
+            r->cycles = df->reference.cycles;
+            return;
+        }
+        memset(df->reference_dirty, 0, DCOY_DCPU_PAGES);
+        memset(df->candidate_dirty, 0, DCOY_DCPU_PAGES);
+    }
+
+    *r = found;
+}
+
+
+bool dcoy_diff_run (dcoy_diff *df, const dcoy_dcpu16 *start,
+                    const dcoy_diff_engine *e, unsigned long limit,
+                    dcoy_diff_result *result) {
+    memset(result, 0, sizeof(dcoy_diff_result));
+
+    prepare(&df->reference, start, e->variant, df->reference_dirty);
+    prepare(&df->candidate, start, e->variant, df->candidate_dirty);
+    memcpy(&df->checkpoint, &df->reference, sizeof(dcoy_dcpu16));
+
+    unsigned long done = 0, insts = 0, agreed = 0;
+
+    while (done < limit && dcoy_dcpu_running(&df->reference)) {
+        unsigned int amount = limit - done < df->quantum
+                            ? limit - done : df->quantum;
+        unsigned int ran = advance(df, e, amount, &insts);
+
+        if (!compare(df, result)) {
+            result->pc = df->reference.pc;
+            result->instructions = insts;
+            result->cycles = df->reference.cycles;
+            locate(df, e, agreed, insts, result);
+            return false;
+        }
+
+        checkpoint(df);
+        agreed = insts;
+        if (ran == 0) break;
+        done += ran;
+    }
+
+    result->instructions = insts;
+    result->cycles = df->reference.cycles;
+    return true;
+}
+
+
+/* Random programs */
+
+static uint64_t next (uint64_t *seed) {
+    /* xorshift64*, which mustn't be seeded with 0 */
+    uint64_t x = *seed ? *seed : 0x9e3779b97f4a7c15ull;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+static dcoy_word value (uint64_t *seed) {
+    static const dcoy_word edges[] = {
+        0, 1, 2, 15, 16, 17, 31, 0x7fff, 0x8000, 0x8001, 0xfffe, 0xffff
+    };
+    uint64_t r = next(seed);
+    return r & 1 ? edges[(r >> 1) % (sizeof(edges) / sizeof(edges[0]))]
+                 : (dcoy_word)(r >> 16);
+}
+
+
+static bool has_word (unsigned int lead) {
+    return (lead >= DCOY_ARG_ROFFSET && lead < DCOY_ARG_PUSHPOP) ||
+           lead == DCOY_ARG_PICK || lead == DCOY_ARG_LOOKUP ||
+           lead == DCOY_ARG_VALUE;
+}
+
+
+static unsigned int operand (uint64_t *seed, bool is_a) {
+    uint64_t r = next(seed);
+
+    /* short literals are common, and writes to PC are left to jumps */
+    if (is_a && r % 4 == 0) {
+        return 0x20 + (r >> 8) % 32;
+    }
+    unsigned int lead = (r >> 8) % 0x20;
+    return !is_a && lead == DCOY_ARG_PC ? DCOY_ARG_RVALUE + (r >> 16) % 8
+                                        : lead;
+}
+
+
+unsigned int dcoy_diff_generate (dcoy_word *out, unsigned int size,
+                                 uint64_t *seed) {
+    static const uint8_t ops[] = {
+        SET, SET, ADD, SUB, MUL, MLI, DIV, DVI, DIV, DVI, MOD, MDI,
+        AND, BOR, XOR, SHR, ASR, SHL, SHR, ASR, SHL, ADX, SBX, STI, STD
+    };
+    static const uint8_t sops[] = {
+        JSR, JSR, INT, IAG, IAS, IAS, RFI, IAQ, IAQ, HWN
+    };
+
+    unsigned int pos = 0;
+
+    for (;;) {
+        uint64_t r = next(seed);
+        unsigned int op, a, b = 0;
+        dcoy_word a_word = value(seed), b_word = value(seed);
+        bool special = false;
+
+        if (r % 8 == 0) {
+            /* the start of what may be a chain of them */
+            op = IFB + (r >> 8) % (IFU - IFB + 1);
+            a = operand(seed, true);
+            b = operand(seed, false);
+        } else if (r % 16 == 1) {
+            /* a jump within the program */
+            op = SET;
+            a = DCOY_ARG_VALUE;
+            b = DCOY_ARG_PC;
+            a_word = size ? (r >> 16) % size : 0;
+        } else if (r % 16 == 3) {
+            special = true;
+            op = (r >> 8) % 16 == 0 ? ((r >> 12) & 1 ? HWQ : HWI)
+                                    : sops[(r >> 16) % sizeof(sops)];
+            a = operand(seed, true);
+            if (op == JSR || op == IAS) {
+                a = DCOY_ARG_VALUE;
+                a_word = size ? (r >> 24) % size : 0;
+            }
+        } else {
+            op = ops[(r >> 8) % sizeof(ops)];
+            a = operand(seed, true);
+            b = operand(seed, false);
+        }
+
+        unsigned int words = 1 + has_word(a) + (!special && has_word(b));
+        if (pos + words > size) break;
+
+        out[pos++] = special ? op << 5 | a << 10 : op | b << 5 | a << 10;
+        if (has_word(a)) out[pos++] = a_word;
+        if (!special && has_word(b)) out[pos++] = b_word;
+    }
+
+    return pos;
+}
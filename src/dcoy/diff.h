@@ -0,0 +1,98 @@
+/**
+ * dcoy/diff.h
+ *
+ * Lockstep differential checking of execution engines against the
+ * reference interpreter - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_diff_h
+#define _dcoy_diff_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dcoy/aot.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Engines
+ * An engine runs a DCPU for up to `amount` instructions, or cycles if
+ * it syncs by cycles, and returns how many instructions it ran (if it
+ * knows). The reference follows the same variant's rules, so it counts
+ * cycles and takes interrupts only if the variant does. */
+
+typedef struct dcoy_diff_engine {
+    const char *name;
+    unsigned int variant;
+    bool by_cycles;
+    unsigned int (*run) (dcoy_dcpu16 *d, unsigned int amount, void *data);
+    void *data;
+} dcoy_diff_engine;
+
+void dcoy_diff_engine_variant (dcoy_diff_engine *e, unsigned int variant);
+void dcoy_diff_engine_aot (dcoy_diff_engine *e, const dcoy_aot *aot);
+
+
+/* Checking
+ * The engine and the reference each run a quantum from the same state,
+ * and are compared: registers, PC, SP, EX, IA, flags, cycles, the
+ * interrupt queue, error codes, and any memory page either wrote to.
+ * When they differ, both go back to where they last agreed and run a
+ * step at a time, to find the first instruction (or block, for engines
+ * that can't stop sooner) where they part ways.
+ *
+ * Each side gets its own copy of the starting state, without hardware,
+ * which can't be duplicated - so any HWI, HWQ, or timed event a program
+ * relies on will just go wrong the same way on both. */
+
+typedef struct dcoy_diff_result {
+    bool diverged;
+    unsigned long instructions;     /* run by the reference */
+    unsigned int cycles;            /* of the reference, when it stopped */
+
+    /* what differed first, and the instruction (at pc) that did it */
+    const char *field;
+    unsigned int index;             /* address, register, or queue slot */
+    unsigned int expected;
+    unsigned int actual;
+    dcoy_word pc;
+    char inst[32];
+} dcoy_diff_result;
+
+typedef struct dcoy_diff {
+    unsigned int quantum;
+
+    dcoy_dcpu16 reference;
+    dcoy_dcpu16 candidate;
+    dcoy_dcpu16 checkpoint;     /* where they last agreed */
+
+    uint8_t reference_dirty[DCOY_DCPU_PAGES];
+    uint8_t candidate_dirty[DCOY_DCPU_PAGES];
+} dcoy_diff;
+
+#define DCOY_DIFF_QUANTUM   10000
+
+dcoy_diff *dcoy_diff_create (unsigned int quantum);
+void dcoy_diff_destroy (dcoy_diff *df);
+
+/* Runs until `limit` instructions (or cycles) have been run, the
+ * reference halts, or they diverge. Returns false if they diverged. */
+bool dcoy_diff_run (dcoy_diff *df, const dcoy_dcpu16 *start,
+                    const dcoy_diff_engine *e, unsigned long limit,
+                    dcoy_diff_result *result);
+
+
+/* Random programs
+ * Fills `size` words with random instructions using only real opcodes,
+ * weighted towards the corner cases: dividing by zero and negative
+ * numbers, shifts of 16 or more, chains of IFs, the stack, and jumps
+ * and interrupt handlers inside the program. HWQ and HWI show up only
+ * rarely, since without hardware they stop the program. Returns the
+ * number of words used (an instruction never runs off the end). */
+
+unsigned int dcoy_diff_generate (dcoy_word *out, unsigned int size,
+                                 uint64_t *seed);
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * dcoy/fuzz.c
+ *
+ * Snapshot-and-restore harness for fuzzing DCPU programs - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/fuzz.h"
+#include "dcoy/coverage.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Without an exit PC to watch for, runs go this many instructions
+ * between checks of the cycle budget. */
+#define BATCH   64
+
+
+/* Instance management */
+
+dcoy_fuzz *dcoy_fuzz_create () {
+    dcoy_fuzz *f = calloc(1, sizeof(dcoy_fuzz));
+    if (f == NULL) return f;
+    dcoy_dcpu_initialize(&f->base);
+    dcoy_dcpu_initialize(&f->work);
+    return f;
+}
+
+
+void dcoy_fuzz_destroy (dcoy_fuzz *f) {
+    free(f);
+}
+
+
+/* Running */
+
+/* Runs a copy of d until it reaches pc, and makes that the base for
+ * all future runs. Returns false if it halted or ran out of cycles. */
+bool dcoy_fuzz_fork (dcoy_fuzz *f, const dcoy_dcpu16 *d, dcoy_word pc,
+                     unsigned int max_cycles) {
+    f->base = *d;
+    dcoy_dcpu16 *b = &f->base;
+    unsigned int start = b->cycles;
+    b->dirty = NULL;
+
+    /* work no longer matches anything, so the next restore is a full one */
+    memset(f->dirty, 1, sizeof(f->dirty));
+
+    while (b->pc != pc) {
+        if (!dcoy_dcpu_running(b) || b->cycles - start >= max_cycles) {
+            return false;
+        }
+        dcoy_dcpu_step(b);
+    }
+
+    return true;
+}
+
+
+/* Copies base to work, except for the pages of memory that haven't
+ * been written to since the last restore. */
+static void restore (dcoy_fuzz *f) {
+    dcoy_dcpu16 *d = &f->work;
+    const dcoy_dcpu16 *b = &f->base;
+    size_t mem = offsetof(dcoy_dcpu16, mem);
+    size_t after = mem + sizeof(b->mem);
+
+    memcpy(d, b, mem);
+    memcpy((uint8_t *)d + after, (const uint8_t *)b + after,
+           sizeof(dcoy_dcpu16) - after);
+
+    for (unsigned int page = 0; page < DCOY_DCPU_PAGES; page++) {
+        if (f->dirty[page]) {
+            memcpy(d->mem + page * DCOY_DCPU_PAGE_WORDS,
+                   b->mem + page * DCOY_DCPU_PAGE_WORDS,
+                   DCOY_DCPU_PAGE_WORDS * sizeof(dcoy_word));
+        }
+    }
+
+    memset(f->dirty, 0, sizeof(f->dirty));
+    d->dirty = f->dirty;
+}
+
+
+static void inject (dcoy_dcpu16 *d, dcoy_word addr, unsigned int words,
+                    const void *input, size_t size) {
+    const uint8_t *bytes = input;
+    size_t window = (size_t)words * sizeof(dcoy_word);
+    if (size > window) size = window;
+
+    /* The window may wrap around the end of memory. Bytes go in the
+     * same order as in an image file, and the rest of it is zeroed. */
+    size_t first = (size_t)(DCOY_MEM_WORDS - addr) * sizeof(dcoy_word);
+    if (first > window) first = window;
+
+    if (size <= first) {
+        memcpy((uint8_t *)(d->mem + addr), bytes, size);
+        memset((uint8_t *)(d->mem + addr) + size, 0, first - size);
+        memset(d->mem, 0, window - first);
+    } else {
+        memcpy((uint8_t *)(d->mem + addr), bytes, first);
+        memcpy((uint8_t *)d->mem, bytes + first, size - first);
+        memset((uint8_t *)d->mem + (size - first), 0, window - size);
+    }
+
+    dcoy_dcpu_dirty_range(d, addr, words);
+}
+
+
+unsigned int dcoy_fuzz_run (dcoy_fuzz *f, const void *input, size_t size) {
+    dcoy_dcpu16 *d = &f->work;
+
+    restore(f);
+    dcoy_dcpu_variant_set(d, f->variant);
+    inject(d, f->input_addr, f->input_words, input, size);
+
+    if (f->coverage) {
+        dcoy_coverage_clear(f->coverage);
+        dcoy_coverage_attach(d, f->coverage);
+    }
+
+    /* variants that don't count cycles are budgeted by instruction */
+    bool counts_cycles = dcoy_dcpu_variant_counts_cycles(f->variant);
+    unsigned int start = d->cycles;
+    unsigned int spent = 0;
+    unsigned int batch = f->use_exit_pc ? 1 : BATCH;
+
+    while (spent < f->cycles) {
+        if (!dcoy_dcpu_ready(d)) {
+            break;
+        }
+        if (dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_ON_FIRE)) {
+            return DCOY_FUZZ_FIRE;
+        }
+        if (f->use_exit_pc && d->pc == f->exit_pc) {
+            return DCOY_FUZZ_EXITED;
+        }
+
+        unsigned int done = dcoy_dcpu_run(d, batch);
+        spent = counts_cycles ? d->cycles - start : spent + done;
+    }
+
+    if (!dcoy_dcpu_running(d)) {
+        return d->error_code ? DCOY_FUZZ_ERROR : DCOY_FUZZ_HALTED;
+    } else if (dcoy_dcpu_yielded(d) &&
+               !dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_ON_FIRE)) {
+        return DCOY_FUZZ_YIELDED;
+    }
+    return dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_ON_FIRE) ? DCOY_FUZZ_FIRE
+                                                     : DCOY_FUZZ_TIMEOUT;
+}
@@ -0,0 +1,75 @@
+/**
+ * dcoy/fuzz.h
+ *
+ * Snapshot-and-restore harness for fuzzing DCPU programs - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_fuzz_h
+#define _dcoy_fuzz_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Results of a run, most serious first */
+
+#define DCOY_FUZZ_ERROR     0   /* halted with an error; see error_code */
+#define DCOY_FUZZ_FIRE      1   /* the interrupt queue overflowed */
+#define DCOY_FUZZ_HALTED    2   /* halted without an error */
+#define DCOY_FUZZ_EXITED    3   /* reached the exit PC */
+#define DCOY_FUZZ_TIMEOUT   4   /* ran out of cycles */
+#define DCOY_FUZZ_YIELDED   5   /* stopped at a trap, or otherwise yielded */
+
+
+/* Harness structure
+ * The DCPU is run once from reset to the fork point and copied into
+ * `base`. Every run then restores `work` from it, writes the input into
+ * the input window, and runs until the cycle budget is used up.
+ * Only the DCPU itself is restored - devices and timed events that are
+ * active at the fork point will not be. Memory is tracked in pages, and
+ * only the pages a run wrote to are copied back from `base`. */
+
+typedef struct dcoy_fuzz {
+    dcoy_dcpu16 base;
+    dcoy_dcpu16 work;
+
+    dcoy_word input_addr;
+    unsigned int input_words;
+
+    /* the budget is in instructions for variants without cycles */
+    unsigned int cycles;
+    unsigned int variant;
+
+    bool use_exit_pc;
+    dcoy_word exit_pc;
+
+    /* if set, cleared before each run and attached to `work` */
+    uint8_t *coverage;
+
+    uint8_t dirty[DCOY_DCPU_PAGES];
+} dcoy_fuzz;
+
+
+/* Instance management */
+
+dcoy_fuzz *dcoy_fuzz_create ();
+void dcoy_fuzz_destroy (dcoy_fuzz *f);
+
+#define dcoy_fuzz_input(f, addr, words) \
+    ((f)->input_addr = (addr), (f)->input_words = (words))
+#define dcoy_fuzz_exit_pc(f, pc) \
+    ((f)->use_exit_pc = true, (f)->exit_pc = (pc))
+
+
+/* Running */
+
+bool dcoy_fuzz_fork (dcoy_fuzz *f, const dcoy_dcpu16 *d, dcoy_word pc,
+                     unsigned int max_cycles);
+unsigned int dcoy_fuzz_run (dcoy_fuzz *f, const void *input, size_t size);
+
+#endif
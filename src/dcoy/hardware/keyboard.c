@@ -0,0 +1,166 @@
+/**
+ * dcoy/hardware/keyboard.c
+ *
+ * Generic keyboard, fed by a host input thread - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/hardware/keyboard.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/constants.h"
+#include "dcoy/specs.h"
+
+#define MASK    (DCOY_KEYBOARD_BUFFER - 1)
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw);
+static void poll (dcoy_dcpu16 *d, dcoy_dcpu_event *ev);
+
+
+/* Instance management */
+
+void dcoy_keyboard_initialize (dcoy_keyboard *kb) {
+    memset(kb, 0, sizeof(dcoy_keyboard));
+
+    kb->hw.id = DCOY_KEYBOARD_ID;
+    kb->hw.version = DCOY_KEYBOARD_VERSION;
+    kb->hw.manufacturer = DCOY_KEYBOARD_MANUFACTURER;
+    kb->hw.interrupt = interrupt;
+
+    kb->poll.fire = poll;
+    kb->poll.data = kb;
+}
+
+
+dcoy_keyboard *dcoy_keyboard_create () {
+    dcoy_keyboard *kb = aligned_alloc(DCOY_KEYBOARD_CACHE_LINE,
+                                      sizeof(dcoy_keyboard));
+    if (kb == NULL) return kb;
+    dcoy_keyboard_initialize(kb);
+    return kb;
+}
+
+
+void dcoy_keyboard_destroy (dcoy_keyboard *kb) {
+    /* like the M35FD, it must already be detached */
+    free(kb);
+}
+
+
+/* Host input
+ * The host's thread owns head and the DCPU's thread owns tail. Keys
+ * are written before head is released, and tail is only moved past a
+ * key after it's been read. */
+
+unsigned int dcoy_keyboard_paste (dcoy_keyboard *kb, const dcoy_word *keys,
+                                  unsigned int count) {
+    unsigned int head = atomic_load_explicit(&kb->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&kb->tail, memory_order_acquire);
+
+    unsigned int space = DCOY_KEYBOARD_BUFFER - (head - tail);
+    if (count > space) count = space;
+
+    for (unsigned int i = 0; i < count; i++) {
+        kb->keys[(head + i) & MASK] = keys[i];
+    }
+
+    atomic_store_explicit(&kb->head, head + count, memory_order_release);
+    return count;
+}
+
+
+bool dcoy_keyboard_type (dcoy_keyboard *kb, dcoy_word key) {
+    return dcoy_keyboard_paste(kb, &key, 1) == 1;
+}
+
+
+void dcoy_keyboard_press (dcoy_keyboard *kb, dcoy_word key) {
+    if (key >= DCOY_KEY_COUNT) return;
+    atomic_fetch_or(&kb->pressed[key / 32], 1u << (key % 32));
+    atomic_store(&kb->changed, true);
+}
+
+
+void dcoy_keyboard_release (dcoy_keyboard *kb, dcoy_word key) {
+    if (key >= DCOY_KEY_COUNT) return;
+    atomic_fetch_and(&kb->pressed[key / 32], ~(1u << (key % 32)));
+    atomic_store(&kb->changed, true);
+}
+
+
+/* Interrupts to the DCPU */
+
+static void poll (dcoy_dcpu16 *d, dcoy_dcpu_event *ev) {
+    dcoy_keyboard *kb = ev->data;
+
+    if (!kb->outstanding) {
+        unsigned int head = atomic_load_explicit(&kb->head,
+                                                 memory_order_acquire);
+        bool changed = atomic_exchange(&kb->changed, false);
+
+        if (head != kb->notified || changed) {
+            kb->notified = head;
+            kb->outstanding = true;
+            dcoy_dcpu_interrupt(d, kb->message);
+        }
+    }
+
+    dcoy_dcpu_schedule(d, ev, DCOY_KEYBOARD_POLL_CYCLES);
+}
+
+
+/* Interrupts from the DCPU */
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw) {
+    dcoy_keyboard *kb = (dcoy_keyboard *)hw;
+    unsigned int head, tail;
+
+    switch (d->reg[A]) {
+        case DCOY_KEYBOARD_CLEAR:
+            head = atomic_load_explicit(&kb->head, memory_order_acquire);
+            atomic_store_explicit(&kb->tail, head, memory_order_release);
+            kb->outstanding = false;
+            break;
+
+        case DCOY_KEYBOARD_NEXT:
+            head = atomic_load_explicit(&kb->head, memory_order_acquire);
+            tail = atomic_load_explicit(&kb->tail, memory_order_relaxed);
+            if (head == tail) {
+                d->reg[C] = 0;
+            } else {
+                d->reg[C] = kb->keys[tail & MASK];
+                atomic_store_explicit(&kb->tail, tail + 1,
+                                      memory_order_release);
+            }
+            kb->outstanding = false;
+            break;
+
+        case DCOY_KEYBOARD_PRESSED:
+            d->reg[C] = d->reg[B] < DCOY_KEY_COUNT &&
+                        (atomic_load(&kb->pressed[d->reg[B] / 32]) >>
+                         (d->reg[B] % 32) & 1);
+            kb->outstanding = false;
+            break;
+
+        case DCOY_KEYBOARD_SET_INTERRUPT:
+            kb->message = d->reg[B];
+            if (kb->message) {
+                if (!kb->poll.scheduled) {
+                    dcoy_dcpu_schedule(d, &kb->poll,
+                                       DCOY_KEYBOARD_POLL_CYCLES);
+                }
+            } else {
+                dcoy_dcpu_unschedule(d, &kb->poll);
+            }
+            break;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * dcoy/hardware/keyboard.h
+ *
+ * Generic keyboard, fed by a host input thread - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_hardware_keyboard_h
+#define _dcoy_hardware_keyboard_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Device identification - the spec doesn't name a manufacturer */
+
+#define DCOY_KEYBOARD_ID            0x30cf7406
+#define DCOY_KEYBOARD_VERSION       0x0001
+#define DCOY_KEYBOARD_MANUFACTURER  0x00000000
+
+
+/* Interrupts (values of A for HWI) */
+
+#define DCOY_KEYBOARD_CLEAR         0   /* empties the buffer */
+#define DCOY_KEYBOARD_NEXT          1   /* C: next typed key, or 0 */
+#define DCOY_KEYBOARD_PRESSED       2   /* C: 1 if key B is held down */
+#define DCOY_KEYBOARD_SET_INTERRUPT 3   /* B: message, or 0 for none */
+
+
+/* Keys - anything else is ASCII, from 0x20 to 0x7f */
+
+#define DCOY_KEY_BACKSPACE          0x10
+#define DCOY_KEY_RETURN             0x11
+#define DCOY_KEY_INSERT             0x12
+#define DCOY_KEY_DELETE             0x13
+#define DCOY_KEY_UP                 0x80
+#define DCOY_KEY_DOWN               0x81
+#define DCOY_KEY_LEFT               0x82
+#define DCOY_KEY_RIGHT              0x83
+#define DCOY_KEY_SHIFT              0x90
+#define DCOY_KEY_CONTROL            0x91
+
+#define DCOY_KEY_COUNT              0x100
+
+
+/* Timing
+ * Input is checked for on a timed event rather than as it arrives, so
+ * however fast the host types (or pastes), the DCPU gets at most one
+ * interrupt per poll. After that, no more are sent until the program
+ * has used HWI to look at the keyboard. */
+
+#define DCOY_KEYBOARD_POLL_CYCLES   100     /* 1 ms at 100 kHz */
+#define DCOY_KEYBOARD_BUFFER        1024    /* a power of two */
+#define DCOY_KEYBOARD_CACHE_LINE    64
+
+
+/* Device structure
+ * The buffer is a ring with a single producer (the host's input
+ * thread) and a single consumer (whichever thread runs the DCPU), so
+ * neither side ever locks or allocates. */
+
+typedef struct dcoy_keyboard {
+    dcoy_hardware hw;
+    dcoy_dcpu_event poll;
+
+    /* only touched by the DCPU's thread */
+    dcoy_word message;
+    bool outstanding;
+    unsigned int notified;
+
+    _Alignas(DCOY_KEYBOARD_CACHE_LINE) _Atomic unsigned int head;
+    _Alignas(DCOY_KEYBOARD_CACHE_LINE) _Atomic unsigned int tail;
+
+    _Alignas(DCOY_KEYBOARD_CACHE_LINE)
+    _Atomic uint32_t pressed[DCOY_KEY_COUNT / 32];
+    atomic_bool changed;
+
+    dcoy_word keys[DCOY_KEYBOARD_BUFFER];
+} dcoy_keyboard;
+
+
+/* Instance management */
+
+dcoy_keyboard *dcoy_keyboard_create ();
+void dcoy_keyboard_initialize (dcoy_keyboard *kb);
+void dcoy_keyboard_destroy (dcoy_keyboard *kb);
+
+#define dcoy_keyboard_attach(d, kb) dcoy_dcpu_hardware_attach((d), &(kb)->hw)
+
+
+/* Host input - safe to call from one other thread at a time.
+ * type and paste return how many keys fit in the buffer. */
+
+bool dcoy_keyboard_type (dcoy_keyboard *kb, dcoy_word key);
+unsigned int dcoy_keyboard_paste (dcoy_keyboard *kb, const dcoy_word *keys,
+                                  unsigned int count);
+void dcoy_keyboard_press (dcoy_keyboard *kb, dcoy_word key);
+void dcoy_keyboard_release (dcoy_keyboard *kb, dcoy_word key);
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * dcoy/hardware/link.c
+ *
+ * Point-to-point serial link between two DCPUs in a cluster -
+ * implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/hardware/link.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/constants.h"
+#include "dcoy/specs.h"
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw);
+static void arrived (dcoy_dcpu16 *d, dcoy_dcpu_event *ev);
+
+
+/* Channels */
+
+dcoy_link_channel *dcoy_link_channel_create (unsigned int capacity) {
+    unsigned int size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    dcoy_link_channel *ch = aligned_alloc(DCOY_LINK_CACHE_LINE,
+                                          sizeof(dcoy_link_channel));
+    if (ch == NULL) return ch;
+    memset(ch, 0, sizeof(dcoy_link_channel));
+
+    ch->entries = malloc(size * sizeof(dcoy_link_entry));
+    if (ch->entries == NULL) {
+        free(ch);
+        return NULL;
+    }
+    ch->capacity = size;
+    return ch;
+}
+
+
+void dcoy_link_channel_destroy (dcoy_link_channel *ch) {
+    free(ch->entries);
+    free(ch);
+}
+
+#define entry(ch, index)    (&(ch)->entries[(index) & ((ch)->capacity - 1)])
+
+
+/* Instance management */
+
+void dcoy_link_initialize (dcoy_link *link, dcoy_link_channel *out,
+                           dcoy_link_channel *in, unsigned int latency) {
+    memset(link, 0, sizeof(dcoy_link));
+
+    link->hw.id = DCOY_LINK_ID;
+    link->hw.version = DCOY_LINK_VERSION;
+    link->hw.manufacturer = DCOY_LINK_MANUFACTURER;
+    link->hw.interrupt = interrupt;
+
+    link->arrival.fire = arrived;
+    link->arrival.data = link;
+
+    link->out = out;
+    link->in = in;
+    link->latency = latency;
+}
+
+
+dcoy_link *dcoy_link_create (dcoy_link_channel *out, dcoy_link_channel *in,
+                             unsigned int latency) {
+    dcoy_link *link = malloc(sizeof(dcoy_link));
+    if (link == NULL) return link;
+    dcoy_link_initialize(link, out, in, latency);
+    return link;
+}
+
+
+void dcoy_link_destroy (dcoy_link *link) {
+    /* the channels belong to whoever connected the link */
+    free(link);
+}
+
+
+/* Arrivals
+ * Only words that had been published when the quantum began are ever
+ * looked at. The sender's clock can't be more than a quantum ahead, and
+ * latency is at least a quantum, so any word that arrives during this
+ * quantum was sent in an earlier one. */
+
+static void arm (dcoy_link *link, dcoy_dcpu16 *d) {
+    if (link->arrival.scheduled || link->in_notified == link->in_limit) {
+        return;
+    }
+
+    unsigned int at = entry(link->in, link->in_notified)->at;
+    dcoy_dcpu_schedule(d, &link->arrival,
+                       dcoy_dcpu_cycles_reached(d, at) ? 0 : at - d->cycles);
+}
+
+
+static void arrived (dcoy_dcpu16 *d, dcoy_dcpu_event *ev) {
+    dcoy_link *link = ev->data;
+
+    link->in_notified++;
+    if (link->message) {
+        dcoy_dcpu_interrupt(d, link->message);
+    }
+    arm(link, d);
+}
+
+
+static bool waiting (dcoy_link *link, dcoy_dcpu16 *d, unsigned int index) {
+    return index != link->in_limit &&
+           dcoy_dcpu_cycles_reached(d, entry(link->in, index)->at);
+}
+
+
+/* Quanta */
+
+void dcoy_link_begin (dcoy_link *link, dcoy_dcpu16 *d, unsigned int quantum) {
+    /* the slots the other side published at the end of the last one */
+    unsigned int last = (quantum + 1) & 1;
+
+    link->credit = link->out->capacity -
+                   (link->out->head - link->out->tail_published[last]);
+    link->in_limit = link->in->head_published[last];
+    arm(link, d);
+}
+
+
+void dcoy_link_end (dcoy_link *link, unsigned int quantum) {
+    link->out->head_published[quantum & 1] = link->out->head;
+    link->in->tail_published[quantum & 1] = link->in->tail;
+}
+
+
+/* Interrupts */
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw) {
+    dcoy_link *link = (dcoy_link *)hw;
+    dcoy_link_channel *out = link->out, *in = link->in;
+    unsigned int count;
+
+    switch (d->reg[A]) {
+        case DCOY_LINK_POLL:
+            for (count = 0; waiting(link, d, in->tail + count); count++);
+            d->reg[B] = count;
+            d->reg[C] = link->credit > 0xffff ? 0xffff : link->credit;
+            break;
+
+        case DCOY_LINK_SET_INTERRUPT:
+            link->message = d->reg[X];
+            break;
+
+        case DCOY_LINK_SEND:
+            if (link->credit == 0) {
+                d->reg[C] = 0;
+                break;
+            }
+            entry(out, out->head)->at = d->cycles + link->latency;
+            entry(out, out->head)->word = d->reg[B];
+            out->head++;
+            link->credit--;
+            d->reg[C] = 1;
+            break;
+
+        case DCOY_LINK_RECEIVE:
+            if (!waiting(link, d, in->tail)) {
+                d->reg[B] = 0;
+                d->reg[C] = 0;
+                break;
+            }
+            d->reg[B] = entry(in, in->tail)->word;
+            in->tail++;
+            d->reg[C] = 1;
+            break;
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * dcoy/hardware/link.h
+ *
+ * Point-to-point serial link between two DCPUs in a cluster - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_hardware_link_h
+#define _dcoy_hardware_link_h
+
+#include <stdbool.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Device identification */
+
+#define DCOY_LINK_ID                0x1c4b0a51
+#define DCOY_LINK_VERSION           0x0001
+#define DCOY_LINK_MANUFACTURER      0x44434f59  /* "DCOY" */
+
+
+/* Interrupts (values of A for HWI) */
+
+#define DCOY_LINK_POLL              0   /* B: words waiting, C: can send */
+#define DCOY_LINK_SET_INTERRUPT     1   /* X: message on arrival, or 0 */
+#define DCOY_LINK_SEND              2   /* sends B, C: 1 if sent */
+#define DCOY_LINK_RECEIVE           3   /* B: next word, C: 1 if any */
+
+
+/* Channels
+ * A channel is a ring of words in flight in one direction, each stamped
+ * with the cycle it arrives at. The sender only writes `head` and the
+ * receiver only writes `tail`, so it needs no locks. Neither side reads
+ * the other's live index, though - each publishes it once a quantum
+ * (see dcoy/cluster.h), and the other side only sees what was published
+ * before the last barrier. That keeps what a DCPU can observe
+ * independent of how fast the other one's thread happens to be. */
+
+#define DCOY_LINK_CACHE_LINE        64
+
+typedef struct dcoy_link_entry {
+    unsigned int at;
+    dcoy_word word;
+} dcoy_link_entry;
+
+typedef struct dcoy_link_channel {
+    dcoy_link_entry *entries;
+    unsigned int capacity;      /* a power of two */
+
+    /* indexed by quantum number, so a slot is never written while
+     * the other side might still be reading it */
+    _Alignas(DCOY_LINK_CACHE_LINE) unsigned int head;
+    unsigned int head_published[2];
+
+    _Alignas(DCOY_LINK_CACHE_LINE) unsigned int tail;
+    unsigned int tail_published[2];
+} dcoy_link_channel;
+
+dcoy_link_channel *dcoy_link_channel_create (unsigned int capacity);
+void dcoy_link_channel_destroy (dcoy_link_channel *ch);
+
+
+/* Device structure
+ * Each end of a link is its own device, sending on one channel and
+ * receiving on the other. */
+
+typedef struct dcoy_link {
+    dcoy_hardware hw;
+    dcoy_dcpu_event arrival;
+
+    dcoy_link_channel *out;
+    dcoy_link_channel *in;
+    unsigned int latency;
+    dcoy_word message;
+
+    /* what's visible this quantum */
+    unsigned int credit;        /* words that can still be sent */
+    unsigned int in_limit;      /* words that have been published */
+    unsigned int in_notified;   /* words already interrupted for */
+} dcoy_link;
+
+
+/* Instance management */
+
+dcoy_link *dcoy_link_create (dcoy_link_channel *out, dcoy_link_channel *in,
+                             unsigned int latency);
+void dcoy_link_initialize (dcoy_link *link, dcoy_link_channel *out,
+                           dcoy_link_channel *in, unsigned int latency);
+void dcoy_link_destroy (dcoy_link *link);
+
+#define dcoy_link_attach(d, link) dcoy_dcpu_hardware_attach((d), &(link)->hw)
+
+
+/* Quanta - called by the cluster around each quantum of the DCPU the
+ * link is attached to, numbered from 0 */
+
+void dcoy_link_begin (dcoy_link *link, dcoy_dcpu16 *d, unsigned int quantum);
+void dcoy_link_end (dcoy_link *link, unsigned int quantum);
+
+#endif
@@ -0,0 +1,379 @@
+/**
+ * dcoy/hardware/m35fd.c
+ *
+ * Mackapar 3.5" Floppy Drive (M35FD) backed by a mapped image -
+ * implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dcoy/hardware/m35fd.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/constants.h"
+#include "dcoy/snapshot.h"
+#include "dcoy/specs.h"
+
+#define SECTOR_BYTES    (DCOY_M35FD_SECTOR_WORDS * 2)
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw);
+static void transfer_done (dcoy_dcpu16 *d, dcoy_dcpu_event *ev);
+static void save (dcoy_dcpu16 *d, dcoy_hardware *hw, dcoy_snapshot *snap);
+static bool load (dcoy_dcpu16 *d, dcoy_hardware *hw, dcoy_snapshot *snap);
+
+
+/* Instance management */
+
+void dcoy_m35fd_initialize (dcoy_m35fd *fd) {
+    memset(fd, 0, sizeof(dcoy_m35fd));
+
+    fd->hw.id = DCOY_M35FD_ID;
+    fd->hw.version = DCOY_M35FD_VERSION;
+    fd->hw.manufacturer = DCOY_M35FD_MANUFACTURER;
+    fd->hw.interrupt = interrupt;
+    fd->hw.save = save;
+    fd->hw.load = load;
+
+    fd->transfer.fire = transfer_done;
+    fd->transfer.data = fd;
+
+    fd->state = DCOY_M35FD_STATE_NO_MEDIA;
+    fd->error = DCOY_M35FD_ERROR_NONE;
+}
+
+
+dcoy_m35fd *dcoy_m35fd_create () {
+    dcoy_m35fd *fd = malloc(sizeof(dcoy_m35fd));
+    if (fd == NULL) return fd;
+    dcoy_m35fd_initialize(fd);
+    return fd;
+}
+
+
+void dcoy_m35fd_destroy (dcoy_m35fd *fd) {
+    /* The drive must already be detached from any DCPU, so there is
+     * no transfer left to cancel. */
+    if (fd->media) {
+        munmap(fd->media, fd->media_size);
+    }
+    free(fd);
+}
+
+
+/* State changes */
+
+static dcoy_word ready_state (dcoy_m35fd *fd) {
+    if (fd->media == NULL) {
+        return DCOY_M35FD_STATE_NO_MEDIA;
+    }
+    return fd->write_protected ? DCOY_M35FD_STATE_READY_WP
+                               : DCOY_M35FD_STATE_READY;
+}
+
+
+static void update (dcoy_m35fd *fd, dcoy_dcpu16 *d,
+                    dcoy_word state, dcoy_word error) {
+    bool changed = fd->state != state || fd->error != error;
+
+    fd->state = state;
+    fd->error = error;
+
+    if (changed && fd->message) {
+        dcoy_dcpu_interrupt(d, fd->message);
+    }
+}
+
+
+/* Media */
+
+int dcoy_m35fd_insert (dcoy_m35fd *fd, dcoy_dcpu16 *d,
+                       const char *filename, unsigned int flags) {
+    bool write_protected = flags & DCOY_M35FD_WRITE_PROTECTED;
+
+    if (fd->media) {
+        dcoy_m35fd_eject(fd, d);
+    }
+
+    int file = open(filename, write_protected ? O_RDONLY : O_RDWR);
+    if (file < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(file, &st) < 0) {
+        close(file);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    if (!write_protected && (flags & DCOY_M35FD_EXTEND) &&
+        size < DCOY_M35FD_IMAGE_BYTES) {
+        if (ftruncate(file, DCOY_M35FD_IMAGE_BYTES) < 0) {
+            close(file);
+            return -1;
+        }
+        size = DCOY_M35FD_IMAGE_BYTES;
+    } else if (size > DCOY_M35FD_IMAGE_BYTES) {
+        size = DCOY_M35FD_IMAGE_BYTES;
+    }
+
+    if (size < SECTOR_BYTES) {
+        close(file);
+        errno = EINVAL;
+        return -1;
+    }
+    size -= size % SECTOR_BYTES;
+
+    void *media = mmap(NULL, size,
+                       write_protected ? PROT_READ : PROT_READ | PROT_WRITE,
+                       MAP_SHARED, file, 0);
+    close(file);
+    if (media == MAP_FAILED) {
+        return -1;
+    }
+
+    fd->media = media;
+    fd->media_size = size;
+    fd->sectors = size / SECTOR_BYTES;
+    fd->write_protected = write_protected;
+    fd->track = 0;
+
+    update(fd, d, ready_state(fd), fd->error);
+    return 0;
+}
+
+
+void dcoy_m35fd_eject (dcoy_m35fd *fd, dcoy_dcpu16 *d) {
+    if (fd->media == NULL) {
+        return;
+    }
+
+    dcoy_word error = fd->error;
+    if (fd->state == DCOY_M35FD_STATE_BUSY) {
+        dcoy_dcpu_unschedule(d, &fd->transfer);
+        error = DCOY_M35FD_ERROR_EJECT;
+    }
+
+    /* dirty pages are written back to the image by the kernel */
+    munmap(fd->media, fd->media_size);
+    fd->media = NULL;
+    fd->media_size = 0;
+    fd->sectors = 0;
+
+    update(fd, d, DCOY_M35FD_STATE_NO_MEDIA, error);
+}
+
+
+/* Transfers
+ * A transfer is only a timed event while it's in progress. The data is
+ * copied in one go when it completes, directly between the mapping and
+ * DCPU memory. Starting the transfer asks the kernel to page in the
+ * sector, and if it still hasn't by the time the copy is due, the
+ * transfer takes a little longer rather than faulting on the mapping
+ * and holding up the DCPU. */
+
+/* the pages of the mapping that hold the transfer's sector */
+static void sector_pages (dcoy_m35fd *fd, char **start, size_t *length) {
+    size_t offset = (size_t)fd->sector * SECTOR_BYTES;
+    size_t skew = offset % getpagesize();
+    *start = (char *)fd->media + offset - skew;
+    *length = SECTOR_BYTES + skew;
+}
+
+
+static bool sector_resident (dcoy_m35fd *fd) {
+    char *start;
+    size_t length;
+    sector_pages(fd, &start, &length);
+
+    size_t page = getpagesize();
+    unsigned char vec[(SECTOR_BYTES + page - 1) / page + 1];
+    if (mincore(start, length, vec) < 0) {
+        /* can't tell, so it's no worse than not asking */
+        return true;
+    }
+
+    for (size_t i = 0; i < (length + page - 1) / page; i++) {
+        if (!(vec[i] & 1)) return false;
+    }
+    return true;
+}
+
+
+static void prefetch (dcoy_m35fd *fd) {
+    char *start;
+    size_t length;
+    sector_pages(fd, &start, &length);
+    madvise(start, length, MADV_WILLNEED);
+}
+
+
+static bool start (dcoy_m35fd *fd, dcoy_dcpu16 *d, bool writing) {
+    dcoy_word error = DCOY_M35FD_ERROR_NONE;
+
+    if (fd->media == NULL) {
+        error = DCOY_M35FD_ERROR_NO_MEDIA;
+    } else if (fd->state == DCOY_M35FD_STATE_BUSY) {
+        error = DCOY_M35FD_ERROR_BUSY;
+    } else if (writing && fd->write_protected) {
+        error = DCOY_M35FD_ERROR_PROTECTED;
+    } else if (d->reg[X] >= fd->sectors) {
+        error = DCOY_M35FD_ERROR_BAD_SECTOR;
+    }
+
+    if (error) {
+        update(fd, d, fd->state, error);
+        return false;
+    }
+
+    fd->writing = writing;
+    fd->sector = d->reg[X];
+    fd->address = d->reg[Y];
+
+    unsigned int track = fd->sector / DCOY_M35FD_TRACK_SECTORS;
+    unsigned int tracks = track > fd->track ? track - fd->track
+                                            : fd->track - track;
+    fd->track = track;
+
+    prefetch(fd);
+    dcoy_dcpu_schedule(d, &fd->transfer,
+                       tracks * DCOY_M35FD_SEEK_CYCLES
+                       + DCOY_M35FD_TRANSFER_CYCLES);
+
+    update(fd, d, DCOY_M35FD_STATE_BUSY, DCOY_M35FD_ERROR_NONE);
+    return true;
+}
+
+
+static void transfer_done (dcoy_dcpu16 *d, dcoy_dcpu_event *ev) {
+    dcoy_m35fd *fd = ev->data;
+
+    if (!sector_resident(fd)) {
+        prefetch(fd);
+        dcoy_dcpu_schedule(d, &fd->transfer, DCOY_M35FD_RETRY_CYCLES);
+        return;
+    }
+
+    dcoy_word *sector = fd->media
+                      + (size_t)fd->sector * DCOY_M35FD_SECTOR_WORDS;
+
+    /* the transfer wraps around the end of DCPU memory */
+    unsigned int first = DCOY_MEM_WORDS - fd->address;
+    if (first > DCOY_M35FD_SECTOR_WORDS) {
+        first = DCOY_M35FD_SECTOR_WORDS;
+    }
+    unsigned int rest = DCOY_M35FD_SECTOR_WORDS - first;
+
+    if (fd->writing) {
+        memcpy(sector, d->mem + fd->address, first * 2);
+        memcpy(sector + first, d->mem, rest * 2);
+    } else {
+        memcpy(d->mem + fd->address, sector, first * 2);
+        memcpy(d->mem, sector + first, rest * 2);
+        dcoy_dcpu_dirty_range(d, fd->address, DCOY_M35FD_SECTOR_WORDS);
+    }
+
+    update(fd, d, ready_state(fd), fd->error);
+}
+
+
+/* Interrupts */
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw) {
+    dcoy_m35fd *fd = (dcoy_m35fd *)hw;
+
+    switch (d->reg[A]) {
+        case DCOY_M35FD_POLL:
+            d->reg[B] = fd->state;
+            d->reg[C] = fd->error;
+            fd->error = DCOY_M35FD_ERROR_NONE;
+            break;
+
+        case DCOY_M35FD_SET_INTERRUPT:
+            fd->message = d->reg[X];
+            break;
+
+        case DCOY_M35FD_READ_SECTOR:
+            d->reg[B] = start(fd, d, false);
+            break;
+
+        case DCOY_M35FD_WRITE_SECTOR:
+            d->reg[B] = start(fd, d, true);
+            break;
+    }
+
+    return 0;
+}
+
+
+/* Snapshots
+ * The media isn't part of the snapshot - the host inserts it again
+ * before loading. If it doesn't, the drive comes back empty, and any
+ * transfer that was in progress fails as if the disk was ejected. */
+
+static void save (dcoy_dcpu16 *d, dcoy_hardware *hw, dcoy_snapshot *snap) {
+    dcoy_m35fd *fd = (dcoy_m35fd *)hw;
+
+    dcoy_snapshot_put_word(snap, fd->state);
+    dcoy_snapshot_put_word(snap, fd->error);
+    dcoy_snapshot_put_word(snap, fd->message);
+    dcoy_snapshot_put_word(snap, fd->track);
+    dcoy_snapshot_put_word(snap, fd->writing);
+    dcoy_snapshot_put_word(snap, fd->sector);
+    dcoy_snapshot_put_word(snap, fd->address);
+    dcoy_snapshot_put_dword(snap, fd->transfer.scheduled
+                                  ? fd->transfer.at - d->cycles : 0);
+}
+
+
+static bool load (dcoy_dcpu16 *d, dcoy_hardware *hw, dcoy_snapshot *snap) {
+    dcoy_m35fd *fd = (dcoy_m35fd *)hw;
+    dcoy_word state, error, message, track, writing, sector, address;
+    uint32_t remaining;
+
+    if (!dcoy_snapshot_get_word(snap, &state) ||
+        !dcoy_snapshot_get_word(snap, &error) ||
+        !dcoy_snapshot_get_word(snap, &message) ||
+        !dcoy_snapshot_get_word(snap, &track) ||
+        !dcoy_snapshot_get_word(snap, &writing) ||
+        !dcoy_snapshot_get_word(snap, &sector) ||
+        !dcoy_snapshot_get_word(snap, &address) ||
+        !dcoy_snapshot_get_dword(snap, &remaining)) {
+        return false;
+    }
+
+    dcoy_dcpu_unschedule(d, &fd->transfer);
+
+    fd->error = error;
+    fd->message = message;
+    fd->track = track;
+    fd->writing = writing;
+    fd->sector = sector;
+    fd->address = address;
+
+    if (fd->media == NULL) {
+        fd->state = DCOY_M35FD_STATE_NO_MEDIA;
+        if (state == DCOY_M35FD_STATE_BUSY) {
+            fd->error = DCOY_M35FD_ERROR_EJECT;
+        }
+    } else if (state == DCOY_M35FD_STATE_BUSY && sector < fd->sectors) {
+        fd->state = state;
+        dcoy_dcpu_schedule(d, &fd->transfer, remaining);
+    } else {
+        fd->state = ready_state(fd);
+        if (state == DCOY_M35FD_STATE_BUSY) {
+            fd->error = DCOY_M35FD_ERROR_BAD_SECTOR;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,112 @@
+/**
+ * dcoy/hardware/m35fd.h
+ *
+ * Mackapar 3.5" Floppy Drive (M35FD) backed by a mapped image - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_hardware_m35fd_h
+#define _dcoy_hardware_m35fd_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Device identification */
+
+#define DCOY_M35FD_ID               0x4fd524c5
+#define DCOY_M35FD_VERSION          0x000b
+#define DCOY_M35FD_MANUFACTURER     0x1eb37e91
+
+
+/* Disk geometry and timing (in cycles at 100 kHz) */
+
+#define DCOY_M35FD_SECTOR_WORDS     512
+#define DCOY_M35FD_SECTORS          1440
+#define DCOY_M35FD_TRACK_SECTORS    18
+#define DCOY_M35FD_IMAGE_BYTES      (DCOY_M35FD_SECTORS * \
+                                     DCOY_M35FD_SECTOR_WORDS * 2)
+
+#define DCOY_M35FD_SEEK_CYCLES      240     /* 2.4 ms per track */
+#define DCOY_M35FD_TRANSFER_CYCLES  1668    /* 512 words at 30700 words/s */
+#define DCOY_M35FD_RETRY_CYCLES     100     /* waiting on the host's disk */
+
+
+/* Interrupts (values of A for HWI) */
+
+#define DCOY_M35FD_POLL             0
+#define DCOY_M35FD_SET_INTERRUPT    1
+#define DCOY_M35FD_READ_SECTOR      2
+#define DCOY_M35FD_WRITE_SECTOR     3
+
+
+/* States */
+
+#define DCOY_M35FD_STATE_NO_MEDIA   0x0000
+#define DCOY_M35FD_STATE_READY      0x0001
+#define DCOY_M35FD_STATE_READY_WP   0x0002
+#define DCOY_M35FD_STATE_BUSY       0x0003
+
+
+/* Errors */
+
+#define DCOY_M35FD_ERROR_NONE       0x0000
+#define DCOY_M35FD_ERROR_BUSY       0x0001
+#define DCOY_M35FD_ERROR_NO_MEDIA   0x0002
+#define DCOY_M35FD_ERROR_PROTECTED  0x0003
+#define DCOY_M35FD_ERROR_EJECT      0x0004
+#define DCOY_M35FD_ERROR_BAD_SECTOR 0x0005
+#define DCOY_M35FD_ERROR_BROKEN     0xffff
+
+
+/* Device structure */
+
+typedef struct dcoy_m35fd {
+    dcoy_hardware hw;
+    dcoy_dcpu_event transfer;
+
+    dcoy_word state;
+    dcoy_word error;
+    dcoy_word message;
+
+    /* the disk image, mapped straight from its file */
+    dcoy_word *media;
+    size_t media_size;
+    unsigned int sectors;
+    bool write_protected;
+
+    /* the transfer in progress */
+    unsigned int track;
+    bool writing;
+    dcoy_word sector;
+    dcoy_word address;
+} dcoy_m35fd;
+
+
+/* Instance management */
+
+dcoy_m35fd *dcoy_m35fd_create ();
+void dcoy_m35fd_initialize (dcoy_m35fd *fd);
+void dcoy_m35fd_destroy (dcoy_m35fd *fd);
+
+#define dcoy_m35fd_attach(d, fd) dcoy_dcpu_hardware_attach((d), &(fd)->hw)
+
+
+/* Media
+ * These take the DCPU the drive is attached to, so that it can be
+ * interrupted about the change in state. An image shorter than a full
+ * disk is used as it is, and the sectors it's missing read as bad,
+ * unless it's writable and inserted with DCOY_M35FD_EXTEND - then the
+ * file itself is extended to a full disk. */
+
+#define DCOY_M35FD_WRITE_PROTECTED  0x1
+#define DCOY_M35FD_EXTEND           0x2
+
+int dcoy_m35fd_insert (dcoy_m35fd *fd, dcoy_dcpu16 *d,
+                       const char *filename, unsigned int flags);
+void dcoy_m35fd_eject (dcoy_m35fd *fd, dcoy_dcpu16 *d);
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * dcoy/heatmap.c
+ *
+ * Memory access heatmaps and working sets - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/heatmap.h"
+#include "dcoy/dcpu.h"
+
+#define MAGIC           "DCOYHEAT"
+#define MAGIC_SIZE      8
+
+/* bits of seen */
+#define SEEN_TOUCHED    (1 << 0)
+#define SEEN_WRITTEN    (1 << 1)
+
+static void sample (dcoy_dcpu16 *d, dcoy_dcpu_event *ev);
+
+
+/* Instance management */
+
+dcoy_heatmap *dcoy_heatmap_create (unsigned int window, unsigned int step,
+                                   bool words) {
+    dcoy_heatmap *h = calloc(1, sizeof(dcoy_heatmap));
+    if (h == NULL) return h;
+
+    if (words) {
+        h->word_reads = calloc(DCOY_MEM_WORDS, sizeof(uint32_t));
+        h->word_writes = calloc(DCOY_MEM_WORDS, sizeof(uint32_t));
+        if (h->word_reads == NULL || h->word_writes == NULL) {
+            dcoy_heatmap_destroy(h);
+            return NULL;
+        }
+    }
+
+    h->window = window;
+    h->step = step ? step : window;
+    h->sample.fire = sample;
+    h->sample.data = h;
+    return h;
+}
+
+
+void dcoy_heatmap_destroy (dcoy_heatmap *h) {
+    /* like the profiler, it must be stopped first */
+    free(h->word_reads);
+    free(h->word_writes);
+    free(h->windows);
+    free(h);
+}
+
+
+void dcoy_heatmap_clear (dcoy_heatmap *h) {
+    memset(h->reads, 0, sizeof(h->reads));
+    memset(h->writes, 0, sizeof(h->writes));
+    memset(h->seen, 0, sizeof(h->seen));
+
+    if (h->word_reads) {
+        memset(h->word_reads, 0, DCOY_MEM_WORDS * sizeof(uint32_t));
+        memset(h->word_writes, 0, DCOY_MEM_WORDS * sizeof(uint32_t));
+    }
+
+    h->window_count = 0;
+}
+
+
+/* Counting - called by the interpreter for every access */
+
+void dcoy_heatmap_access (dcoy_heatmap *h, dcoy_word addr,
+                          unsigned int cycles, bool write) {
+    unsigned int page = addr / DCOY_DCPU_PAGE_WORDS;
+
+    h->touched_at[page] = cycles;
+    if (write) {
+        h->writes[page]++;
+        h->written_at[page] = cycles;
+        h->seen[page] |= SEEN_TOUCHED | SEEN_WRITTEN;
+        if (h->word_writes) h->word_writes[addr]++;
+    } else {
+        h->reads[page]++;
+        h->seen[page] |= SEEN_TOUCHED;
+        if (h->word_reads) h->word_reads[addr]++;
+    }
+}
+
+
+/* Working sets */
+
+static bool within (unsigned int at, unsigned int cycles,
+                    unsigned int window) {
+    /* wrapping, like dcoy_dcpu_cycles_reached */
+    return cycles - at < window;
+}
+
+
+unsigned int dcoy_heatmap_working_set (const dcoy_heatmap *h,
+                                       unsigned int cycles,
+                                       unsigned int window) {
+    unsigned int pages = 0;
+
+    for (unsigned int i = 0; i < DCOY_DCPU_PAGES; i++) {
+        if ((h->seen[i] & SEEN_TOUCHED) &&
+            within(h->touched_at[i], cycles, window)) {
+            pages++;
+        }
+    }
+    return pages;
+}
+
+
+void dcoy_heatmap_take (dcoy_heatmap *h, dcoy_dcpu16 *d) {
+    if (h->window_count == h->window_size) {
+        unsigned int size = h->window_size ? h->window_size * 2 : 256;
+        dcoy_heatmap_window *list = realloc(h->windows,
+                                            size * sizeof(dcoy_heatmap_window));
+        if (list == NULL) return;
+        h->windows = list;
+        h->window_size = size;
+    }
+
+    dcoy_heatmap_window *w = &h->windows[h->window_count++];
+    w->cycle = d->cycles;
+    w->pages = dcoy_heatmap_working_set(h, d->cycles, h->window);
+    w->written = 0;
+
+    for (unsigned int i = 0; i < DCOY_DCPU_PAGES; i++) {
+        if ((h->seen[i] & SEEN_WRITTEN) &&
+            within(h->written_at[i], d->cycles, h->window)) {
+            w->written++;
+        }
+    }
+}
+
+
+static void sample (dcoy_dcpu16 *d, dcoy_dcpu_event *ev) {
+    dcoy_heatmap *h = ev->data;
+    dcoy_heatmap_take(h, d);
+    /* on a fixed grid, as the profiler does */
+    dcoy_dcpu_schedule(d, ev, ev->at + h->step - d->cycles);
+}
+
+
+void dcoy_heatmap_start (dcoy_heatmap *h, dcoy_dcpu16 *d) {
+    d->heat = h;
+    if (h->window) {
+        dcoy_dcpu_schedule(d, &h->sample, h->step);
+    }
+}
+
+
+void dcoy_heatmap_stop (dcoy_heatmap *h, dcoy_dcpu16 *d) {
+    if (d->heat == h) {
+        d->heat = NULL;
+    }
+    dcoy_dcpu_unschedule(d, &h->sample);
+}
+
+
+/* Export */
+
+static void write_word (FILE *out, dcoy_word value) {
+    putc(value & 0xff, out);
+    putc(value >> 8, out);
+}
+
+
+static void write_dword (FILE *out, uint32_t value) {
+    write_word(out, value & 0xffff);
+    write_word(out, value >> 16);
+}
+
+
+bool dcoy_heatmap_write (const dcoy_heatmap *h, FILE *out) {
+    fwrite(MAGIC, 1, MAGIC_SIZE, out);
+    write_word(out, DCOY_HEATMAP_VERSION);
+    write_word(out, h->word_reads ? DCOY_HEATMAP_WORDS : 0);
+    write_dword(out, h->window);
+    write_dword(out, h->step);
+
+    for (unsigned int i = 0; i < DCOY_DCPU_PAGES; i++) {
+        write_dword(out, h->reads[i]);
+        write_dword(out, h->writes[i]);
+    }
+
+    if (h->word_reads) {
+        for (unsigned int i = 0; i < DCOY_MEM_WORDS; i++) {
+            write_dword(out, h->word_reads[i]);
+            write_dword(out, h->word_writes[i]);
+        }
+    }
+
+    write_dword(out, h->window_count);
+    for (unsigned int i = 0; i < h->window_count; i++) {
+        write_dword(out, h->windows[i].cycle);
+        write_word(out, h->windows[i].pages);
+        write_word(out, h->windows[i].written);
+    }
+
+    return !ferror(out);
+}
+
+
+bool dcoy_heatmap_write_pages_csv (const dcoy_heatmap *h, FILE *out) {
+    fprintf(out, "page,reads,writes\n");
+    for (unsigned int i = 0; i < DCOY_DCPU_PAGES; i++) {
+        fprintf(out, "%u,%lu,%lu\n", i, (unsigned long)h->reads[i],
+                (unsigned long)h->writes[i]);
+    }
+    return !ferror(out);
+}
+
+
+bool dcoy_heatmap_write_words_csv (const dcoy_heatmap *h, FILE *out) {
+    if (h->word_reads == NULL) return false;
+
+    fprintf(out, "address,reads,writes\n");
+    for (unsigned int i = 0; i < DCOY_MEM_WORDS; i++) {
+        if (h->word_reads[i] || h->word_writes[i]) {
+            fprintf(out, "%u,%lu,%lu\n", i, (unsigned long)h->word_reads[i],
+                    (unsigned long)h->word_writes[i]);
+        }
+    }
+    return !ferror(out);
+}
+
+
+bool dcoy_heatmap_write_windows_csv (const dcoy_heatmap *h, FILE *out) {
+    fprintf(out, "cycle,pages,written\n");
+    for (unsigned int i = 0; i < h->window_count; i++) {
+        fprintf(out, "%u,%u,%u\n", h->windows[i].cycle,
+                h->windows[i].pages, h->windows[i].written);
+    }
+    return !ferror(out);
+}
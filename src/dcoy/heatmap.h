@@ -0,0 +1,101 @@
+/**
+ * dcoy/heatmap.h
+ *
+ * Memory access heatmaps and working sets - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_heatmap_h
+#define _dcoy_heatmap_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Counts
+ * A heatmap counts reads and writes for each DCOY_DCPU_PAGE_WORDS word
+ * page, and optionally for each word. Nothing is counted (or costs more
+ * than a NULL check) while no heatmap is attached, and code run by
+ * dcoy/aot.h is never counted.
+ *
+ * Working sets
+ * Every `step` cycles, a timed event records how many distinct pages
+ * were touched, and how many written, in the last `window` cycles. So
+ * windows overlap when step is shorter than window. That needs a
+ * variant that counts cycles. */
+
+typedef struct dcoy_heatmap_window {
+    unsigned int cycle;     /* when the window ended */
+    unsigned int pages;
+    unsigned int written;
+} dcoy_heatmap_window;
+
+typedef struct dcoy_heatmap {
+    dcoy_dcpu_event sample;
+    unsigned int window;
+    unsigned int step;
+
+    uint32_t reads[DCOY_DCPU_PAGES];
+    uint32_t writes[DCOY_DCPU_PAGES];
+
+    /* DCOY_MEM_WORDS each, or NULL */
+    uint32_t *word_reads;
+    uint32_t *word_writes;
+
+    /* when each page was last touched, and last written - only valid
+     * once it has been, which `seen` records */
+    unsigned int touched_at[DCOY_DCPU_PAGES];
+    unsigned int written_at[DCOY_DCPU_PAGES];
+    uint8_t seen[DCOY_DCPU_PAGES];
+
+    dcoy_heatmap_window *windows;
+    unsigned int window_count;
+    unsigned int window_size;
+} dcoy_heatmap;
+
+
+/* Instance management
+ * step defaults to window, and a window of 0 records no working sets. */
+
+dcoy_heatmap *dcoy_heatmap_create (unsigned int window, unsigned int step,
+                                   bool words);
+void dcoy_heatmap_destroy (dcoy_heatmap *h);
+void dcoy_heatmap_clear (dcoy_heatmap *h);
+
+
+/* Recording - start attaches it to d and schedules the sampling event,
+ * and stop undoes both. take records a working set right away. */
+
+void dcoy_heatmap_start (dcoy_heatmap *h, dcoy_dcpu16 *d);
+void dcoy_heatmap_stop (dcoy_heatmap *h, dcoy_dcpu16 *d);
+void dcoy_heatmap_take (dcoy_heatmap *h, dcoy_dcpu16 *d);
+
+/* distinct pages touched in the last `window` cycles before `cycles` */
+unsigned int dcoy_heatmap_working_set (const dcoy_heatmap *h,
+                                       unsigned int cycles,
+                                       unsigned int window);
+
+
+/* Export
+ * The CSV writers give "page,reads,writes" lines (or "address,..." per
+ * word, leaving out words never touched) and "cycle,pages,written"
+ * lines, each with a header. The binary format is little-endian:
+ *
+ *     "DCOYHEAT"  u16 version  u16 flags  u32 window  u32 step
+ *     u32 reads, then u32 writes, for each page
+ *     if flags & DCOY_HEATMAP_WORDS, the same for each word
+ *     u32 window count, then u32 cycle, u16 pages, u16 written each */
+
+#define DCOY_HEATMAP_VERSION    1
+#define DCOY_HEATMAP_WORDS      (1 << 0)
+
+bool dcoy_heatmap_write (const dcoy_heatmap *h, FILE *out);
+bool dcoy_heatmap_write_pages_csv (const dcoy_heatmap *h, FILE *out);
+bool dcoy_heatmap_write_words_csv (const dcoy_heatmap *h, FILE *out);
+bool dcoy_heatmap_write_windows_csv (const dcoy_heatmap *h, FILE *out);
+
+#endif
@@ -0,0 +1,275 @@
+/**
+ * dcoy/machine.hpp
+ *
+ * A C++ front end whose devices and hooks are bound at compile time -
+ * header only, needs C++11
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_machine_hpp
+#define _dcoy_machine_hpp
+
+#include <memory>
+#include <new>
+#include <tuple>
+#include <utility>
+
+extern "C" {
+#include "dcoy/code.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/dcpu/arith.h"
+}
+
+namespace dcoy {
+
+/* Ownership
+ * dcpu_ptr owns a DCPU from dcoy_dcpu_create, and destroys it when it
+ * goes. make_dcpu throws std::bad_alloc if it can't get one. */
+
+struct dcpu_deleter {
+    void operator() (dcoy_dcpu16 *d) const { dcoy_dcpu_destroy(d); }
+};
+
+typedef std::unique_ptr<dcoy_dcpu16, dcpu_deleter> dcpu_ptr;
+
+inline dcpu_ptr make_dcpu () {
+    dcpu_ptr d(dcoy_dcpu_create());
+    if (!d) throw std::bad_alloc();
+    return d;
+}
+
+
+/* Devices
+ * A device derives from device<itself> (which is a dcoy_hardware, as C
+ * devices embed one) and defines
+ *
+ *     unsigned int interrupt (dcoy_dcpu16 *d);
+ *
+ * which a machine calls directly for HWI, so it can be inlined. The
+ * dcoy_hardware part forwards to it as well, so the same device can
+ * still be attached to a plain DCPU. */
+
+template <class Derived>
+struct device : dcoy_hardware {
+    device (dcoy_hardware_id_t id_, dcoy_hardware_version_t version_,
+            dcoy_hardware_mfid_t manufacturer_) {
+        id = id_;
+        version = version_;
+        manufacturer = manufacturer_;
+        dcoy_hardware::interrupt = &device::forward;
+        save = NULL;
+        load = NULL;
+    }
+
+    static unsigned int forward (dcoy_dcpu16 *d, dcoy_hardware *hw) {
+        return static_cast<Derived *>(hw)->interrupt(d);
+    }
+};
+
+namespace detail {
+
+/* finds device `index` out of the first N in a tuple */
+template <unsigned int N, class Tuple>
+struct dispatch {
+    static dcoy_hardware *find (Tuple &all, unsigned int index) {
+        return index == N - 1 ? &std::get<N - 1>(all)
+                              : dispatch<N - 1, Tuple>::find(all, index);
+    }
+
+    static unsigned int interrupt (Tuple &all, dcoy_dcpu16 *d,
+                                   unsigned int index) {
+        return index == N - 1
+            ? std::get<N - 1>(all).interrupt(d)
+            : dispatch<N - 1, Tuple>::interrupt(all, d, index);
+    }
+};
+
+template <class Tuple>
+struct dispatch<0, Tuple> {
+    static dcoy_hardware *find (Tuple &, unsigned int) { return NULL; }
+    static unsigned int interrupt (Tuple &, dcoy_dcpu16 *, unsigned int) {
+        return 0;
+    }
+};
+
+}
+
+/* The device set takes the first hardware indexes, in order. Devices
+ * attached to the DCPU with dcoy_dcpu_hardware_attach come after them,
+ * and are called through their function pointers as usual. */
+
+template <class... Devices>
+struct devices {
+    typedef std::tuple<Devices...> tuple;
+    static const unsigned int count = sizeof...(Devices);
+
+    tuple all;
+
+    devices () {}
+    explicit devices (Devices... each) : all(std::move(each)...) {}
+
+    dcoy_hardware *find (dcoy_dcpu16 *d, unsigned int index) {
+        return index < count
+            ? detail::dispatch<count, tuple>::find(all, index)
+            : dcoy_dcpu_hardware(d, index - count);
+    }
+
+    unsigned int interrupt (dcoy_dcpu16 *d, unsigned int index,
+                            dcoy_hardware *hw) {
+        return index < count
+            ? detail::dispatch<count, tuple>::interrupt(all, d, index)
+            : hw->interrupt(d, hw);
+    }
+};
+
+/* with no devices, this is just what the C interpreter does */
+template <>
+struct devices<> {
+    typedef std::tuple<> tuple;
+    static const unsigned int count = 0;
+
+    tuple all;
+
+    dcoy_hardware *find (dcoy_dcpu16 *d, unsigned int index) {
+        return dcoy_dcpu_hardware(d, index);
+    }
+
+    unsigned int interrupt (dcoy_dcpu16 *d, unsigned int,
+                            dcoy_hardware *hw) {
+        return hw->interrupt(d, hw);
+    }
+};
+
+
+/* Memory hooks
+ * read sees every word an instruction reads from memory (as `value`)
+ * and returns what it actually gets, and write sees every word it
+ * writes, after it's stored. That covers operands, the JSR push and
+ * the RFI pops, but not instruction fetches or interrupt entry. */
+
+struct no_hooks {
+    dcoy_word read (dcoy_dcpu16 *, dcoy_word, dcoy_word value) {
+        return value;
+    }
+    void write (dcoy_dcpu16 *, dcoy_word, dcoy_word) {}
+};
+
+
+/* Instrumentation
+ * step is called after each instruction, once any interrupt and timed
+ * events after it are done, with its address and the cycles it cost. */
+
+struct no_instrument {
+    void step (dcoy_dcpu16 *, dcoy_word, const dcoy_inst &, unsigned int) {}
+};
+
+
+/* Machines
+ * A DCPU, owned by the machine, with a run loop specialized for its
+ * device set, hooks and instrumentation. The DCPU is a new one, or one
+ * the machine adopts from a dcpu_ptr (which must not be null), keeping
+ * its state and attached hardware. run and step do what
+ * dcoy_dcpu_run (with the full variant, whatever d->variant says) and
+ * dcoy_dcpu_step do, including traps, yielding, coverage, heatmaps,
+ * dirty pages and timed events. machine<> is the plain interpreter. */
+
+template <class Devices = devices<>, class Hooks = no_hooks,
+          class Instrument = no_instrument>
+class machine {
+public:
+    explicit machine (Devices devs = Devices(), Hooks hooks = Hooks(),
+                      Instrument instrument = Instrument())
+        : d_(make_dcpu()), devices_(std::move(devs)),
+          hooks_(std::move(hooks)), instrument_(std::move(instrument)) {}
+
+    explicit machine (dcpu_ptr d, Devices devs = Devices(),
+                      Hooks hooks = Hooks(),
+                      Instrument instrument = Instrument())
+        : d_(std::move(d)), devices_(std::move(devs)),
+          hooks_(std::move(hooks)), instrument_(std::move(instrument)) {}
+
+    machine (machine &&) = default;
+    machine &operator= (machine &&) = default;
+
+    dcoy_dcpu16 *dcpu () const { return d_.get(); }
+    dcoy_dcpu16 *operator-> () const { return d_.get(); }
+
+    template <unsigned int N>
+    typename std::tuple_element<N, typename Devices::tuple>::type &
+    device () { return std::get<N>(devices_.all); }
+
+    Hooks &hooks () { return hooks_; }
+    Instrument &instrument () { return instrument_; }
+
+    unsigned int run (unsigned int steps) {
+        dcoy_dcpu16 *d = d_.get();
+        unsigned int done;
+
+        for (done = 0; done < steps && dcoy_dcpu_ready(d); done++) {
+            if (dcoy_dcpu_trapped(d, d->pc)) {
+                dcoy_dcpu_yield(d);
+                break;
+            }
+            pass(d);
+        }
+
+        d->retired += done;
+        return done;
+    }
+
+    unsigned int step () {
+        dcoy_dcpu16 *d = d_.get();
+        if (!dcoy_dcpu_running(d)) return 0;
+
+        d->retired++;
+        return pass(d);
+    }
+
+private:
+    dcpu_ptr d_;
+    Devices devices_;
+    Hooks hooks_;
+    Instrument instrument_;
+
+    inline unsigned int pass (dcoy_dcpu16 *d) {
+        dcoy_word pc = d->pc;
+        dcoy_inst inst;
+        d->pc += dcoy_dcpu_read_pc(&inst, d);
+        dcoy_word next = d->pc;
+
+        unsigned int cost = exec(d, inst);
+        d->cycles += cost;
+
+        if (d->int_queue_count && !dcoy_dcpu_yielded(d)) {
+            dcoy_dcpu_interrupt_trigger(d);
+        }
+
+        dcoy_dcpu_coverage(d, inst, next);
+
+        if (dcoy_dcpu_events_due(d)) {
+            dcoy_dcpu_events_run(d);
+        }
+
+        instrument_.step(d, pc, inst, cost);
+        return cost;
+    }
+
+#define DCOY_CORE_LOAD(d, addr) \
+    hooks_.read((d), (addr), (d)->mem[(addr)])
+#define DCOY_CORE_STORE(d, addr, value) \
+    ((d)->mem[(addr)] = (value), hooks_.write((d), (addr), (value)))
+#define DCOY_CORE_HARDWARE_COUNT(d) \
+    (Devices::count + (d)->hardware_count)
+#define DCOY_CORE_HARDWARE(d, index) \
+    devices_.find((d), (index))
+#define DCOY_CORE_HWI(d, index, hw) \
+    devices_.interrupt((d), (index), (hw))
+
+#include "dcoy/dcpu/core.h"
+};
+
+}
+
+#endif
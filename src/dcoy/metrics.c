@@ -0,0 +1,357 @@
+/**
+ * dcoy/metrics.c
+ *
+ * Per-DCPU counters published in shared memory - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dcoy/metrics.h"
+#include "dcoy/dcpu.h"
+
+const char *const dcoy_metrics_error_names[DCOY_METRICS_ERRORS] = {
+    "invalid_opcode", "invalid_spec_opcode", "invalid_arg_type",
+    "no_hardware", "other"
+};
+
+static unsigned int error_index (unsigned int code) {
+    switch (code) {
+        case DCOY_DCPU_ERROR_INVALID_OPCODE:        return 0;
+        case DCOY_DCPU_ERROR_INVALID_SPEC_OPCODE:   return 1;
+        case DCOY_DCPU_ERROR_INVALID_ARG_TYPE:      return 2;
+        case DCOY_DCPU_ERROR_NO_HARDWARE:           return 3;
+        default:                                    return 4;
+    }
+}
+
+
+static uint64_t now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Regions */
+
+static dcoy_metrics *map (const char *name, int fd, size_t size,
+                          bool owner) {
+    dcoy_metrics *m = calloc(1, sizeof(dcoy_metrics));
+    void *region = mmap(NULL, size, owner ? PROT_READ | PROT_WRITE
+                                          : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (m == NULL || region == MAP_FAILED || !(m->name = strdup(name))) {
+        if (region != MAP_FAILED) munmap(region, size);
+        free(m);
+        return NULL;
+    }
+
+    m->size = size;
+    m->header = region;
+    m->slots = (dcoy_metrics_slot *)(m->header + 1);
+    return m;
+}
+
+
+dcoy_metrics *dcoy_metrics_create (const char *name, unsigned int slots) {
+    size_t size = sizeof(dcoy_metrics_header) +
+                  (size_t)slots * sizeof(dcoy_metrics_slot);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    dcoy_metrics *m = map(name, fd, size, true);
+    if (m == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /* the slots start out zeroed, which is free and unlocked */
+    m->header->version = DCOY_METRICS_VERSION;
+    m->header->slot_size = sizeof(dcoy_metrics_slot);
+    m->header->slot_count = slots;
+    atomic_thread_fence(memory_order_release);
+    memcpy(m->header->magic, DCOY_METRICS_MAGIC, 8);
+    return m;
+}
+
+
+void dcoy_metrics_destroy (dcoy_metrics *m) {
+    shm_unlink(m->name);
+    dcoy_metrics_close(m);
+}
+
+
+dcoy_metrics *dcoy_metrics_open (const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        (size_t)st.st_size < sizeof(dcoy_metrics_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    dcoy_metrics *m = map(name, fd, st.st_size, false);
+    if (m == NULL) return NULL;
+
+    dcoy_metrics_header *h = m->header;
+    if (memcmp(h->magic, DCOY_METRICS_MAGIC, 8) != 0 ||
+        h->version != DCOY_METRICS_VERSION ||
+        h->slot_size != sizeof(dcoy_metrics_slot) ||
+        sizeof(dcoy_metrics_header) +
+            (size_t)h->slot_count * h->slot_size > m->size) {
+        dcoy_metrics_close(m);
+        return NULL;
+    }
+    return m;
+}
+
+
+void dcoy_metrics_close (dcoy_metrics *m) {
+    munmap(m->header, m->size);
+    free(m->name);
+    free(m);
+}
+
+
+/* Sources */
+
+/* name is only set on attaching, but it's covered by seq all the same */
+static void publish (dcoy_metrics_source *src, const char *name) {
+    dcoy_metrics_slot *slot = src->slot;
+    unsigned int seq = atomic_load_explicit(&slot->seq,
+                                            memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    if (name) {
+        strncpy(slot->name, name, DCOY_METRICS_NAME - 1);
+        slot->name[DCOY_METRICS_NAME - 1] = '\0';
+    }
+    slot->counters = src->totals;
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+
+dcoy_metrics_source *dcoy_metrics_attach (dcoy_metrics *m, dcoy_dcpu16 *d,
+                                          const char *name) {
+    dcoy_metrics_source *src = calloc(1, sizeof(dcoy_metrics_source));
+    if (src == NULL) return src;
+
+    for (unsigned int i = 0; i < m->header->slot_count; i++) {
+        unsigned int unused = 0;
+        if (atomic_compare_exchange_strong(&m->slots[i].live, &unused, 1)) {
+            src->slot = &m->slots[i];
+            break;
+        }
+    }
+    if (src->slot == NULL) {
+        free(src);
+        return NULL;
+    }
+
+    /* it counts from here */
+    src->d = d;
+    src->cycles = d->cycles;
+    src->retired = d->retired;
+    src->int_queued = d->int_queued;
+    src->int_delivered = d->int_delivered;
+    src->int_dropped = d->int_dropped;
+    src->errored = d->error_code != DCOY_DCPU_ERROR_NONE;
+    src->totals.updated = now();
+
+    publish(src, name ? name : "");
+    return src;
+}
+
+
+void dcoy_metrics_detach (dcoy_metrics_source *src) {
+    atomic_store_explicit(&src->slot->live, 0, memory_order_release);
+    free(src);
+}
+
+
+void dcoy_metrics_update (dcoy_metrics_source *src, uint64_t exec_ns) {
+    dcoy_dcpu16 *d = src->d;
+    dcoy_metrics_counters *t = &src->totals;
+
+    /* differences of wrapping counters are right as long as fewer
+     * than 2^32 go by between updates */
+    t->cycles += d->cycles - src->cycles;
+    t->instructions += d->retired - src->retired;
+    t->interrupts_queued += d->int_queued - src->int_queued;
+    t->interrupts_delivered += d->int_delivered - src->int_delivered;
+    t->interrupts_dropped += d->int_dropped - src->int_dropped;
+    t->exec_ns += exec_ns;
+    t->updated = now();
+
+    src->cycles = d->cycles;
+    src->retired = d->retired;
+    src->int_queued = d->int_queued;
+    src->int_delivered = d->int_delivered;
+    src->int_dropped = d->int_dropped;
+
+    /* an error halts the DCPU, so each lasts until the host clears it */
+    bool errored = d->error_code != DCOY_DCPU_ERROR_NONE;
+    if (errored && !src->errored) {
+        t->errors[error_index(d->error_code)]++;
+    }
+    src->errored = errored;
+
+    publish(src, NULL);
+}
+
+
+unsigned int dcoy_metrics_run (dcoy_metrics_source *src, unsigned int steps) {
+    uint64_t start = now();
+    unsigned int done = dcoy_dcpu_run(src->d, steps);
+    dcoy_metrics_update(src, now() - start);
+    return done;
+}
+
+
+/* Reading */
+
+int dcoy_metrics_read (const dcoy_metrics *m, unsigned int index,
+                       dcoy_metrics_counters *out,
+                       char name[DCOY_METRICS_NAME]) {
+    dcoy_metrics_slot *slot = &m->slots[index];
+
+    for (unsigned int tries = 0; tries < DCOY_METRICS_RETRIES; tries++) {
+        if (tries) sched_yield();
+
+        if (!atomic_load_explicit(&slot->live, memory_order_acquire)) {
+            return DCOY_METRICS_UNUSED;
+        }
+
+        unsigned int seq = atomic_load_explicit(&slot->seq,
+                                                memory_order_acquire);
+        if (seq & 1) continue;
+
+        *out = slot->counters;
+        memcpy(name, slot->name, DCOY_METRICS_NAME);
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+            name[DCOY_METRICS_NAME - 1] = '\0';
+            return DCOY_METRICS_OK;
+        }
+    }
+
+    return DCOY_METRICS_UNAVAILABLE;
+}
+
+
+/* Export */
+
+static void write_label (FILE *out, const char *name, unsigned int index) {
+    fputs("{name=\"", out);
+    for (const char *c = name; *c; c++) {
+        switch (*c) {
+            case '\\':  fputs("\\\\", out);     break;
+            case '"':   fputs("\\\"", out);     break;
+            case '\n':  fputs("\\n", out);      break;
+            default:    fputc(*c, out);         break;
+        }
+    }
+    fprintf(out, "\",slot=\"%u\"", index);
+}
+
+
+/* one metric family, with a sample for each slot in use */
+#define SERIES(metric, type, help, fmt, value) do { \
+    fprintf(out, "# HELP dcoy_" metric " " help "\n" \
+                 "# TYPE dcoy_" metric " " type "\n"); \
+    for (unsigned int i = 0; i < count; i++) { \
+        if (state[i] != DCOY_METRICS_OK) continue; \
+        fputs("dcoy_" metric, out); \
+        write_label(out, names[i], i); \
+        fprintf(out, "} " fmt "\n", value); \
+    } \
+} while (0)
+
+bool dcoy_metrics_write_text (const dcoy_metrics *m, FILE *out) {
+    unsigned int count = m->header->slot_count;
+    size_t n = count ? count : 1;
+    dcoy_metrics_counters *all = calloc(n, sizeof(dcoy_metrics_counters));
+    char (*names)[DCOY_METRICS_NAME] = calloc(n, DCOY_METRICS_NAME);
+    int *state = calloc(n, sizeof(int));
+    bool ok = all && names && state;
+
+    /* one consistent copy of each, so that every family agrees */
+    for (unsigned int i = 0; ok && i < count; i++) {
+        state[i] = dcoy_metrics_read(m, i, &all[i], names[i]);
+    }
+
+    if (ok) {
+        SERIES("cycles_total", "counter", "DCPU cycles run.",
+               "%llu", (unsigned long long)all[i].cycles);
+        SERIES("instructions_total", "counter", "Instructions retired.",
+               "%llu", (unsigned long long)all[i].instructions);
+        SERIES("interrupts_queued_total", "counter",
+               "Interrupts added to the queue.",
+               "%llu", (unsigned long long)all[i].interrupts_queued);
+        SERIES("interrupts_delivered_total", "counter",
+               "Interrupts delivered to a handler.",
+               "%llu", (unsigned long long)all[i].interrupts_delivered);
+        SERIES("interrupts_dropped_total", "counter",
+               "Interrupts dropped because the queue was full.",
+               "%llu", (unsigned long long)all[i].interrupts_dropped);
+
+        fprintf(out, "# HELP dcoy_errors_total Errors, by code.\n"
+                     "# TYPE dcoy_errors_total counter\n");
+        for (unsigned int i = 0; i < count; i++) {
+            if (state[i] != DCOY_METRICS_OK) continue;
+            for (unsigned int e = 0; e < DCOY_METRICS_ERRORS; e++) {
+                fputs("dcoy_errors_total", out);
+                write_label(out, names[i], i);
+                fprintf(out, ",code=\"%s\"} %llu\n",
+                        dcoy_metrics_error_names[e],
+                        (unsigned long long)all[i].errors[e]);
+            }
+        }
+
+        SERIES("exec_seconds_total", "counter",
+               "Time spent running the DCPU.",
+               "%.9f", all[i].exec_ns / 1e9);
+        SERIES("updated_seconds", "gauge",
+               "Monotonic clock time of the last update.",
+               "%.6f", all[i].updated / 1e9);
+
+        /* by slot alone, since even the name can't be trusted */
+        fprintf(out, "# HELP dcoy_unavailable Slots in use that couldn't "
+                     "be read, as an update never finished.\n"
+                     "# TYPE dcoy_unavailable gauge\n");
+        for (unsigned int i = 0; i < count; i++) {
+            if (state[i] != DCOY_METRICS_UNAVAILABLE) continue;
+            fprintf(out, "dcoy_unavailable{slot=\"%u\"} 1\n", i);
+        }
+    }
+
+    free(all);
+    free(names);
+    free(state);
+    return ok && !ferror(out);
+}
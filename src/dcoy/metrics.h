@@ -0,0 +1,140 @@
+/**
+ * dcoy/metrics.h
+ *
+ * Per-DCPU counters published in shared memory - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_metrics_h
+#define _dcoy_metrics_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+
+/* Layout
+ * A region is a header followed by a fixed number of slots, in a POSIX
+ * shared memory object that any process can map to read them. Each
+ * slot is written by one thread only - whichever runs its DCPU - and
+ * takes up whole cache lines of its own, so writers never share a line.
+ *
+ * Slots are seqlocked: seq is odd while its writer is updating it, so
+ * a reader copies the slot and tries again if seq was odd or changed
+ * in the meantime. Readers never write to the region, and never hold
+ * up a writer.
+ *
+ * Everything is 64 bits and counts up from when the slot was taken,
+ * except updated, the monotonic time in ns it was last published. */
+
+#define DCOY_METRICS_MAGIC      "DCOYMETR"
+#define DCOY_METRICS_VERSION    1
+#define DCOY_METRICS_LINE       64
+#define DCOY_METRICS_NAME       24
+
+/* errors are counted for each DCOY_DCPU_ERROR_* code, and any other */
+#define DCOY_METRICS_ERRORS     5
+
+extern const char *const dcoy_metrics_error_names[DCOY_METRICS_ERRORS];
+
+typedef struct dcoy_metrics_counters {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t interrupts_queued;
+    uint64_t interrupts_delivered;
+    uint64_t interrupts_dropped;    /* queue full, so the DCPU caught fire */
+    uint64_t errors[DCOY_METRICS_ERRORS];
+    uint64_t exec_ns;
+    uint64_t updated;
+} dcoy_metrics_counters;
+
+typedef struct dcoy_metrics_slot {
+    _Alignas(DCOY_METRICS_LINE) atomic_uint seq;
+    atomic_uint live;
+    char name[DCOY_METRICS_NAME];
+    dcoy_metrics_counters counters;
+} dcoy_metrics_slot;
+
+typedef struct dcoy_metrics_header {
+    _Alignas(DCOY_METRICS_LINE) char magic[8];
+    uint32_t version;
+    uint32_t slot_size;         /* so readers know they agree */
+    uint32_t slot_count;
+} dcoy_metrics_header;
+
+
+/* Regions
+ * create makes (or replaces) the shared memory object `name` - which
+ * starts with a slash, as for shm_open - and destroy unlinks it again.
+ * open maps an existing one read only, for readers, and checks that it
+ * was made with the same layout; close just unmaps it. */
+
+typedef struct dcoy_metrics {
+    char *name;
+    size_t size;
+    dcoy_metrics_header *header;
+    dcoy_metrics_slot *slots;
+} dcoy_metrics;
+
+dcoy_metrics *dcoy_metrics_create (const char *name, unsigned int slots);
+void dcoy_metrics_destroy (dcoy_metrics *m);
+
+dcoy_metrics *dcoy_metrics_open (const char *name);
+void dcoy_metrics_close (dcoy_metrics *m);
+
+
+/* Sources
+ * A source takes a free slot for one DCPU, and keeps what it last saw
+ * of the DCPU's own wrapping counters, so that it can publish 64 bit
+ * totals. The thread running the DCPU calls update after running it by
+ * any means, with the time that took - or run, which times a call to
+ * dcoy_dcpu_run and updates. Any thread may attach or detach sources. */
+
+typedef struct dcoy_metrics_source {
+    dcoy_metrics_slot *slot;
+    dcoy_dcpu16 *d;
+
+    /* the DCPU's counters, as of the last update */
+    unsigned int cycles;
+    unsigned int retired;
+    unsigned int int_queued;
+    unsigned int int_delivered;
+    unsigned int int_dropped;
+    bool errored;
+
+    /* what's published, kept here so the slot is only ever written */
+    dcoy_metrics_counters totals;
+} dcoy_metrics_source;
+
+dcoy_metrics_source *dcoy_metrics_attach (dcoy_metrics *m, dcoy_dcpu16 *d,
+                                          const char *name);
+void dcoy_metrics_detach (dcoy_metrics_source *src);
+
+void dcoy_metrics_update (dcoy_metrics_source *src, uint64_t exec_ns);
+unsigned int dcoy_metrics_run (dcoy_metrics_source *src, unsigned int steps);
+
+
+/* Reading
+ * read copies out the counters and name of slot `index` consistently.
+ * It tries up to DCOY_METRICS_RETRIES times, yielding in between, and
+ * then gives up on the slot as unavailable - its writer may have died
+ * halfway through an update. write_text prints every slot in use in
+ * the Prometheus text exposition format, labelled by name and slot,
+ * and flags unavailable ones with dcoy_unavailable rather than waiting
+ * on them. */
+
+#define DCOY_METRICS_UNUSED         0
+#define DCOY_METRICS_OK             1
+#define DCOY_METRICS_UNAVAILABLE    2
+
+#define DCOY_METRICS_RETRIES        4096
+
+int dcoy_metrics_read (const dcoy_metrics *m, unsigned int index,
+                       dcoy_metrics_counters *out,
+                       char name[DCOY_METRICS_NAME]);
+bool dcoy_metrics_write_text (const dcoy_metrics *m, FILE *out);
+
+#endif
@@ -0,0 +1,330 @@
+/**
+ * dcoy/pace.c
+ *
+ * Real-time pacing for many DCPUs on one thread - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dcoy/pace.h"
+#include "dcoy/dcpu.h"
+
+#define NS      1000000000ull
+
+/* Instances are run in batches of this many cycles' worth of
+ * instructions at a time (assuming they take at least this many), and
+ * then one at a time close to the target, as in dcoy/sched.c */
+#define BATCH_COST      8
+
+
+uint64_t dcoy_pace_now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS + ts.tv_nsec;
+}
+
+
+/* Time conversion - split up so that cycles * NS can't overflow */
+
+static uint64_t cycles_to_ns (const dcoy_pacer *p, uint64_t cycles) {
+    return cycles / p->hz * NS + cycles % p->hz * NS / p->hz;
+}
+
+static uint64_t ns_to_cycles (const dcoy_pacer *p, uint64_t ns) {
+    return ns / NS * p->hz + ns % NS * p->hz / NS;
+}
+
+#define due_at(p, e)    ((e)->epoch + cycles_to_ns((p), (e)->cycles))
+
+
+/* Timer wheel */
+
+/* An instance goes in the first tick that starts once it's due, so it's
+ * never run early */
+static void schedule (dcoy_pacer *p, dcoy_paced *e) {
+    uint64_t tick = (e->due + DCOY_PACE_TICK - 1) / DCOY_PACE_TICK;
+    if (tick <= p->tick) {
+        tick = p->tick + 1;
+    }
+
+    e->rounds = (tick - p->tick - 1) / DCOY_PACE_SLOTS;
+    e->slot = tick % DCOY_PACE_SLOTS;
+    e->prev = NULL;
+    e->next = p->slots[e->slot];
+    if (e->next) e->next->prev = e;
+    p->slots[e->slot] = e;
+}
+
+
+static void unschedule (dcoy_pacer *p, dcoy_paced *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        p->slots[e->slot] = e->next;
+    }
+    if (e->next) e->next->prev = e->prev;
+    e->next = e->prev = NULL;
+}
+
+
+/* Instance management */
+
+dcoy_pacer *dcoy_pacer_create (unsigned int hz, uint64_t batch,
+                               uint64_t max_lag) {
+    dcoy_pacer *p = calloc(1, sizeof(dcoy_pacer));
+    if (p == NULL) return p;
+
+    p->hz = hz ? hz : DCOY_PACE_HZ;
+    p->batch = batch ? batch : DCOY_PACE_BATCH;
+    p->max_lag = max_lag ? max_lag : DCOY_PACE_MAX_LAG;
+    p->tick = dcoy_pace_now() / DCOY_PACE_TICK;
+    return p;
+}
+
+
+void dcoy_pacer_destroy (dcoy_pacer *p) {
+    for (unsigned int i = 0; i < p->instance_count; i++) {
+        free(p->instances[i]);
+    }
+    free(p->instances);
+    free(p);
+}
+
+
+dcoy_paced *dcoy_pacer_add (dcoy_pacer *p, dcoy_dcpu16 *d) {
+    if (p->instance_count == p->instance_size) {
+        unsigned int size = p->instance_size ? p->instance_size * 2 : 8;
+        dcoy_paced **list = realloc(p->instances, size * sizeof(dcoy_paced *));
+        if (list == NULL) return NULL;
+        p->instances = list;
+        p->instance_size = size;
+    }
+
+    dcoy_paced *e = calloc(1, sizeof(dcoy_paced));
+    if (e == NULL) return e;
+
+    e->d = d;
+    e->epoch = e->due = dcoy_pace_now();
+    schedule(p, e);
+
+    p->instances[p->instance_count++] = e;
+    return e;
+}
+
+
+void dcoy_pacer_remove (dcoy_pacer *p, dcoy_paced *e) {
+    for (unsigned int i = 0; i < p->instance_count; i++) {
+        if (p->instances[i] == e) {
+            memmove(&p->instances[i], &p->instances[i + 1],
+                    (p->instance_count - i - 1) * sizeof(dcoy_paced *));
+            p->instance_count--;
+            if (!e->parked) unschedule(p, e);
+            free(e);
+            return;
+        }
+    }
+}
+
+
+void dcoy_pacer_wake (dcoy_pacer *p, dcoy_paced *e) {
+    if (!e->parked) return;
+
+    /* the epoch moves up so that its next cycle is due now */
+    e->due = dcoy_pace_now();
+    e->epoch = e->due - cycles_to_ns(p, e->cycles);
+    e->parked = false;
+    schedule(p, e);
+}
+
+
+/* Running */
+
+static void record (unsigned long *lateness, uint64_t late) {
+    unsigned int bucket = 0;
+    for (uint64_t us = late / 1000; us && bucket < DCOY_PACE_BUCKETS - 1;
+         us >>= 1) {
+        bucket++;
+    }
+    lateness[bucket]++;
+}
+
+
+static void visit (dcoy_pacer *p, dcoy_paced *e, uint64_t now) {
+    dcoy_dcpu16 *d = e->d;
+
+    uint64_t late = now > e->due ? now - e->due : 0;
+    record(e->lateness, late);
+    record(p->lateness, late);
+    e->late_total += late;
+    p->late_total += late;
+    if (late > e->late_max) e->late_max = late;
+    if (late > p->late_max) p->late_max = late;
+    e->visits++;
+    p->visits++;
+
+    /* drop whatever backlog it can't catch up on */
+    uint64_t at = due_at(p, e);
+    if (now > at + p->max_lag) {
+        uint64_t skip = now - p->max_lag - at;
+        e->epoch += skip;
+        e->dropped += ns_to_cycles(p, skip);
+        e->stalls++;
+    }
+
+    uint64_t target = ns_to_cycles(p, now + p->batch - e->epoch);
+    bool counts_cycles = dcoy_dcpu_variant_counts_cycles(d->variant);
+
+    while (e->cycles < target && dcoy_dcpu_ready(d)) {
+        unsigned int start = d->cycles;
+        unsigned int ran = dcoy_dcpu_run(d,
+            (target - e->cycles) / BATCH_COST + 1);
+
+        e->cycles += counts_cycles ? d->cycles - start : ran;
+        if (ran == 0) break;
+    }
+
+    if (!dcoy_dcpu_ready(d)) {
+        e->parked = true;
+        return;
+    }
+
+    e->due = due_at(p, e);
+    schedule(p, e);
+}
+
+
+unsigned long dcoy_pacer_poll (dcoy_pacer *p, uint64_t now) {
+    uint64_t last = now / DCOY_PACE_TICK;
+    unsigned long visits = 0;
+
+    while (p->tick < last) {
+        p->tick++;
+
+        /* anything rescheduled goes to a later tick, or the head of
+         * this slot a whole turn later, so it isn't seen again here.
+         * Each visit reads the clock, so time spent on the ones before
+         * it counts towards its lateness. */
+        dcoy_paced *e = p->slots[p->tick % DCOY_PACE_SLOTS], *next;
+        for (; e; e = next) {
+            next = e->next;
+            if (e->rounds) {
+                e->rounds--;
+                continue;
+            }
+            unschedule(p, e);
+            visit(p, e, dcoy_pace_now());
+            visits++;
+        }
+    }
+
+    return visits;
+}
+
+
+uint64_t dcoy_pacer_next (const dcoy_pacer *p) {
+    for (unsigned int i = 1; i <= DCOY_PACE_SLOTS; i++) {
+        uint64_t tick = p->tick + i;
+        for (dcoy_paced *e = p->slots[tick % DCOY_PACE_SLOTS]; e;
+             e = e->next) {
+            if (e->rounds == 0) return tick * DCOY_PACE_TICK;
+        }
+    }
+
+    /* nothing this turn - come back to count the rounds down */
+    return (p->tick + DCOY_PACE_SLOTS) * DCOY_PACE_TICK;
+}
+
+
+unsigned long dcoy_pacer_run (dcoy_pacer *p, uint64_t until) {
+    unsigned long visits = 0;
+
+    for (;;) {
+        uint64_t now = dcoy_pace_now();
+        visits += dcoy_pacer_poll(p, now);
+        if (now >= until) break;
+
+        /* sleeping until an absolute time doesn't drift */
+        uint64_t wake = dcoy_pacer_next(p);
+        if (wake > until) wake = until;
+        if (wake > now) {
+            struct timespec ts = {wake / NS, wake % NS};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+
+    return visits;
+}
+
+
+/* Statistics */
+
+uint64_t dcoy_pace_percentile (const unsigned long *lateness, double q) {
+    unsigned long total = 0, seen = 0;
+    for (unsigned int i = 0; i < DCOY_PACE_BUCKETS; i++) {
+        total += lateness[i];
+    }
+
+    for (unsigned int i = 0; i < DCOY_PACE_BUCKETS; i++) {
+        seen += lateness[i];
+        if (seen && seen >= q * total) {
+            return (uint64_t)1000 << i;
+        }
+    }
+    return 0;
+}
+
+
+static const char *status (const dcoy_paced *e) {
+    if (!dcoy_dcpu_running(e->d)) {
+        return e->d->error_code ? "error" : "halted";
+    }
+    return e->parked ? "parked" : "paced";
+}
+
+
+bool dcoy_pacer_write_stats (const dcoy_pacer *p, FILE *out) {
+    uint64_t cycles = 0, dropped = 0;
+    unsigned long stalls = 0;
+
+    fprintf(out, "instance cycles visits late_mean late_p50 late_p99 "
+                 "late_max stalls dropped status\n");
+
+    for (unsigned int i = 0; i < p->instance_count; i++) {
+        const dcoy_paced *e = p->instances[i];
+        fprintf(out, "%u %llu %lu %llu %llu %llu %llu %lu %llu %s\n", i,
+                (unsigned long long)e->cycles, e->visits,
+                (unsigned long long)(e->visits
+                    ? e->late_total / e->visits / 1000 : 0),
+                (unsigned long long)dcoy_pace_percentile(e->lateness,
+                                                         0.5) / 1000,
+                (unsigned long long)dcoy_pace_percentile(e->lateness,
+                                                         0.99) / 1000,
+                (unsigned long long)e->late_max / 1000, e->stalls,
+                (unsigned long long)e->dropped, status(e));
+
+        cycles += e->cycles;
+        dropped += e->dropped;
+        stalls += e->stalls;
+    }
+
+    fprintf(out, "all %llu %lu %llu %llu %llu %llu %lu %llu -\n",
+            (unsigned long long)cycles, p->visits,
+            (unsigned long long)(p->visits
+                ? p->late_total / p->visits / 1000 : 0),
+            (unsigned long long)dcoy_pace_percentile(p->lateness,
+                                                     0.5) / 1000,
+            (unsigned long long)dcoy_pace_percentile(p->lateness,
+                                                     0.99) / 1000,
+            (unsigned long long)p->late_max / 1000, stalls,
+            (unsigned long long)dropped);
+
+    return !ferror(out);
+}
@@ -0,0 +1,135 @@
+/**
+ * dcoy/pace.h
+ *
+ * Real-time pacing for many DCPUs on one thread - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_pace_h
+#define _dcoy_pace_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+
+/* Time
+ * Wall time is in nanoseconds on the monotonic clock. Each instance's
+ * cycles are due at a fixed rate from its epoch - cycle n at
+ * epoch + n / hz seconds - so rounding never builds up, however small
+ * the batches are. Variants that don't count cycles are paced by
+ * instructions. */
+
+#define DCOY_PACE_HZ        100000      /* the DCPU's nominal clock */
+#define DCOY_PACE_BATCH     1000000     /* ns of guest time a visit runs
+                                         * ahead of the wall clock */
+#define DCOY_PACE_MAX_LAG   50000000    /* ns an instance may catch up */
+
+#define DCOY_PACE_TICK      100000      /* ns per timer wheel slot */
+#define DCOY_PACE_SLOTS     256
+
+uint64_t dcoy_pace_now ();
+
+
+/* Instances
+ * Each visit runs an instance until its guest time is `batch` ahead of
+ * the wall clock, so it next comes due when the wall clock catches up.
+ * How late that visit actually starts is its lateness. An instance that
+ * has fallen more than max_lag behind (because the host stalled, or
+ * there's more work than one thread can do) runs only enough to get
+ * back within max_lag, and the rest of its backlog is dropped.
+ *
+ * Lateness is also kept as a histogram with power of two buckets of
+ * microseconds: bucket 0 is under 1us, bucket i is under 2^i us, and
+ * the last takes anything later.
+ *
+ * An instance that halts or yields is parked until the host wakes it,
+ * and is then paced from the time it woke, not from when it stopped. */
+
+#define DCOY_PACE_BUCKETS   24
+
+typedef struct dcoy_paced {
+    dcoy_dcpu16 *d;
+
+    uint64_t epoch;             /* when cycle 0 was due */
+    uint64_t cycles;            /* run since it was added */
+    uint64_t due;
+    bool parked;
+
+    /* on the wheel */
+    struct dcoy_paced *next;
+    struct dcoy_paced *prev;
+    unsigned int slot;
+    unsigned int rounds;        /* turns of the wheel left before due */
+
+    /* statistics */
+    unsigned long visits;
+    uint64_t late_total;        /* ns */
+    uint64_t late_max;
+    unsigned long stalls;       /* visits that hit max_lag */
+    uint64_t dropped;           /* cycles of backlog dropped */
+    unsigned long lateness[DCOY_PACE_BUCKETS];
+} dcoy_paced;
+
+
+/* Pacer
+ * Instances are kept on a hashed timer wheel of DCOY_PACE_SLOTS slots
+ * of DCOY_PACE_TICK each, by when they're next due. Adding, removing
+ * and rescheduling an instance take constant time, and each tick only
+ * looks at the instances in its slot. Instances belong to the pacer,
+ * their DCPUs to the host. */
+
+typedef struct dcoy_pacer {
+    unsigned int hz;
+    uint64_t batch;
+    uint64_t max_lag;
+
+    dcoy_paced **instances;
+    unsigned int instance_count;
+    unsigned int instance_size;
+
+    dcoy_paced *slots[DCOY_PACE_SLOTS];
+    uint64_t tick;              /* the last one handled */
+
+    /* every visit to every instance */
+    unsigned long visits;
+    uint64_t late_total;
+    uint64_t late_max;
+    unsigned long lateness[DCOY_PACE_BUCKETS];
+} dcoy_pacer;
+
+/* 0 for any of these takes the default */
+dcoy_pacer *dcoy_pacer_create (unsigned int hz, uint64_t batch,
+                               uint64_t max_lag);
+void dcoy_pacer_destroy (dcoy_pacer *p);
+
+/* An instance starts out due right away. */
+dcoy_paced *dcoy_pacer_add (dcoy_pacer *p, dcoy_dcpu16 *d);
+void dcoy_pacer_remove (dcoy_pacer *p, dcoy_paced *e);
+void dcoy_pacer_wake (dcoy_pacer *p, dcoy_paced *e);
+
+
+/* Running
+ * poll visits every instance due by `now` (reading the clock again for
+ * each visit) and returns how many it visited, and next says when the
+ * next might be due, for hosts with their own event loops. run does
+ * both until `until`, sleeping in between, and returns the number of
+ * visits. */
+
+unsigned long dcoy_pacer_poll (dcoy_pacer *p, uint64_t now);
+uint64_t dcoy_pacer_next (const dcoy_pacer *p);
+unsigned long dcoy_pacer_run (dcoy_pacer *p, uint64_t until);
+
+
+/* Statistics
+ * percentile gives the upper bound, in ns, of the histogram bucket that
+ * the fraction `q` of visits were no later than - for all of them, or
+ * one instance's. The stats are a header line, a line per instance, and
+ * a line for all of them, with times in microseconds. */
+
+uint64_t dcoy_pace_percentile (const unsigned long *lateness, double q);
+bool dcoy_pacer_write_stats (const dcoy_pacer *p, FILE *out);
+
+#endif
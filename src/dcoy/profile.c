@@ -0,0 +1,316 @@
+/**
+ * dcoy/profile.c
+ *
+ * Sampling profiler for guest code - implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/profile.h"
+#include "dcoy/code.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+#define INITIAL_STACKS  256     /* must be a power of two */
+#define LINE_LENGTH     256
+
+static void sample (dcoy_dcpu16 *d, dcoy_dcpu_event *ev);
+
+
+/* Instance management */
+
+dcoy_profile *dcoy_profile_create (unsigned int period) {
+    dcoy_profile *p = calloc(1, sizeof(dcoy_profile));
+    if (p == NULL) return p;
+
+    p->period = period ? period : 1;
+    p->sample.fire = sample;
+    p->sample.data = p;
+    return p;
+}
+
+
+void dcoy_profile_destroy (dcoy_profile *p) {
+    /* like devices, the profiler must be stopped before it's freed */
+    for (unsigned int i = 0; i < p->symbol_count; i++) {
+        free(p->symbols[i].name);
+    }
+    free(p->symbols);
+    free(p->stacks);
+    free(p);
+}
+
+
+void dcoy_profile_clear (dcoy_profile *p) {
+    free(p->stacks);
+    p->stacks = NULL;
+    p->stack_count = 0;
+    p->stack_size = 0;
+    p->samples = 0;
+}
+
+
+/* Stacks */
+
+static unsigned int stack_hash (const dcoy_profile_stack *s) {
+    uint32_t hash = 2166136261u ^ s->depth;
+    for (unsigned int i = 0; i < s->depth; i++) {
+        hash = (hash ^ s->frames[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+static bool stack_equal (const dcoy_profile_stack *a,
+                         const dcoy_profile_stack *b) {
+    return a->depth == b->depth &&
+           memcmp(a->frames, b->frames, a->depth * sizeof(dcoy_word)) == 0;
+}
+
+
+static dcoy_profile_stack *stack_slot (dcoy_profile_stack *table,
+                                       unsigned int size,
+                                       const dcoy_profile_stack *s) {
+    unsigned int i = stack_hash(s) & (size - 1);
+    while (table[i].count && !stack_equal(&table[i], s)) {
+        i = (i + 1) & (size - 1);
+    }
+    return &table[i];
+}
+
+
+static bool stacks_grow (dcoy_profile *p) {
+    unsigned int size = p->stack_size ? p->stack_size * 2 : INITIAL_STACKS;
+    dcoy_profile_stack *table = calloc(size, sizeof(dcoy_profile_stack));
+    if (table == NULL) return false;
+
+    for (unsigned int i = 0; i < p->stack_size; i++) {
+        if (p->stacks[i].count) {
+            *stack_slot(table, size, &p->stacks[i]) = p->stacks[i];
+        }
+    }
+
+    free(p->stacks);
+    p->stacks = table;
+    p->stack_size = size;
+    return true;
+}
+
+
+/* Sampling */
+
+/* A word on the stack is taken to be a return address if the
+ * instruction just before it (one or two words back) is a JSR that
+ * ends exactly there. */
+static bool return_address (dcoy_dcpu16 *d, dcoy_word addr) {
+    dcoy_inst inst;
+
+    for (dcoy_word size = 1; size <= 2; size++) {
+        dcoy_word start = addr - size;
+        if (dcoy_dcpu_read_inst(&inst, d, start) == size &&
+            inst.special && inst.opcode == DCOY_SOP_JSR) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void dcoy_profile_take (dcoy_profile *p, dcoy_dcpu16 *d) {
+    dcoy_profile_stack s;
+    s.count = 1;
+    s.depth = 0;
+    s.frames[s.depth++] = d->pc;
+
+    /* the stack grows down from 0xffff, and is empty when SP is 0 */
+    unsigned int words = d->sp ? DCOY_MEM_WORDS - d->sp : 0;
+    if (words > DCOY_PROFILE_SCAN) words = DCOY_PROFILE_SCAN;
+
+    for (unsigned int i = 0; i < words && s.depth < DCOY_PROFILE_DEPTH; i++) {
+        dcoy_word word = d->mem[(dcoy_word)(d->sp + i)];
+        if (return_address(d, word)) {
+            s.frames[s.depth++] = word;
+        }
+    }
+
+    if (p->stack_count * 4 >= p->stack_size * 3 && !stacks_grow(p)) {
+        return;
+    }
+
+    dcoy_profile_stack *slot = stack_slot(p->stacks, p->stack_size, &s);
+    if (slot->count) {
+        slot->count++;
+    } else {
+        *slot = s;
+        p->stack_count++;
+    }
+    p->samples++;
+}
+
+
+/* Samples stay on a fixed grid of cycles, so an instruction that runs
+ * past more than one sample point is sampled more than once. */
+static void sample (dcoy_dcpu16 *d, dcoy_dcpu_event *ev) {
+    dcoy_profile *p = ev->data;
+    dcoy_profile_take(p, d);
+    dcoy_dcpu_schedule(d, ev, ev->at + p->period - d->cycles);
+}
+
+
+void dcoy_profile_start (dcoy_profile *p, dcoy_dcpu16 *d) {
+    dcoy_dcpu_schedule(d, &p->sample, p->period);
+}
+
+
+void dcoy_profile_stop (dcoy_profile *p, dcoy_dcpu16 *d) {
+    dcoy_dcpu_unschedule(d, &p->sample);
+}
+
+
+/* Symbols */
+
+bool dcoy_profile_symbol_add (dcoy_profile *p, dcoy_word addr,
+                              const char *name) {
+    if (p->symbol_count == p->symbol_size) {
+        unsigned int size = p->symbol_size ? p->symbol_size * 2 : 64;
+        dcoy_profile_symbol *list = realloc(p->symbols,
+                                            size * sizeof(*list));
+        if (list == NULL) return false;
+        p->symbols = list;
+        p->symbol_size = size;
+    }
+
+    char *copy = strdup(name);
+    if (copy == NULL) return false;
+
+    /* maps are usually in address order already, so this rarely moves */
+    unsigned int i = p->symbol_count;
+    while (i > 0 && p->symbols[i - 1].addr > addr) {
+        i--;
+    }
+    memmove(&p->symbols[i + 1], &p->symbols[i],
+            (p->symbol_count - i) * sizeof(dcoy_profile_symbol));
+
+    p->symbols[i].addr = addr;
+    p->symbols[i].name = copy;
+    p->symbol_count++;
+    return true;
+}
+
+
+/* Returns the last symbol at or before addr */
+const dcoy_profile_symbol *dcoy_profile_symbol_find (dcoy_profile *p,
+                                                     dcoy_word addr) {
+    unsigned int low = 0, high = p->symbol_count;
+
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        if (p->symbols[mid].addr <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low ? &p->symbols[low - 1] : NULL;
+}
+
+
+static bool prefixed (const char *token) {
+    return token[0] == '$' ||
+           (token[0] == '0' && (token[1] == 'x' || token[1] == 'X'));
+}
+
+
+static bool parse_address (const char *token, dcoy_word *addr) {
+    if (token[0] == '$') {
+        token++;
+    } else if (prefixed(token)) {
+        token += 2;
+    }
+    if (*token == '\0') return false;
+
+    char *end;
+    unsigned long value = strtoul(token, &end, 16);
+    if (*end != '\0' || value >= DCOY_MEM_WORDS) return false;
+
+    *addr = value;
+    return true;
+}
+
+
+int dcoy_profile_symbols_load (dcoy_profile *p, const char *filename) {
+    FILE *in = fopen(filename, "r");
+    if (!in) {
+        return -1;
+    }
+
+    char line[LINE_LENGTH];
+    int loaded = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        char *first = strtok(line, " \t\r\n:=");
+        char *second = strtok(NULL, " \t\r\n:=");
+        if (!first || !second || first[0] == ';' || first[0] == '#') {
+            continue;
+        }
+
+        /* a label like "add" is also valid hex, so a prefixed address
+         * wins, then "label address" over "address label" */
+        bool swap = prefixed(first) && !prefixed(second);
+        const char *name = swap ? second : first;
+        dcoy_word addr;
+
+        if (!parse_address(swap ? first : second, &addr)) {
+            if (swap || !parse_address(first, &addr)) continue;
+            name = second;
+        }
+
+        if (!dcoy_profile_symbol_add(p, addr, name)) {
+            fclose(in);
+            return -1;
+        }
+        loaded++;
+    }
+
+    fclose(in);
+    return loaded;
+}
+
+
+/* Export */
+
+/* Return addresses are looked up by the JSR before them, in case the
+ * call was the last instruction under its label. */
+static void write_frame (dcoy_profile *p, dcoy_word addr, bool caller,
+                         FILE *out) {
+    const dcoy_profile_symbol *sym =
+        dcoy_profile_symbol_find(p, caller ? addr - 1 : addr);
+    if (sym) {
+        fputs(sym->name, out);
+    } else {
+        fprintf(out, "0x%04x", addr);
+    }
+}
+
+
+bool dcoy_profile_write_folded (dcoy_profile *p, FILE *out) {
+    for (unsigned int i = 0; i < p->stack_size; i++) {
+        const dcoy_profile_stack *s = &p->stacks[i];
+        if (s->count == 0) continue;
+
+        for (unsigned int f = s->depth; f-- > 0; ) {
+            write_frame(p, s->frames[f], f > 0, out);
+            putc(f ? ';' : ' ', out);
+        }
+        fprintf(out, "%u\n", s->count);
+    }
+    return !ferror(out);
+}
@@ -0,0 +1,92 @@
+/**
+ * dcoy/profile.h
+ *
+ * Sampling profiler for guest code - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_profile_h
+#define _dcoy_profile_h
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Samples are taken by a timed event every `period` cycles, so the same
+ * program always gives the same profile. Each one records PC and the
+ * return addresses of the guest call stack, found by scanning up from
+ * SP for words that directly follow a JSR. The scan is a heuristic -
+ * data that happens to look like a return address shows up as a call -
+ * but costs nothing while the program isn't being sampled. */
+
+#define DCOY_PROFILE_DEPTH  32      /* frames kept per sample */
+#define DCOY_PROFILE_SCAN   256     /* stack words searched for frames */
+
+typedef struct dcoy_profile_stack {
+    unsigned int count;
+    unsigned int depth;
+    dcoy_word frames[DCOY_PROFILE_DEPTH];   /* innermost first */
+} dcoy_profile_stack;
+
+typedef struct dcoy_profile_symbol {
+    dcoy_word addr;
+    char *name;
+} dcoy_profile_symbol;
+
+typedef struct dcoy_profile {
+    dcoy_dcpu_event sample;
+    unsigned int period;
+    unsigned long samples;
+
+    /* open addressed, keyed by the whole stack */
+    dcoy_profile_stack *stacks;
+    unsigned int stack_count;
+    unsigned int stack_size;
+
+    /* sorted by address once loading is done */
+    dcoy_profile_symbol *symbols;
+    unsigned int symbol_count;
+    unsigned int symbol_size;
+} dcoy_profile;
+
+
+/* Instance management */
+
+dcoy_profile *dcoy_profile_create (unsigned int period);
+void dcoy_profile_destroy (dcoy_profile *p);
+void dcoy_profile_clear (dcoy_profile *p);
+
+
+/* Sampling - start schedules the sampling event on d, and stop cancels
+ * it. Hosts that run code without events (like compiled code or the
+ * no-cycles variants) can call dcoy_profile_take themselves. */
+
+void dcoy_profile_start (dcoy_profile *p, dcoy_dcpu16 *d);
+void dcoy_profile_stop (dcoy_profile *p, dcoy_dcpu16 *d);
+void dcoy_profile_take (dcoy_profile *p, dcoy_dcpu16 *d);
+
+
+/* Symbols
+ * A symbol map has one label and address per line, in either order,
+ * optionally separated by ':' or '='. Addresses are hex, with or
+ * without a 0x or $ prefix. Lines starting with ';' or '#' are
+ * comments. Returns the number of symbols loaded, or -1 on error. */
+
+int dcoy_profile_symbols_load (dcoy_profile *p, const char *filename);
+bool dcoy_profile_symbol_add (dcoy_profile *p, dcoy_word addr,
+                              const char *name);
+const dcoy_profile_symbol *dcoy_profile_symbol_find (dcoy_profile *p,
+                                                     dcoy_word addr);
+
+
+/* Export - one "outer;...;inner count" line per distinct stack, as read
+ * by flame graph tools. Frames are named by the symbol they fall in,
+ * or by address if there is none, so stacks that differ only within a
+ * symbol give repeated lines, which those tools add together. */
+
+bool dcoy_profile_write_folded (dcoy_profile *p, FILE *out);
+
+#endif
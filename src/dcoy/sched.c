@@ -0,0 +1,211 @@
+/**
+ * dcoy/sched.c
+ *
+ * Quotas and weighted fair time-slicing for many DCPUs on one thread -
+ * implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/sched.h"
+#include "dcoy/dcpu.h"
+
+/* Virtual time is kept in 1/VTIME_SCALE cycles, so that heavy weights
+ * don't round down to nothing */
+#define VTIME_SCALE     1024
+
+/* Slices are run in batches of this many cycles' worth of instructions
+ * at a time (assuming they take at least this many), and then one at a
+ * time close to the end */
+#define BATCH_COST      8
+
+
+/* Tenants */
+
+static unsigned long remaining (unsigned long quota, unsigned long used) {
+    return quota == 0 ? (unsigned long)-1 : quota > used ? quota - used : 0;
+}
+
+
+unsigned int dcoy_tenant_run (dcoy_tenant *t, unsigned int slice) {
+    dcoy_dcpu16 *d = t->d;
+
+    unsigned long budget = slice > t->debt ? slice - t->debt : 0;
+    t->debt -= slice - budget;
+
+    unsigned long cycles_left = remaining(t->cycle_quota, t->cycles);
+    unsigned long insts_left = remaining(t->instruction_quota,
+                                         t->instructions);
+    bool quota_cut = cycles_left < budget;
+    if (quota_cut) budget = cycles_left;
+
+    bool counts_cycles = dcoy_dcpu_variant_counts_cycles(d->variant);
+    unsigned int start = d->cycles;
+    unsigned long used = 0, insts = 0;
+
+    while (used < budget && insts < insts_left && dcoy_dcpu_ready(d)) {
+        unsigned long steps = (budget - used) / BATCH_COST + 1;
+        if (steps > insts_left - insts) steps = insts_left - insts;
+
+        insts += dcoy_dcpu_run(d, steps);
+        used = counts_cycles ? d->cycles - start : insts;
+    }
+
+    t->cycles += used;
+    t->instructions += insts;
+    t->slices++;
+    t->vtime += (uint64_t)used * VTIME_SCALE / (t->weight ? t->weight : 1);
+
+    if (used > budget) {
+        t->debt += used - budget;
+        t->overshoot += used - budget;
+    }
+
+    if (!dcoy_dcpu_running(d)) {
+        return DCOY_TENANT_HALTED;
+    } else if (dcoy_dcpu_yielded(d)) {
+        return DCOY_TENANT_YIELDED;
+    } else if (t->instruction_quota && t->instructions >= t->instruction_quota) {
+        return DCOY_TENANT_INSTRUCTION_QUOTA;
+    } else if (quota_cut || (t->cycle_quota && t->cycles >= t->cycle_quota)) {
+        return DCOY_TENANT_CYCLE_QUOTA;
+    }
+
+    t->preemptions++;
+    return DCOY_TENANT_PREEMPTED;
+}
+
+
+/* Instance management */
+
+dcoy_sched *dcoy_sched_create (unsigned int slice) {
+    dcoy_sched *s = calloc(1, sizeof(dcoy_sched));
+    if (s == NULL) return s;
+    s->slice = slice ? slice : DCOY_SCHED_SLICE;
+    return s;
+}
+
+
+void dcoy_sched_destroy (dcoy_sched *s) {
+    for (unsigned int i = 0; i < s->tenant_count; i++) {
+        free(s->tenants[i]);
+    }
+    free(s->tenants);
+    free(s);
+}
+
+
+dcoy_tenant *dcoy_sched_add (dcoy_sched *s, dcoy_dcpu16 *d,
+                             unsigned int weight) {
+    if (s->tenant_count == s->tenant_size) {
+        unsigned int size = s->tenant_size ? s->tenant_size * 2 : 8;
+        dcoy_tenant **list = realloc(s->tenants, size * sizeof(dcoy_tenant *));
+        if (list == NULL) return NULL;
+        s->tenants = list;
+        s->tenant_size = size;
+    }
+
+    dcoy_tenant *t = calloc(1, sizeof(dcoy_tenant));
+    if (t == NULL) return t;
+
+    t->d = d;
+    t->weight = weight ? weight : 1;
+
+    /* starting from zero would let it run alone until it caught up */
+    t->vtime = s->vtime;
+
+    s->tenants[s->tenant_count++] = t;
+    return t;
+}
+
+
+void dcoy_sched_remove (dcoy_sched *s, dcoy_tenant *t) {
+    for (unsigned int i = 0; i < s->tenant_count; i++) {
+        if (s->tenants[i] == t) {
+            memmove(&s->tenants[i], &s->tenants[i + 1],
+                    (s->tenant_count - i - 1) * sizeof(dcoy_tenant *));
+            s->tenant_count--;
+            free(t);
+            return;
+        }
+    }
+}
+
+
+/* Scheduling */
+
+static dcoy_tenant *next (dcoy_sched *s) {
+    dcoy_tenant *best = NULL;
+
+    /* ties go to whichever was added first */
+    for (unsigned int i = 0; i < s->tenant_count; i++) {
+        dcoy_tenant *t = s->tenants[i];
+        if (!dcoy_tenant_runnable(t)) continue;
+
+        /* Runnable tenants never fall behind the last one to run, so
+         * this only catches those that were out of quota, halted or
+         * yielded.
+         * It doesn't get to make up for the time it sat out. */
+        if (t->vtime < s->vtime) {
+            t->vtime = s->vtime;
+        }
+        if (!best || t->vtime < best->vtime) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+
+unsigned long dcoy_sched_run (dcoy_sched *s, unsigned long cycles) {
+    unsigned long used = 0;
+
+    while (used < cycles) {
+        dcoy_tenant *t = next(s);
+        if (t == NULL) {
+            break;
+        }
+        s->vtime = t->vtime;
+
+        unsigned long before = t->cycles;
+        unsigned long left = cycles - used;
+        dcoy_tenant_run(t, left < s->slice ? left : s->slice);
+        used += t->cycles - before;
+    }
+
+    return used;
+}
+
+
+/* Export */
+
+static const char *status (const dcoy_tenant *t) {
+    if (!dcoy_dcpu_running(t->d)) {
+        return t->d->error_code ? "error" : "halted";
+    } else if (dcoy_dcpu_yielded(t->d)) {
+        return "yielded";
+    }
+    return dcoy_tenant_exhausted(t) ? "exhausted" : "runnable";
+}
+
+
+bool dcoy_sched_write_stats (const dcoy_sched *s, FILE *out) {
+    fprintf(out, "tenant weight cycles instructions slices preemptions "
+                 "overshoot status\n");
+
+    for (unsigned int i = 0; i < s->tenant_count; i++) {
+        const dcoy_tenant *t = s->tenants[i];
+        fprintf(out, "%u %u %lu %lu %lu %lu %lu %s\n", i, t->weight,
+                t->cycles, t->instructions, t->slices, t->preemptions,
+                t->overshoot, status(t));
+    }
+
+    return !ferror(out);
+}
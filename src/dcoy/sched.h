@@ -0,0 +1,95 @@
+/**
+ * dcoy/sched.h
+ *
+ * Quotas and weighted fair time-slicing for many DCPUs on one thread -
+ * header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_sched_h
+#define _dcoy_sched_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+
+/* Tenants
+ * A tenant is a DCPU with a weight, optional lifetime quotas, and
+ * counters of what it has used. A slice runs it for a number of cycles
+ * and stops at the first instruction boundary at or past the end, so
+ * the DCPU can simply be run again later. Any cycles past the end are
+ * owed, and taken off its next slice.
+ *
+ * Variants that don't count cycles are measured in instructions. */
+
+#define DCOY_TENANT_PREEMPTED           0   /* used up its slice */
+#define DCOY_TENANT_CYCLE_QUOTA         1   /* reached cycle_quota */
+#define DCOY_TENANT_INSTRUCTION_QUOTA   2   /* reached instruction_quota */
+#define DCOY_TENANT_HALTED              3
+#define DCOY_TENANT_YIELDED             4   /* until the host clears it */
+
+typedef struct dcoy_tenant {
+    dcoy_dcpu16 *d;
+    unsigned int weight;
+
+    /* 0 for no quota - the host may raise them to let a tenant go on */
+    unsigned long cycle_quota;
+    unsigned long instruction_quota;
+
+    /* accounting */
+    unsigned long cycles;
+    unsigned long instructions;
+    unsigned long slices;
+    unsigned long preemptions;
+    unsigned long overshoot;        /* total cycles run past slice ends */
+
+    unsigned int debt;
+    uint64_t vtime;                 /* cycles used, scaled by weight */
+} dcoy_tenant;
+
+#define dcoy_tenant_exhausted(t) ( \
+    ((t)->cycle_quota && (t)->cycles >= (t)->cycle_quota) || \
+    ((t)->instruction_quota && (t)->instructions >= (t)->instruction_quota))
+
+#define dcoy_tenant_runnable(t) \
+    (dcoy_dcpu_ready((t)->d) && !dcoy_tenant_exhausted(t))
+
+unsigned int dcoy_tenant_run (dcoy_tenant *t, unsigned int slice);
+
+
+/* Scheduler
+ * Always runs the runnable tenant that has used the least time relative
+ * to its weight, so over time each gets cycles in proportion to it.
+ * Tenants belong to the scheduler, their DCPUs to the host. */
+
+#define DCOY_SCHED_SLICE    1000    /* cycles */
+
+typedef struct dcoy_sched {
+    dcoy_tenant **tenants;
+    unsigned int tenant_count;
+    unsigned int tenant_size;
+
+    unsigned int slice;
+    uint64_t vtime;                 /* of the last tenant to run */
+} dcoy_sched;
+
+dcoy_sched *dcoy_sched_create (unsigned int slice);
+void dcoy_sched_destroy (dcoy_sched *s);
+
+dcoy_tenant *dcoy_sched_add (dcoy_sched *s, dcoy_dcpu16 *d,
+                             unsigned int weight);
+void dcoy_sched_remove (dcoy_sched *s, dcoy_tenant *t);
+
+/* Runs slices until `cycles` have been used between all the tenants, or
+ * none is runnable. Returns the cycles used. */
+unsigned long dcoy_sched_run (dcoy_sched *s, unsigned long cycles);
+
+
+/* Export - a header line, then one line of counters per tenant */
+
+bool dcoy_sched_write_stats (const dcoy_sched *s, FILE *out);
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * dcoy/session.c
+ *
+ * Resumable execution that yields to the host on guest I/O -
+ * implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "dcoy/session.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/constants.h"
+
+/* as in dcoy/sched.c, instructions are run in batches assuming they
+ * take at least this many cycles each */
+#define BATCH_COST      8
+
+
+/* Readiness */
+
+static void signal_ready (dcoy_session *s) {
+    uint64_t one = 1;
+    /* can only fail if the counter is about to overflow, which is
+     * still readable */
+    (void)!write(s->fd, &one, sizeof(one));
+}
+
+
+static void clear_ready (dcoy_session *s) {
+    uint64_t count;
+    (void)!read(s->fd, &count, sizeof(count));
+}
+
+
+/* Instance management */
+
+dcoy_session *dcoy_session_create (dcoy_dcpu16 *d) {
+    dcoy_session *s = calloc(1, sizeof(dcoy_session));
+    if (s == NULL) return s;
+
+    s->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->fd < 0) {
+        free(s);
+        return NULL;
+    }
+
+    s->d = d;
+    d->traps = s->traps;
+
+    signal_ready(s);
+    return s;
+}
+
+
+void dcoy_session_destroy (dcoy_session *s) {
+    if (s->d->traps == s->traps) {
+        s->d->traps = NULL;
+    }
+
+    for (unsigned int i = 0; i < s->device_count; i++) {
+        free(s->devices[i]);
+    }
+    free(s->devices);
+    close(s->fd);
+    free(s);
+}
+
+
+/* Hosted devices */
+
+static unsigned int interrupt (dcoy_dcpu16 *d, dcoy_hardware *hw) {
+    dcoy_session_device *dev = (dcoy_session_device *)hw;
+    dcoy_session_event *ev = &dev->session->event;
+
+    ev->type = DCOY_SESSION_HWI;
+    ev->device = dev->index;
+    ev->pc = d->pc;
+    ev->a = d->reg[A];
+
+    dcoy_dcpu_yield(d);
+    return 0;
+}
+
+
+int dcoy_session_device_add (dcoy_session *s, uint32_t id, dcoy_word version,
+                             uint32_t manufacturer) {
+    dcoy_session_device **list = realloc(s->devices, (s->device_count + 1) *
+                                         sizeof(dcoy_session_device *));
+    if (list == NULL) return -1;
+    s->devices = list;
+
+    dcoy_session_device *dev = calloc(1, sizeof(dcoy_session_device));
+    if (dev == NULL) return -1;
+
+    dev->hw.id = id;
+    dev->hw.version = version;
+    dev->hw.manufacturer = manufacturer;
+    dev->hw.interrupt = interrupt;
+    dev->session = s;
+    dev->index = s->d->hardware_count;
+
+    if (!dcoy_dcpu_hardware_attach(s->d, &dev->hw)) {
+        free(dev);
+        return -1;
+    }
+
+    s->devices[s->device_count++] = dev;
+    return dev->index;
+}
+
+
+void dcoy_session_trap (dcoy_session *s, dcoy_word addr) {
+    s->traps[addr / 8] |= 1 << (addr % 8);
+}
+
+
+void dcoy_session_untrap (dcoy_session *s, dcoy_word addr) {
+    s->traps[addr / 8] &= ~(1 << (addr % 8));
+}
+
+
+/* Execution */
+
+static bool stopped (dcoy_session *s) {
+    dcoy_dcpu16 *d = s->d;
+    dcoy_session_event *ev = &s->event;
+
+    if (!dcoy_dcpu_running(d)) {
+        ev->type = DCOY_SESSION_HALTED;
+    } else if (dcoy_dcpu_yielded(d)) {
+        /* HWI fills in the rest itself */
+        if (dcoy_dcpu_trapped(d, d->pc) && ev->type != DCOY_SESSION_HWI) {
+            ev->type = DCOY_SESSION_TRAP;
+            ev->device = 0;
+            ev->pc = d->pc;
+            ev->a = d->reg[A];
+            s->step_past = true;
+        }
+    } else {
+        return false;
+    }
+
+    s->waiting = ev->type != DCOY_SESSION_HALTED;
+    return true;
+}
+
+
+const dcoy_session_event *dcoy_session_run (dcoy_session *s,
+                                            unsigned int cycles) {
+    dcoy_dcpu16 *d = s->d;
+    clear_ready(s);
+
+    if (s->waiting || !dcoy_dcpu_running(d)) {
+        return &s->event;
+    }
+
+    bool counts_cycles = dcoy_dcpu_variant_counts_cycles(d->variant);
+    unsigned int start = d->cycles;
+    unsigned long used = 0, insts = 0;
+
+    s->event.type = DCOY_SESSION_BUDGET;
+
+    if (s->step_past) {
+        s->step_past = false;
+        dcoy_dcpu_step(d);
+        insts++;
+        used = counts_cycles ? d->cycles - start : insts;
+    }
+
+    while (used < cycles && !stopped(s)) {
+        insts += dcoy_dcpu_run(d, (cycles - used) / BATCH_COST + 1);
+        used = counts_cycles ? d->cycles - start : insts;
+    }
+
+    if (s->event.type == DCOY_SESSION_BUDGET && !stopped(s)) {
+        s->event.pc = d->pc;
+        s->event.a = d->reg[A];
+        signal_ready(s);
+    }
+    return &s->event;
+}
+
+
+void dcoy_session_resume (dcoy_session *s, unsigned int cost) {
+    dcoy_dcpu16 *d = s->d;
+    if (!s->waiting) return;
+
+    s->waiting = false;
+    dcoy_dcpu_flag_unset(d, DCOY_DCPU_FLAG_YIELD);
+
+    if (s->event.type == DCOY_SESSION_HWI) {
+        if (dcoy_dcpu_variant_counts_cycles(d->variant)) {
+            d->cycles += cost;
+        }
+
+        /* the interrupt that would have followed the HWI */
+        if (dcoy_dcpu_variant_takes_interrupts(d->variant)) {
+            dcoy_dcpu_interrupt_trigger(d);
+        }
+    }
+
+    signal_ready(s);
+}
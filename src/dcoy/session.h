@@ -0,0 +1,99 @@
+/**
+ * dcoy/session.h
+ *
+ * Resumable execution that yields to the host on guest I/O - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_session_h
+#define _dcoy_session_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Events
+ * A session runs its DCPU until the guest does HWI on a hosted device or
+ * reaches a trapped address, and hands the host a descriptor of what it
+ * did. The DCPU then waits - with its registers as the guest left them
+ * and no interrupts triggered - until the host resumes it. */
+
+#define DCOY_SESSION_BUDGET     0   /* ran for the cycles it was given */
+#define DCOY_SESSION_HWI        1   /* HWI on hosted device `device` */
+#define DCOY_SESSION_TRAP       2   /* about to run the trapped `pc` */
+#define DCOY_SESSION_HALTED     3   /* halted, or an error - see d */
+
+typedef struct dcoy_session_event {
+    unsigned int type;
+    dcoy_word device;   /* hardware index, for HWI */
+    dcoy_word pc;       /* where the DCPU will carry on from */
+    dcoy_word a;        /* A at the time, which is usually the request */
+} dcoy_session_event;
+
+
+/* Hosted devices
+ * These have no behavior of their own - HWI on one yields, and the host
+ * answers by setting registers or memory before resuming. HWN and HWQ
+ * report the ID, version and manufacturer given here. */
+
+typedef struct dcoy_session_device {
+    dcoy_hardware hw;
+    struct dcoy_session *session;
+    dcoy_word index;
+} dcoy_session_device;
+
+
+/* Sessions
+ * Each has an eventfd, which is readable while the session is ready to
+ * run: from creation, after the host resumes it, and after a run that
+ * only used up its budget. So one thread can serve any number of them
+ * by waiting on all their fds with epoll and calling dcoy_session_run
+ * on whichever come up. A session must only be used by one thread at a
+ * time, but the one that resumes it needn't be the one that runs it. */
+
+typedef struct dcoy_session {
+    dcoy_dcpu16 *d;
+    int fd;
+
+    dcoy_session_event event;
+    bool waiting;       /* for dcoy_session_resume */
+    bool step_past;     /* the trap it stopped at */
+
+    dcoy_session_device **devices;
+    unsigned int device_count;
+
+    uint8_t traps[DCOY_DCPU_TRAPS_SIZE];
+} dcoy_session;
+
+
+/* Instance management
+ * The session owns its devices and traps, so destroy it along with the
+ * DCPU, not before. create returns NULL if it can't get an eventfd. */
+
+dcoy_session *dcoy_session_create (dcoy_dcpu16 *d);
+void dcoy_session_destroy (dcoy_session *s);
+
+#define dcoy_session_fd(s)      ((s)->fd)
+
+/* attaches a new hosted device, and returns its index, or -1 */
+int dcoy_session_device_add (dcoy_session *s, uint32_t id, dcoy_word version,
+                             uint32_t manufacturer);
+
+void dcoy_session_trap (dcoy_session *s, dcoy_word addr);
+void dcoy_session_untrap (dcoy_session *s, dcoy_word addr);
+
+
+/* Execution
+ * run goes on for up to `cycles` (instructions, for variants that don't
+ * count cycles) and returns what stopped it. While a session is waiting
+ * it just returns the same event again. resume charges `cost` extra
+ * cycles to the guest's HWI, and makes the session ready to run. */
+
+const dcoy_session_event *dcoy_session_run (dcoy_session *s,
+                                            unsigned int cycles);
+void dcoy_session_resume (dcoy_session *s, unsigned int cost);
+
+#endif
@@ -0,0 +1,453 @@
+/**
+ * dcoy/snapshot.c
+ *
+ * Portable snapshots of machine state, full or as deltas -
+ * implementation
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcoy/snapshot.h"
+#include "dcoy/constants.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+#define MAGIC           "DCOYSNAP"
+#define MAGIC_SIZE      8
+
+#define TAG_CPU         'C'
+#define TAG_LITERAL     'L'
+#define TAG_REPEAT      'R'
+#define TAG_DEVICE      'D'
+#define TAG_END         'E'
+
+/* A run of this many equal words is written as a repeat, and a gap of
+ * this many unchanged (or, in a full snapshot, zero) words ends a
+ * literal. Anything shorter costs more as its own record. */
+#define MIN_REPEAT      4
+#define MIN_GAP         4
+
+
+/* Little-endian primitives */
+
+static void write_word (FILE *out, dcoy_word value) {
+    putc(value & 0xff, out);
+    putc(value >> 8, out);
+}
+
+
+static void write_dword (FILE *out, uint32_t value) {
+    write_word(out, value & 0xffff);
+    write_word(out, value >> 16);
+}
+
+
+static bool read_word (FILE *in, dcoy_word *value) {
+    int low = getc(in);
+    int high = getc(in);
+    if (high == EOF) return false;
+    *value = low | high << 8;
+    return true;
+}
+
+
+static bool read_dword (FILE *in, uint32_t *value) {
+    dcoy_word low, high;
+    if (!read_word(in, &low) || !read_word(in, &high)) return false;
+    *value = low | (uint32_t)high << 16;
+    return true;
+}
+
+
+uint32_t dcoy_snapshot_checksum (const dcoy_dcpu16 *d) {
+    uint32_t hash = 2166136261u;
+    for (unsigned int i = 0; i < DCOY_MEM_WORDS; i++) {
+        hash = (hash ^ (d->mem[i] & 0xff)) * 16777619u;
+        hash = (hash ^ (d->mem[i] >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+
+/* Device state */
+
+void dcoy_snapshot_put (dcoy_snapshot *snap, const void *data, size_t size) {
+    if (snap->used + size > snap->size) {
+        size_t grown = snap->size ? snap->size : 64;
+        while (grown < snap->used + size) {
+            grown *= 2;
+        }
+
+        uint8_t *buf = realloc(snap->data, grown);
+        if (buf == NULL) {
+            snap->failed = true;
+            return;
+        }
+        snap->data = buf;
+        snap->size = grown;
+    }
+
+    memcpy(snap->data + snap->used, data, size);
+    snap->used += size;
+}
+
+
+void dcoy_snapshot_put_word (dcoy_snapshot *snap, dcoy_word value) {
+    uint8_t bytes[2] = { value & 0xff, value >> 8 };
+    dcoy_snapshot_put(snap, bytes, 2);
+}
+
+
+void dcoy_snapshot_put_dword (dcoy_snapshot *snap, uint32_t value) {
+    dcoy_snapshot_put_word(snap, value & 0xffff);
+    dcoy_snapshot_put_word(snap, value >> 16);
+}
+
+
+bool dcoy_snapshot_get (dcoy_snapshot *snap, void *data, size_t size) {
+    if (snap->used - snap->pos < size) {
+        return false;
+    }
+    memcpy(data, snap->data + snap->pos, size);
+    snap->pos += size;
+    return true;
+}
+
+
+bool dcoy_snapshot_get_word (dcoy_snapshot *snap, dcoy_word *value) {
+    uint8_t bytes[2];
+    if (!dcoy_snapshot_get(snap, bytes, 2)) return false;
+    *value = bytes[0] | bytes[1] << 8;
+    return true;
+}
+
+
+bool dcoy_snapshot_get_dword (dcoy_snapshot *snap, uint32_t *value) {
+    dcoy_word low, high;
+    if (!dcoy_snapshot_get_word(snap, &low) ||
+        !dcoy_snapshot_get_word(snap, &high)) {
+        return false;
+    }
+    *value = low | (uint32_t)high << 16;
+    return true;
+}
+
+
+/* Writing */
+
+static void write_cpu (dcoy_dcpu16 *d, FILE *out) {
+    putc(TAG_CPU, out);
+    write_dword(out, d->cycles);
+    write_dword(out, d->flags);
+    write_dword(out, d->variant);
+
+    for (unsigned int r = 0; r < DCOY_REG_COUNT; r++) {
+        write_word(out, d->reg[r]);
+    }
+    write_word(out, d->pc);
+    write_word(out, d->sp);
+    write_word(out, dcoy_dcpu_ex(d));
+    write_word(out, d->ia);
+
+    write_word(out, d->error_code);
+    write_word(out, d->error_data);
+    write_word(out, d->error_pc);
+
+    write_word(out, d->int_queue_count);
+    for (unsigned int i = 0; i < d->int_queue_count; i++) {
+        write_word(out, d->int_queue[(d->int_queue_start + i) %
+                                     DCOY_INT_QUEUE_SIZE]);
+    }
+}
+
+
+/* Returns how many words from addr on are equal to the one there,
+ * looking no further than limit */
+static unsigned int repeat_length (const dcoy_dcpu16 *d, unsigned int addr,
+                                   unsigned int limit) {
+    unsigned int n = 1;
+    while (n < limit && addr + n < DCOY_MEM_WORDS &&
+           d->mem[addr + n] == d->mem[addr]) {
+        n++;
+    }
+    return n;
+}
+
+
+#define unchanged(d, base, addr) \
+    ((d)->mem[addr] == ((base) ? (base)->mem[addr] : 0))
+
+static unsigned int gap_length (const dcoy_dcpu16 *d, const dcoy_dcpu16 *base,
+                                unsigned int addr) {
+    unsigned int n = 0;
+    while (addr + n < DCOY_MEM_WORDS && n < MIN_GAP &&
+           unchanged(d, base, addr + n)) {
+        n++;
+    }
+    return n;
+}
+
+
+static void write_memory (dcoy_dcpu16 *d, const dcoy_dcpu16 *base,
+                          FILE *out) {
+    unsigned int addr = 0;
+
+    while (addr < DCOY_MEM_WORDS) {
+        if (unchanged(d, base, addr)) {
+            addr++;
+            continue;
+        }
+
+        unsigned int repeat = repeat_length(d, addr, DCOY_MEM_WORDS);
+        if (repeat >= MIN_REPEAT) {
+            putc(TAG_REPEAT, out);
+            write_word(out, addr);
+            write_word(out, repeat - 1);
+            write_word(out, d->mem[addr]);
+            addr += repeat;
+            continue;
+        }
+
+        /* a literal runs until a long enough gap or repeat */
+        unsigned int end = addr + 1;
+        while (end < DCOY_MEM_WORDS) {
+            unsigned int gap = gap_length(d, base, end);
+            if (gap == MIN_GAP || end + gap == DCOY_MEM_WORDS) break;
+            if (gap == 0 && repeat_length(d, end, MIN_REPEAT) == MIN_REPEAT) {
+                break;
+            }
+            end += gap ? gap : 1;
+        }
+
+        putc(TAG_LITERAL, out);
+        write_word(out, addr);
+        write_word(out, end - addr - 1);
+        for (; addr < end; addr++) {
+            write_word(out, d->mem[addr]);
+        }
+    }
+}
+
+
+static bool write_devices (dcoy_dcpu16 *d, FILE *out) {
+    dcoy_snapshot snap = { .data = NULL };
+
+    for (unsigned int i = 0; i < d->hardware_count; i++) {
+        dcoy_hardware *hw = d->hardware[i];
+        if (hw->save == NULL) continue;
+
+        snap.used = 0;
+        hw->save(d, hw, &snap);
+        if (snap.failed) break;
+
+        putc(TAG_DEVICE, out);
+        write_word(out, i);
+        write_dword(out, hw->id);
+        write_word(out, hw->version);
+        write_dword(out, snap.used);
+        fwrite(snap.data, 1, snap.used, out);
+    }
+
+    free(snap.data);
+    return !snap.failed;
+}
+
+
+bool dcoy_snapshot_write (dcoy_dcpu16 *d, const dcoy_dcpu16 *base,
+                          FILE *out) {
+    fwrite(MAGIC, 1, MAGIC_SIZE, out);
+    write_word(out, DCOY_SNAPSHOT_VERSION);
+    write_word(out, base ? DCOY_SNAPSHOT_DELTA : 0);
+    write_dword(out, base ? dcoy_snapshot_checksum(base) : 0);
+
+    write_cpu(d, out);
+    write_memory(d, base, out);
+    if (!write_devices(d, out)) {
+        return false;
+    }
+    putc(TAG_END, out);
+
+    return !ferror(out);
+}
+
+
+/* Reading */
+
+static const char *error_message (unsigned int code) {
+    switch (code) {
+        case DCOY_DCPU_ERROR_INVALID_OPCODE:
+            return DCOY_DCPU_ERROR_MSG_INVALID_OPCODE;
+        case DCOY_DCPU_ERROR_INVALID_SPEC_OPCODE:
+            return DCOY_DCPU_ERROR_MSG_INVALID_SPEC_OPCODE;
+        case DCOY_DCPU_ERROR_INVALID_ARG_TYPE:
+            return DCOY_DCPU_ERROR_MSG_INVALID_ARG_TYPE;
+        case DCOY_DCPU_ERROR_NO_HARDWARE:
+            return DCOY_DCPU_ERROR_MSG_NO_HARDWARE;
+    }
+    return NULL;
+}
+
+
+static bool read_cpu (dcoy_dcpu16 *d, FILE *in) {
+    uint32_t cycles, flags, variant;
+    dcoy_word regs[DCOY_REG_COUNT + 4], code, data, pc, count;
+
+    if (!read_dword(in, &cycles) || !read_dword(in, &flags) ||
+        !read_dword(in, &variant)) {
+        return false;
+    }
+    for (unsigned int r = 0; r < DCOY_REG_COUNT + 4; r++) {
+        if (!read_word(in, &regs[r])) return false;
+    }
+    if (!read_word(in, &code) || !read_word(in, &data) ||
+        !read_word(in, &pc) || !read_word(in, &count) ||
+        count > DCOY_INT_QUEUE_SIZE || variant >= DCOY_DCPU_VARIANT_COUNT) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        if (!read_word(in, &d->int_queue[i])) return false;
+    }
+    d->int_queue_start = 0;
+    d->int_queue_count = count;
+
+    d->cycles = cycles;
+    d->flags = flags;
+    d->variant = variant;
+
+    memcpy(d->reg, regs, sizeof(d->reg));
+    d->pc = regs[DCOY_REG_COUNT];
+    d->sp = regs[DCOY_REG_COUNT + 1];
+    dcoy_dcpu_ex_set(d, regs[DCOY_REG_COUNT + 2]);
+    d->ia = regs[DCOY_REG_COUNT + 3];
+
+    d->error_code = code;
+    d->error_message = error_message(code);
+    d->error_data = data;
+    d->error_pc = pc;
+    return true;
+}
+
+
+/* Zeroes memory from `from` up to `to` */
+static void clear (dcoy_dcpu16 *d, unsigned int from, unsigned int to) {
+    if (from >= to) return;
+    memset(d->mem + from, 0, (to - from) * sizeof(dcoy_word));
+    dcoy_dcpu_dirty_range(d, from, to - from);
+}
+
+
+/* In a full snapshot, runs come in order, and whatever they skip over
+ * is zeroed as they're read - `cleared` is how far that has got. It's
+ * NULL for a delta, where what they skip is left as it is. */
+static bool read_run (dcoy_dcpu16 *d, FILE *in, bool repeat,
+                      unsigned int *cleared) {
+    dcoy_word addr, length, word;
+    if (!read_word(in, &addr) || !read_word(in, &length)) {
+        return false;
+    }
+
+    unsigned int count = length + 1;
+    if (addr + count > DCOY_MEM_WORDS) {
+        return false;
+    }
+    if (cleared) {
+        if (addr < *cleared) return false;
+        clear(d, *cleared, addr);
+        *cleared = addr + count;
+    }
+
+    if (repeat) {
+        if (!read_word(in, &word)) return false;
+        for (unsigned int i = 0; i < count; i++) {
+            d->mem[addr + i] = word;
+        }
+    } else {
+        for (unsigned int i = 0; i < count; i++) {
+            if (!read_word(in, &d->mem[addr + i])) return false;
+        }
+    }
+
+    dcoy_dcpu_dirty_range(d, addr, count);
+    return true;
+}
+
+
+static bool read_device (dcoy_dcpu16 *d, FILE *in, dcoy_snapshot *snap) {
+    dcoy_word index, version;
+    uint32_t id, length;
+
+    if (!read_word(in, &index) || !read_dword(in, &id) ||
+        !read_word(in, &version) || !read_dword(in, &length)) {
+        return false;
+    }
+
+    if (length > snap->size) {
+        uint8_t *buf = realloc(snap->data, length);
+        if (buf == NULL) return false;
+        snap->data = buf;
+        snap->size = length;
+    }
+    if (fread(snap->data, 1, length, in) != length) {
+        return false;
+    }
+    snap->used = length;
+    snap->pos = 0;
+
+    /* state for a device that isn't there any more is dropped */
+    dcoy_hardware *hw = dcoy_dcpu_hardware(d, index);
+    if (hw == NULL || hw->id != id || hw->load == NULL) {
+        return true;
+    }
+    return hw->load(d, hw, snap);
+}
+
+
+bool dcoy_snapshot_read (dcoy_dcpu16 *d, FILE *in) {
+    char magic[MAGIC_SIZE];
+    dcoy_word version, flags;
+    uint32_t checksum;
+
+    if (fread(magic, 1, MAGIC_SIZE, in) != MAGIC_SIZE ||
+        memcmp(magic, MAGIC, MAGIC_SIZE) != 0 ||
+        !read_word(in, &version) || version != DCOY_SNAPSHOT_VERSION ||
+        !read_word(in, &flags) || flags & ~DCOY_SNAPSHOT_DELTA ||
+        !read_dword(in, &checksum)) {
+        return false;
+    }
+
+    bool delta = flags & DCOY_SNAPSHOT_DELTA;
+    if (delta && dcoy_snapshot_checksum(d) != checksum) {
+        return false;
+    }
+
+    dcoy_snapshot snap = { .data = NULL };
+    unsigned int cleared = 0;
+    unsigned int *clearing = delta ? NULL : &cleared;
+    bool ok = true;
+
+    while (ok) {
+        int tag = getc(in);
+        switch (tag) {
+            case TAG_CPU:       ok = read_cpu(d, in);                   break;
+            case TAG_LITERAL:   ok = read_run(d, in, false, clearing);  break;
+            case TAG_REPEAT:    ok = read_run(d, in, true, clearing);   break;
+            case TAG_DEVICE:    ok = read_device(d, in, &snap);         break;
+            case TAG_END:
+                if (!delta) clear(d, cleared, DCOY_MEM_WORDS);
+                free(snap.data);
+                return true;
+            default:            ok = false;                             break;
+        }
+    }
+
+    free(snap.data);
+    return false;
+}
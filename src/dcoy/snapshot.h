@@ -0,0 +1,80 @@
+/**
+ * dcoy/snapshot.h
+ *
+ * Portable snapshots of machine state, full or as deltas - header
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#ifndef _dcoy_snapshot_h
+#define _dcoy_snapshot_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+/* Format
+ * Everything is little-endian. A snapshot starts with:
+ *
+ *     "DCOYSNAP"  u16 version  u16 flags  u32 base checksum
+ *
+ * followed by records, each starting with a one byte tag:
+ *
+ *     'C'  CPU state: u32 cycles, flags, variant; u16 A B C X Y Z I J,
+ *          PC, SP, EX, IA, error code, error data, error PC; u16 queue
+ *          length, then the queued interrupt messages, oldest first
+ *     'L'  literal run: u16 address, u16 length - 1, then the words
+ *     'R'  repeat run: u16 address, u16 length - 1, u16 word
+ *     'D'  device: u16 index, u32 id, u16 version, u32 length, state
+ *     'E'  end
+ *
+ * Memory not covered by any run is zero in a full snapshot, whose runs
+ * are in order of address. In a delta it is the same as in the base,
+ * which is identified by the FNV-1a checksum of its memory. Runs are written and read straight from DCPU
+ * memory, so neither side buffers more than one device's state. */
+
+#define DCOY_SNAPSHOT_VERSION   1
+#define DCOY_SNAPSHOT_DELTA     (1 << 0)
+
+typedef struct dcoy_snapshot {
+    /* the state of the device being saved or loaded */
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    size_t pos;
+    bool failed;
+} dcoy_snapshot;
+
+
+/* Whole machines
+ * Writing takes a base to write a delta against, or NULL for a full
+ * snapshot. Reading a delta needs d to already hold its base. A read
+ * that fails on a bad header leaves d alone, but one that fails later
+ * leaves it with whatever had been read by then. Attached hardware is
+ * matched up by index and ID, and devices with no saved state are left
+ * alone. Devices' own resources, like the media in a drive, are up to
+ * the host. */
+
+bool dcoy_snapshot_write (dcoy_dcpu16 *d, const dcoy_dcpu16 *base,
+                          FILE *out);
+bool dcoy_snapshot_read (dcoy_dcpu16 *d, FILE *in);
+
+uint32_t dcoy_snapshot_checksum (const dcoy_dcpu16 *d);
+
+
+/* Device state - for save and load hooks. The getters return false if
+ * the device's saved state is shorter than expected. */
+
+void dcoy_snapshot_put (dcoy_snapshot *snap, const void *data, size_t size);
+void dcoy_snapshot_put_word (dcoy_snapshot *snap, dcoy_word value);
+void dcoy_snapshot_put_dword (dcoy_snapshot *snap, uint32_t value);
+
+bool dcoy_snapshot_get (dcoy_snapshot *snap, void *data, size_t size);
+bool dcoy_snapshot_get_word (dcoy_snapshot *snap, dcoy_word *value);
+bool dcoy_snapshot_get_dword (dcoy_snapshot *snap, uint32_t *value);
+
+#endif
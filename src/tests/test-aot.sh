@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# tests/test-aot.sh
+#
+# Compiles tests/aot.dasm ahead of time, and checks that it runs just as
+# it does in the interpreter
+#
+# (C) 2013, Matthew Frazier
+# Released under the MIT license - see LICENSE for details
+
+set -e
+
+CC=${CC:-cc}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+bin/dcoy-asm src/tests/aot.dasm "$dir/aot.bin" "$dir/aot.sym"
+
+# the interrupt handler is only reached through IA, so it's another entry
+bin/dcoy-aot "$dir/aot.bin" "$dir/aot.c" \
+    $(awk '$1 == "handler" { print $2 }' "$dir/aot.sym")
+$CC -shared -fPIC -O2 -Isrc -o "$dir/aot.so" "$dir/aot.c"
+
+bin/dcoy-diff -a "$dir/aot.so" -l 1000000 "$dir/aot.bin"
@@ -0,0 +1,206 @@
+/**
+ * tests/test-asm.c
+ *
+ * Checks that updating part of a file gives the same output as
+ * assembling all of it again
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "dcoy/asm.h"
+#include "dcoy/specs.h"
+
+#define MAX_LINES       512
+#define MAX_SOURCE      (MAX_LINES * 64)
+#define RANDOM_EDITS    2000
+
+/* Lines of a file, which only ends in a newline if `newline` is set */
+typedef struct file {
+    const char *lines[MAX_LINES];
+    unsigned int count;
+    bool newline;
+} file;
+
+/* Every label here is defined once, and a few are used before they're
+ * defined, so that moving code around changes what gets patched */
+static const char *const start[] = {
+    ":start  SET A, data",
+    "        SET PC, loop",
+    "        DAT 0x10, \"pad\"",
+    ":loop   ADD [data + 1], 1",
+    "        IFN [data + 1], 10",
+    "            SET PC, loop",
+    "        JSR finish",
+    "",
+    "; the end",
+    ":finish SET B, [end - 1]",
+    "        SET PC, POP",
+    ":data   DAT 0, 0, start",
+    ":end    SET A, end"
+};
+
+/* Lines that can be put in without breaking a label. None is blank,
+ * since a blank last line without a newline isn't a line at all. */
+static const char *const fillers[] = {
+    "SET C, 1",
+    "SET X, 0x1234",
+    "ADD [A + 3], finish",
+    "DAT \"some text\", data",
+    "; nothing",
+    "   ",
+    "IFE A, B",
+    "SET PUSH, end + 2"
+};
+
+static dcoy_word updated[DCOY_MEM_WORDS], assembled[DCOY_MEM_WORDS];
+static char source[MAX_SOURCE];
+static unsigned long checks, failures;
+
+
+static size_t join (const file *f) {
+    size_t length = 0;
+    for (unsigned int i = 0; i < f->count; i++) {
+        bool last = i + 1 == f->count;
+        length += sprintf(source + length, "%s%s", f->lines[i],
+                          last && !f->newline ? "" : "\n");
+    }
+    return length;
+}
+
+
+static void check (const char *what, dcoy_asm *a, dcoy_asm *b,
+                   unsigned int first, unsigned int removed,
+                   const char *const *lines, unsigned int added,
+                   file *f) {
+    /* make the edit, then assemble it both ways */
+    memmove(&f->lines[first + added], &f->lines[first + removed],
+            (f->count - first - removed) * sizeof(const char *));
+    memcpy(&f->lines[first], lines, added * sizeof(const char *));
+    f->count += added - removed;
+
+    size_t length = join(f);
+    bool ok_update = dcoy_asm_update(a, source, length, first, removed,
+                                     added);
+    bool ok_full = dcoy_asm_assemble(b, source, length, assembled,
+                                     DCOY_MEM_WORDS);
+
+    checks++;
+    if (ok_update && ok_full && a->end == b->end &&
+            memcmp(updated, assembled, b->end * sizeof(dcoy_word)) == 0) {
+        return;
+    }
+
+    if (failures++ < 20) {
+        printf("%s at line %u, -%u +%u: ", what, first, removed, added);
+        if (!ok_update || !ok_full) {
+            printf("update %s, full assembly %s\n",
+                   ok_update ? "ok" : a->error,
+                   ok_full ? "ok" : b->error);
+        } else if (a->end != b->end) {
+            printf("%u words, should be %u\n", a->end, b->end);
+        } else {
+            printf("output differs\n");
+        }
+    }
+
+    /* start from a good state again */
+    dcoy_asm_assemble(a, source, length, updated, DCOY_MEM_WORDS);
+}
+
+
+static void reset (dcoy_asm *a, file *f, bool newline) {
+    f->count = sizeof(start) / sizeof(start[0]);
+    memcpy(f->lines, start, sizeof(start));
+    f->newline = newline;
+
+    size_t length = join(f);
+    if (!dcoy_asm_assemble(a, source, length, updated, DCOY_MEM_WORDS)) {
+        printf("can't assemble the starting file, line %u: %s\n",
+               a->error_line, a->error);
+        failures++;
+    }
+}
+
+
+static uint64_t next (uint64_t *seed) {
+    /* xorshift64*, as in dcoy/diff.c */
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+static void edits (dcoy_asm *a, dcoy_asm *b, bool newline) {
+    static const char *const one[] = {"SET C, 1"};
+    static const char *const two[] = {"SET X, 0x1234", "DAT 1, 2, 3"};
+    static const char *const longer[] = {"ADD [A + 3], finish"};
+    static const char *const blank[] = {""};
+    static const char *const comment[] = {"; the real end"};
+    file f;
+
+    reset(a, &f, newline);
+    check("insert", a, b, 3, 0, two, 2, &f);
+    check("insert at the start", a, b, 0, 0, one, 1, &f);
+    check("delete", a, b, 4, 2, NULL, 0, &f);
+    check("replace with a longer line", a, b, 2, 1, longer, 1, &f);
+    check("replace with two lines", a, b, 5, 1, two, 2, &f);
+    check("replace with nothing", a, b, 2, 1, blank, 1, &f);
+
+    /* the last line is the one without a newline, if any */
+    reset(a, &f, newline);
+    check("append", a, b, f.count, 0, one, 1, &f);
+    check("append two", a, b, f.count, 0, two, 2, &f);
+    check("replace the last line", a, b, f.count - 1, 1, longer, 1, &f);
+    check("delete the last line", a, b, f.count - 1, 1, NULL, 0, &f);
+    check("append a comment", a, b, f.count, 0, comment, 1, &f);
+    check("delete the last two lines", a, b, f.count - 2, 2, NULL, 0, &f);
+    check("replace the last line with two", a, b, f.count - 1, 1, two, 2,
+          &f);
+
+    /* then a lot of small edits in a row */
+    const unsigned int filler_count = sizeof(fillers) / sizeof(fillers[0]);
+    uint64_t seed = newline ? 0x9e3779b97f4a7c15ull : 0x2545f4914f6cdd1dull;
+    reset(a, &f, newline);
+
+    for (unsigned int i = 0; i < RANDOM_EDITS; i++) {
+        uint64_t r = next(&seed);
+        unsigned int first = r % (f.count + 1);
+        unsigned int removed = (r >> 16) % 3;
+        unsigned int added = (r >> 24) % 3;
+        const char *lines[2];
+
+        /* never take out a label */
+        while (removed && first + removed > f.count) removed--;
+        for (unsigned int j = 0; j < removed; j++) {
+            if (f.lines[first + j][0] == ':') removed = j;
+        }
+        if (f.count + added - removed > MAX_LINES) added = 0;
+        for (unsigned int j = 0; j < added; j++) {
+            lines[j] = fillers[(r >> (32 + j * 8)) % filler_count];
+        }
+
+        check("random edit", a, b, first, removed, lines, added, &f);
+    }
+}
+
+
+int main () {
+    dcoy_asm *a = dcoy_asm_create(), *b = dcoy_asm_create();
+
+    edits(a, b, true);
+    edits(a, b, false);
+
+    dcoy_asm_destroy(a);
+    dcoy_asm_destroy(b);
+    printf("%s: %lu of %lu checks failed\n", failures ? "FAIL" : "ok",
+           failures, checks);
+    return failures != 0;
+}
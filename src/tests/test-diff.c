@@ -0,0 +1,110 @@
+/**
+ * tests/test-diff.c
+ *
+ * Checks that the differential checker agrees with engines that are
+ * right, including ones that sync by cycles, and catches one that isn't
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "dcoy/diff.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/specs.h"
+
+#define LIMIT   100000
+
+static unsigned long checks, failures;
+
+
+/* The interpreter, run the way dcoy_aot_run runs a DCPU with nothing
+ * compiled: by cycles, without saying how many instructions it ran */
+static unsigned int run_cycles (dcoy_dcpu16 *d, unsigned int amount,
+                                void *data) {
+    unsigned int start = d->cycles;
+    (void)data;
+
+    while (dcoy_dcpu_ready(d) && d->cycles - start < amount) {
+        dcoy_dcpu_step(d);
+    }
+    return 0;
+}
+
+
+/* Right, except that A is off by one after anything that sets it */
+static unsigned int run_broken (dcoy_dcpu16 *d, unsigned int amount,
+                                void *data) {
+    unsigned int ran = dcoy_dcpu_run(d, amount);
+    (void)data;
+
+    if (d->reg[DCOY_REG_A] == 3) d->reg[DCOY_REG_A]++;
+    return ran;
+}
+
+
+static void check (const char *what, const dcoy_word *code,
+                   unsigned int size, const dcoy_diff_engine *e,
+                   unsigned int quantum, bool diverges) {
+    dcoy_dcpu16 *d = dcoy_dcpu_create();
+    dcoy_diff *df = dcoy_diff_create(quantum);
+    dcoy_diff_result r;
+
+    memcpy(d->mem, code, size * sizeof(dcoy_word));
+    bool agreed = dcoy_diff_run(df, d, e, LIMIT, &r);
+
+    checks++;
+    if (agreed == diverges && failures++ < 20) {
+        printf("%s, %s engine, quantum %u: ", what, e->name, quantum);
+        if (agreed) {
+            printf("should have diverged\n");
+        } else {
+            printf("diverged on %s %u, 0x%04x rather than 0x%04x, "
+                   "at 0x%04x: %s\n", r.field, r.index, r.actual,
+                   r.expected, r.pc, r.inst);
+        }
+    }
+
+    dcoy_diff_destroy(df);
+    dcoy_dcpu_destroy(d);
+}
+
+
+int main () {
+    /* SET A, 1; ADD A, 2; then an invalid instruction, which halts
+     * without taking a cycle - at the same count the ADD finished on */
+    static const dcoy_word halts[] = {0x8801, 0x8c02, 0x0000};
+
+    /* SET A, 1; :loop ADD A, 2; SUB PC, 2 */
+    static const dcoy_word loops[] = {0x8801, 0x8c02, 0x8f83};
+
+    /* SET A, 1; ADD A, 2; SUB PC, 1 */
+    static const dcoy_word sets_a[] = {0x8801, 0x8c02, 0x8b83};
+
+    static const unsigned int quanta[] = {1, 2, 3, 1000};
+    dcoy_diff_engine cycles = {"cycles", DCOY_DCPU_VARIANT_FULL, true,
+                               run_cycles, NULL};
+    dcoy_diff_engine broken = {"broken", DCOY_DCPU_VARIANT_FULL, false,
+                               run_broken, NULL};
+
+    for (unsigned int i = 0; i < sizeof(quanta) / sizeof(quanta[0]); i++) {
+        unsigned int q = quanta[i];
+
+        check("halt on an error", halts, 3, &cycles, q, false);
+        check("loop", loops, 3, &cycles, q, false);
+        check("wrong A", sets_a, 3, &broken, q, true);
+
+        for (unsigned int v = 0; v < DCOY_DCPU_VARIANT_COUNT; v++) {
+            dcoy_diff_engine variant;
+            dcoy_diff_engine_variant(&variant, v);
+            check("halt on an error", halts, 3, &variant, q, false);
+            check("loop", loops, 3, &variant, q, false);
+        }
+    }
+
+    printf("%s: %lu of %lu checks failed\n", failures ? "FAIL" : "ok",
+           failures, checks);
+    return failures != 0;
+}
@@ -0,0 +1,189 @@
+/**
+ * tests/test-ex.c
+ *
+ * Checks EX, as the interpreter variants compute it lazily, against
+ * computing it eagerly after every instruction
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dcoy/code.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/dcpu/arith.h"
+#include "dcoy/specs.h"
+
+#define RANDOM_PAIRS    4000
+
+static const unsigned int ops[] = {
+    DCOY_OP_ADD, DCOY_OP_SUB, DCOY_OP_MUL, DCOY_OP_MLI, DCOY_OP_DIV,
+    DCOY_OP_DVI, DCOY_OP_SHR, DCOY_OP_ASR, DCOY_OP_SHL, DCOY_OP_ADX,
+    DCOY_OP_SBX
+};
+
+static const dcoy_word edges[] = {
+    0, 1, 2, 15, 16, 17, 31, 32, 0x7fff, 0x8000, 0x8001, 0xfffe, 0xffff
+};
+
+static unsigned long checks, failures;
+
+
+/* What the interpreter did before EX was computed lazily, except that
+ * division is done in 64 bits, so that nothing can overflow. Shifts are
+ * as dcoy/dcpu/arith.h pins them down. */
+static void eager (unsigned int op, dcoy_word b, dcoy_word a,
+                   dcoy_word ex_in, dcoy_word *res, dcoy_word *ex) {
+    dcoy_dword r = 0;
+    int64_t sb = DCOY_SIGN(b), sa = DCOY_SIGN(a);
+    *ex = 0;
+
+    switch (op) {
+        case DCOY_OP_ADD:   r = a + b;      *ex = r >> 16;  break;
+        case DCOY_OP_SUB:   r = b - a;      *ex = r >> 16;  break;
+        case DCOY_OP_MUL:   r = (dcoy_dword)b * a;
+                            *ex = r >> 16;
+                            break;
+        case DCOY_OP_MLI:   r = sb * sa;    *ex = r >> 16;  break;
+
+        case DCOY_OP_DIV:
+            if (a != 0) {
+                r = b / a;
+                *ex = (int64_t)DCOY_SHL(b, 16) / a;
+            }
+            break;
+
+        case DCOY_OP_DVI:
+            if (a != 0) {
+                r = sb / sa;
+                *ex = sb * 65536 / sa;
+            }
+            break;
+
+        case DCOY_OP_SHR:   r = DCOY_SHR(b, a);
+                            *ex = DCOY_ASHR(DCOY_SHL(b, 16), a);
+                            break;
+        case DCOY_OP_ASR:   r = DCOY_ASHR(b, a);
+                            *ex = DCOY_SHR(DCOY_SHL(b, 16), a);
+                            break;
+        case DCOY_OP_SHL:   r = DCOY_SHL(b, a);
+                            *ex = DCOY_ASHR(DCOY_SHL(b, 16), a);
+                            break;
+
+        case DCOY_OP_ADX:   r = a + b + ex_in;      *ex = r >> 16;  break;
+        case DCOY_OP_SBX:   r = b - a + ex_in;      *ex = r >> 16;  break;
+    }
+
+    *res = r;
+}
+
+
+static void check (const char *what, unsigned int variant, unsigned int op,
+                   dcoy_word b, dcoy_word a, dcoy_word ex_in,
+                   dcoy_word expected, dcoy_word actual) {
+    checks++;
+    if (expected == actual) return;
+
+    if (failures++ < 20) {
+        printf("variant %u, %s 0x%04x, 0x%04x with EX 0x%04x: "
+               "%s should be 0x%04x, not 0x%04x\n", variant,
+               dcoy_opcode_names[op], b, a, ex_in, what, expected, actual);
+    }
+}
+
+
+/* Runs `op A, B` and then `then` through a variant, starting with EX
+ * set to ex_in */
+static dcoy_dcpu16 *run (dcoy_dcpu16 *d, unsigned int variant,
+                         unsigned int op, dcoy_word b, dcoy_word a,
+                         dcoy_word ex_in, dcoy_word then, unsigned int steps) {
+    dcoy_dcpu_initialize(d);
+    dcoy_dcpu_variant_set(d, variant);
+    d->reg[DCOY_REG_A] = b;
+    d->reg[DCOY_REG_B] = a;
+    dcoy_dcpu_ex_set(d, ex_in);
+
+    d->mem[0] = op | (DCOY_ARG_RVALUE + DCOY_REG_A) << 5
+                   | (DCOY_ARG_RVALUE + DCOY_REG_B) << 10;
+    d->mem[1] = then;
+    dcoy_dcpu_run(d, steps);
+    return d;
+}
+
+
+static void pair (dcoy_dcpu16 *d, dcoy_word b, dcoy_word a,
+                  dcoy_word ex_in) {
+    /* SET C, EX and ADX X, Y (with X and Y zero) read it as the next
+     * instruction's operand, and as ADX's input */
+    const dcoy_word set_c = DCOY_OP_SET
+                          | (DCOY_ARG_RVALUE + DCOY_REG_C) << 5
+                          | DCOY_ARG_EX << 10;
+    const dcoy_word adx_x = DCOY_OP_ADX
+                          | (DCOY_ARG_RVALUE + DCOY_REG_X) << 5
+                          | (DCOY_ARG_RVALUE + DCOY_REG_Y) << 10;
+
+    for (unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        unsigned int op = ops[i];
+        dcoy_word res, ex;
+        eager(op, b, a, ex_in, &res, &ex);
+
+        for (unsigned int v = 0; v < DCOY_DCPU_VARIANT_COUNT; v++) {
+            run(d, v, op, b, a, ex_in, 0, 1);
+            check("result", v, op, b, a, ex_in, res, d->reg[DCOY_REG_A]);
+            check("EX", v, op, b, a, ex_in, ex, dcoy_dcpu_ex(d));
+
+            run(d, v, op, b, a, ex_in, set_c, 2);
+            check("EX as an operand", v, op, b, a, ex_in, ex,
+                  d->reg[DCOY_REG_C]);
+
+            run(d, v, op, b, a, ex_in, adx_x, 2);
+            check("EX into ADX", v, op, b, a, ex_in, ex, d->reg[DCOY_REG_X]);
+        }
+    }
+}
+
+
+static uint64_t next (uint64_t *seed) {
+    /* xorshift64*, as in dcoy/diff.c */
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+int main () {
+    dcoy_dcpu16 *d = dcoy_dcpu_create();
+    const unsigned int count = sizeof(edges) / sizeof(edges[0]);
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+    for (unsigned int i = 0; i < count; i++) {
+        for (unsigned int j = 0; j < count; j++) {
+            pair(d, edges[i], edges[j], edges[(i + j) % count]);
+        }
+    }
+    for (unsigned int i = 0; i < RANDOM_PAIRS; i++) {
+        uint64_t r = next(&seed);
+        pair(d, r, r >> 16, r >> 32);
+    }
+
+    /* -2^31 / -1 overflows 32 bits, which used to trap */
+    dcoy_word res, ex;
+    for (unsigned int v = 0; v < DCOY_DCPU_VARIANT_COUNT; v++) {
+        run(d, v, DCOY_OP_DVI, 0x8000, 0xffff, 0, 0, 1);
+        eager(DCOY_OP_DVI, 0x8000, 0xffff, 0, &res, &ex);
+        check("result", v, DCOY_OP_DVI, 0x8000, 0xffff, 0, 0x8000,
+              d->reg[DCOY_REG_A]);
+        check("EX", v, DCOY_OP_DVI, 0x8000, 0xffff, 0, 0, dcoy_dcpu_ex(d));
+        check("eager EX", v, DCOY_OP_DVI, 0x8000, 0xffff, 0, 0, ex);
+    }
+
+    dcoy_dcpu_destroy(d);
+    printf("%s: %lu of %lu checks failed\n", failures ? "FAIL" : "ok",
+           failures, checks);
+    return failures != 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * tests/test-machine.cpp
+ *
+ * Checks that machines run random programs the same way the C
+ * interpreter does, and that their own devices come before attached ones
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "dcoy/machine.hpp"
+
+extern "C" {
+#include "dcoy/asm.h"
+#include "dcoy/diff.h"
+}
+
+#define PROGRAMS    300
+#define PROGRAM     256
+#define STEPS       20000
+#define CHUNK       1000
+
+static unsigned long checks, failures;
+
+
+/* Answers HWI by mixing A into B, and counting */
+struct counter : dcoy::device<counter> {
+    dcoy_word count;
+
+    explicit counter (dcoy_hardware_id_t id_ = 0x12345678)
+        : dcoy::device<counter>(id_, 3, 0x1c6c8b36), count(0) {}
+
+    unsigned int interrupt (dcoy_dcpu16 *d) {
+        d->reg[DCOY_REG_B] = d->reg[DCOY_REG_A] ^ count++;
+        return d->reg[DCOY_REG_A] & 3;
+    }
+};
+
+
+/* Returns the first field that differs, or NULL */
+static const char *compare (dcoy_dcpu16 *a, dcoy_dcpu16 *b) {
+    if (std::memcmp(a->reg, b->reg, sizeof(a->reg)) != 0) {
+        return "registers";
+    }
+    if (a->pc != b->pc) return "PC";
+    if (a->sp != b->sp) return "SP";
+    if (dcoy_dcpu_ex(a) != dcoy_dcpu_ex(b)) return "EX";
+    if (a->ia != b->ia) return "IA";
+    if (a->cycles != b->cycles) return "cycles";
+    if (a->flags != b->flags) return "flags";
+    if (a->retired != b->retired) return "instructions retired";
+    if (a->error_code != b->error_code) return "error code";
+    if (a->error_data != b->error_data) return "error data";
+    if (a->error_pc != b->error_pc) return "error PC";
+    if (a->int_queue_count != b->int_queue_count) return "queue length";
+
+    for (unsigned int i = 0; i < a->int_queue_count; i++) {
+        if (a->int_queue[(a->int_queue_start + i) % DCOY_INT_QUEUE_SIZE] !=
+            b->int_queue[(b->int_queue_start + i) % DCOY_INT_QUEUE_SIZE]) {
+            return "queue";
+        }
+    }
+    if (std::memcmp(a->mem, b->mem, sizeof(a->mem)) != 0) return "memory";
+    return NULL;
+}
+
+
+/* Runs m and a plain DCPU with a counter attached over the same
+ * program, comparing them after every chunk */
+template <class Machine>
+static void check (const char *what, unsigned int program, Machine &m,
+                   const dcoy_word *code, unsigned int size) {
+    dcoy::dcpu_ptr reference = dcoy::make_dcpu();
+    counter hw;
+    dcoy_dcpu_hardware_attach(reference.get(), &hw);
+    std::memcpy(reference->mem, code, size * sizeof(dcoy_word));
+    std::memcpy(m->mem, code, size * sizeof(dcoy_word));
+
+    const char *differs = NULL;
+    unsigned int steps = 0;
+
+    while (!differs && steps < STEPS && dcoy_dcpu_ready(reference.get())) {
+        unsigned int ran = dcoy_dcpu_run(reference.get(), CHUNK);
+        if (m.run(CHUNK) != ran) {
+            differs = "instructions run";
+        } else {
+            differs = compare(reference.get(), m.dcpu());
+        }
+        steps += CHUNK;
+    }
+
+    checks++;
+    if (differs && failures++ < 20) {
+        std::printf("%s, program %u: %s differ at 0x%04x\n", what, program,
+                    differs, reference->pc);
+    }
+}
+
+
+/* The machine's own counter should be HWN's first device, and its
+ * attached one the second */
+static void check_order () {
+    static const char source[] =
+        "        HWN [0x1000]\n"
+        "        HWQ 0\n"
+        "        SET [0x1001], A\n"
+        "        SET [0x1002], B\n"
+        "        HWQ 1\n"
+        "        SET [0x1003], A\n"
+        "        SET [0x1004], B\n"
+        "        SET A, 0\n"
+        "        HWI 0\n"
+        "        SET A, 0\n"
+        "        HWI 1\n"
+        "        HWI 1\n"
+        "        SUB PC, 1\n";
+
+    dcoy::dcpu_ptr d = dcoy::make_dcpu();
+    dcoy_dcpu16 *raw = d.get();
+    counter attached(0x9abcdef0);
+    dcoy_dcpu_hardware_attach(raw, &attached);
+
+    dcoy_asm *a = dcoy_asm_create();
+    bool ok = dcoy_asm_assemble(a, source, sizeof(source) - 1, raw->mem,
+                                DCOY_MEM_WORDS);
+    dcoy_asm_destroy(a);
+
+    dcoy::machine<dcoy::devices<counter> > m(std::move(d));
+    m.run(100);
+
+    const char *wrong = NULL;
+    if (!ok) wrong = "the program doesn't assemble";
+    else if (m.dcpu() != raw) wrong = "the DCPU wasn't adopted";
+    else if (m->mem[0x1000] != 2) wrong = "HWN doesn't count both devices";
+    else if (m->mem[0x1001] != 0x5678 || m->mem[0x1002] != 0x1234) {
+        wrong = "HWQ 0 isn't the machine's device";
+    } else if (m->mem[0x1003] != 0xdef0 || m->mem[0x1004] != 0x9abc) {
+        wrong = "HWQ 1 isn't the attached device";
+    } else if (m.device<0>().count != 1 || attached.count != 2) {
+        wrong = "HWI went to the wrong device";
+    }
+
+    checks++;
+    if (wrong && failures++ < 20) {
+        std::printf("device order: %s\n", wrong);
+    }
+}
+
+
+int main () {
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    dcoy_word code[PROGRAM];
+
+    for (unsigned int i = 0; i < PROGRAMS; i++) {
+        unsigned int size = dcoy_diff_generate(code, PROGRAM, &seed);
+
+        dcoy::machine<> plain;
+        counter hw;
+        dcoy_dcpu_hardware_attach(plain.dcpu(), &hw);
+        check("machine<>", i, plain, code, size);
+
+        dcoy::machine<dcoy::devices<counter> > devices;
+        check("devices<counter>", i, devices, code, size);
+    }
+
+    check_order();
+
+    std::printf("%s: %lu of %lu checks failed\n", failures ? "FAIL" : "ok",
+                failures, checks);
+    return failures != 0;
+}
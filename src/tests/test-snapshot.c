@@ -0,0 +1,212 @@
+/**
+ * tests/test-snapshot.c
+ *
+ * Checks that full and delta snapshots read back the state they were
+ * written from, and that ones with a bad header are turned away
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/snapshot.h"
+#include "dcoy/specs.h"
+
+#define STATES  200
+
+static const unsigned int errors[] = {
+    DCOY_DCPU_ERROR_NONE, DCOY_DCPU_ERROR_INVALID_OPCODE,
+    DCOY_DCPU_ERROR_INVALID_SPEC_OPCODE, DCOY_DCPU_ERROR_INVALID_ARG_TYPE,
+    DCOY_DCPU_ERROR_NO_HARDWARE
+};
+
+static unsigned long checks, failures;
+
+
+static uint64_t next (uint64_t *seed) {
+    /* xorshift64*, as in dcoy/diff.c */
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+/* Fills memory from `from` up to `to` with a mix of zeros, runs of one
+ * word and noise, so every kind of record gets written */
+static void scribble (dcoy_dcpu16 *d, unsigned int from, unsigned int to,
+                      uint64_t *seed) {
+    unsigned int addr = from;
+    while (addr < to) {
+        uint64_t r = next(seed);
+        unsigned int length = 1 + (r >> 8) % 300;
+        if (length > to - addr) length = to - addr;
+
+        for (unsigned int i = 0; i < length; i++) {
+            switch (r % 3) {
+                case 0: d->mem[addr + i] = 0;                       break;
+                case 1: d->mem[addr + i] = (dcoy_word)(r >> 32);    break;
+                case 2: d->mem[addr + i] = (dcoy_word)next(seed);   break;
+            }
+        }
+        addr += length;
+    }
+}
+
+
+static void randomize (dcoy_dcpu16 *d, uint64_t *seed) {
+    uint64_t r = next(seed);
+
+    for (unsigned int i = 0; i < DCOY_REG_COUNT; i++) {
+        d->reg[i] = (dcoy_word)next(seed);
+    }
+    d->pc = (dcoy_word)r;
+    d->sp = (dcoy_word)(r >> 16);
+    dcoy_dcpu_ex_set(d, (dcoy_word)(r >> 32));
+    d->ia = (dcoy_word)(r >> 48);
+
+    r = next(seed);
+    d->cycles = (unsigned int)r;
+    d->flags = (r >> 32) & (DCOY_DCPU_FLAG_IAQ | DCOY_DCPU_FLAG_HALT |
+                            DCOY_DCPU_FLAG_ON_FIRE);
+    d->variant = (r >> 40) % DCOY_DCPU_VARIANT_COUNT;
+
+    r = next(seed);
+    d->error_code = errors[r % (sizeof(errors) / sizeof(errors[0]))];
+    d->error_data = (dcoy_word)(r >> 16);
+    d->error_pc = (dcoy_word)(r >> 32);
+
+    /* the queue may wrap around the end of the buffer */
+    d->int_queue_start = (r >> 48) % DCOY_INT_QUEUE_SIZE;
+    d->int_queue_count = next(seed) % (DCOY_INT_QUEUE_SIZE + 1);
+    for (unsigned int i = 0; i < DCOY_INT_QUEUE_SIZE; i++) {
+        d->int_queue[i] = (dcoy_word)next(seed);
+    }
+}
+
+
+/* Returns the first field that differs, or NULL */
+static const char *compare (dcoy_dcpu16 *a, dcoy_dcpu16 *b) {
+    if (memcmp(a->reg, b->reg, sizeof(a->reg)) != 0) return "registers";
+    if (a->pc != b->pc) return "PC";
+    if (a->sp != b->sp) return "SP";
+    if (dcoy_dcpu_ex(a) != dcoy_dcpu_ex(b)) return "EX";
+    if (a->ia != b->ia) return "IA";
+    if (a->cycles != b->cycles) return "cycles";
+    if (a->flags != b->flags) return "flags";
+    if (a->variant != b->variant) return "variant";
+    if (a->error_code != b->error_code) return "error code";
+    if (a->error_data != b->error_data) return "error data";
+    if (a->error_pc != b->error_pc) return "error PC";
+    if (a->int_queue_count != b->int_queue_count) return "queue length";
+
+    for (unsigned int i = 0; i < a->int_queue_count; i++) {
+        if (a->int_queue[(a->int_queue_start + i) % DCOY_INT_QUEUE_SIZE] !=
+            b->int_queue[(b->int_queue_start + i) % DCOY_INT_QUEUE_SIZE]) {
+            return "queue";
+        }
+    }
+    if (memcmp(a->mem, b->mem, sizeof(a->mem)) != 0) return "memory";
+    return NULL;
+}
+
+
+static void check (const char *what, unsigned int state, bool ok,
+                   const char *differs) {
+    checks++;
+    if ((!ok || differs) && failures++ < 20) {
+        printf("%s, state %u: %s\n", what, state,
+               ok ? differs : "read failed");
+    }
+}
+
+
+/* Writes d, against base if there is one, and reads it into into */
+static bool round_trip (dcoy_dcpu16 *d, const dcoy_dcpu16 *base,
+                        dcoy_dcpu16 *into) {
+    FILE *f = tmpfile();
+    if (!f) return false;
+
+    bool ok = dcoy_snapshot_write(d, base, f);
+    rewind(f);
+    ok = ok && dcoy_snapshot_read(into, f);
+    fclose(f);
+    return ok;
+}
+
+
+/* A full snapshot with its header patched at `offset` should be
+ * refused, without touching memory */
+static void check_header (dcoy_dcpu16 *d, dcoy_dcpu16 *into,
+                          const char *what, long offset, dcoy_word value) {
+    FILE *f = tmpfile();
+    if (!f) return;
+
+    dcoy_snapshot_write(d, NULL, f);
+    fseek(f, offset, SEEK_SET);
+    putc(value & 0xff, f);
+    putc(value >> 8, f);
+    rewind(f);
+
+    for (unsigned int i = 0; i < DCOY_MEM_WORDS; i++) {
+        into->mem[i] = 0xdc01;
+    }
+    bool ok = dcoy_snapshot_read(into, f);
+    fclose(f);
+
+    checks++;
+    if (ok && failures++ < 20) {
+        printf("%s: should have been refused\n", what);
+    } else if (into->mem[0] != 0xdc01 && failures++ < 20) {
+        printf("%s: memory was changed\n", what);
+    }
+}
+
+
+int main () {
+    dcoy_dcpu16 *d = dcoy_dcpu_create(), *base = dcoy_dcpu_create();
+    dcoy_dcpu16 *into = dcoy_dcpu_create();
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+    for (unsigned int state = 0; state < STATES; state++) {
+        /* full, into a DCPU holding something else entirely */
+        randomize(d, &seed);
+        scribble(d, 0, DCOY_MEM_WORDS, &seed);
+        randomize(into, &seed);
+        scribble(into, 0, DCOY_MEM_WORDS, &seed);
+
+        bool ok = round_trip(d, NULL, into);
+        check("full", state, ok, ok ? compare(d, into) : NULL);
+
+        /* delta, from a copy of the base, after changing part of it */
+        memcpy(base->mem, d->mem, sizeof(d->mem));
+        memcpy(into->mem, d->mem, sizeof(d->mem));
+
+        uint64_t r = next(&seed);
+        unsigned int from = r % DCOY_MEM_WORDS;
+        unsigned int to = from + (r >> 16) % (DCOY_MEM_WORDS - from + 1);
+        randomize(d, &seed);
+        scribble(d, from, to, &seed);
+
+        ok = round_trip(d, base, into);
+        check("delta", state, ok, ok ? compare(d, into) : NULL);
+    }
+
+    /* the version is at offset 8, and the flags at 10 */
+    check_header(d, into, "version 0", 8, 0);
+    check_header(d, into, "a later version", 8, DCOY_SNAPSHOT_VERSION + 1);
+    check_header(d, into, "unknown flags", 10, 1 << 1);
+
+    dcoy_dcpu_destroy(d);
+    dcoy_dcpu_destroy(base);
+    dcoy_dcpu_destroy(into);
+    printf("%s: %lu of %lu checks failed\n", failures ? "FAIL" : "ok",
+           failures, checks);
+    return failures != 0;
+}
@@ -0,0 +1,506 @@
+/**
+ * tools/dcoy-aot.c
+ *
+ * Compiles a DCPU image ahead of time into C, to be built as a shared
+ * object and loaded with dcoy_aot_load
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dcoy/aot.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/code.h"
+#include "dcoy/constants.h"
+#include "dcoy/opcodes.h"
+#include "dcoy/specs.h"
+
+#define MAX_BLOCK_INSTS 64
+
+static dcoy_word image[DCOY_MEM_WORDS];
+static int image_size;
+
+/* block starts found so far, and which have been compiled */
+static bool found[DCOY_MEM_WORDS];
+static dcoy_word worklist[DCOY_MEM_WORDS];
+static unsigned int worklist_size;
+
+static dcoy_word compiled[DCOY_MEM_WORDS];
+static unsigned int compiled_count;
+static dcoy_word sizes[DCOY_MEM_WORDS];
+
+
+/* Discovery */
+
+static void discover (unsigned int addr) {
+    if (addr < DCOY_MEM_WORDS && !found[addr]) {
+        found[addr] = true;
+        worklist[worklist_size++] = addr;
+    }
+}
+
+
+/* Reads an instruction, refusing any that would wrap around memory */
+static unsigned int read_inst (dcoy_inst *inst, unsigned int addr) {
+    if (addr >= DCOY_MEM_WORDS) return 0;
+    unsigned int size = dcoy_inst_read(inst, image, addr, DCOY_MEM_WORDS);
+    return addr + size <= DCOY_MEM_WORDS ? size : 0;
+}
+
+
+static bool is_literal (dcoy_arg arg) {
+    return arg.type == DCOY_ARG_VALUE || arg.type == DCOY_ARG_IVALUE;
+}
+
+
+/* Instructions that need the library (or an error) run in the
+ * interpreter, so blocks stop just before them. */
+static bool compilable (dcoy_inst inst) {
+    if (dcoy_inst_base_cost(inst) == 0) {
+        return false;
+    }
+    if (inst.special) {
+        switch (inst.opcode) {
+            case INT: case HWN: case HWQ: case HWI:
+                return false;
+        }
+    }
+    return true;
+}
+
+
+static bool writes_pc (dcoy_inst inst) {
+    if (inst.special) {
+        return inst.opcode == JSR || inst.opcode == RFI ||
+               (inst.opcode == IAG && inst.a.type == DCOY_ARG_PC);
+    } else {
+        return inst.b.type == DCOY_ARG_PC &&
+               !(inst.opcode >= IFB && inst.opcode <= IFU);
+    }
+}
+
+
+static bool is_if (dcoy_inst inst) {
+    return !inst.special && inst.opcode >= IFB && inst.opcode <= IFU;
+}
+
+
+/* Mirrors skip() in dcoy/dcpu/exec.c, including its treatment of
+ * special opcodes in the IF range. Returns the address skipped to,
+ * or -1 if the skip would wrap around memory. */
+static int skip_target (unsigned int addr, unsigned int *extra) {
+    dcoy_inst next;
+    unsigned int skipped = 0;
+
+    do {
+        unsigned int size = read_inst(&next, addr);
+        if (size == 0) return -1;
+        addr += size;
+        skipped++;
+    } while (next.opcode >= IFB && next.opcode <= IFU);
+
+    *extra = skipped - 1;
+    return addr;
+}
+
+
+/* Code generation */
+
+static void emit_get (FILE *out, dcoy_arg arg, const char *var) {
+    fprintf(out, "        %s = ", var);
+    switch (arg.type) {
+        case DCOY_ARG_RVALUE:   fprintf(out, "d->reg[%d]", arg.reg);     break;
+        case DCOY_ARG_RLOOKUP:  fprintf(out, "d->mem[d->reg[%d]]", arg.reg);
+                                break;
+        case DCOY_ARG_ROFFSET:  fprintf(out, "d->mem[(dcoy_word)"
+                                             "(d->reg[%d] + 0x%04x)]",
+                                             arg.reg, arg.data);
+                                break;
+        case DCOY_ARG_PUSHPOP:  fprintf(out, "d->mem[d->sp++]");         break;
+        case DCOY_ARG_PEEK:     fprintf(out, "d->mem[d->sp]");           break;
+        case DCOY_ARG_PICK:     fprintf(out, "d->mem[(dcoy_word)"
+                                             "(d->sp + 0x%04x)]", arg.data);
+                                break;
+        case DCOY_ARG_SP:       fprintf(out, "d->sp");                   break;
+        case DCOY_ARG_PC:       fprintf(out, "d->pc");                   break;
+        case DCOY_ARG_EX:       fprintf(out, "d->ex");                   break;
+        case DCOY_ARG_LOOKUP:   fprintf(out, "d->mem[0x%04x]", arg.data); break;
+        default:                fprintf(out, "0x%04x", arg.data);        break;
+    }
+    fprintf(out, ";\n");
+}
+
+
+static void emit_store (FILE *out, const char *addr, const char *value,
+                        unsigned int start, unsigned int size) {
+    fprintf(out, "        w = %s;\n", addr);
+    fprintf(out, "        d->mem[w] = %s;\n", value);
+    fprintf(out, "        dcoy_dcpu_dirty(d, w);\n");
+    fprintf(out, "        modified |= DCOY_AOT_HITS(w, 0x%04x, %u);\n",
+            start, size);
+}
+
+
+static void emit_set (FILE *out, dcoy_arg arg, const char *value,
+                      unsigned int start, unsigned int size) {
+    char addr[48];
+
+    switch (arg.type) {
+        case DCOY_ARG_RVALUE:
+            fprintf(out, "        d->reg[%d] = %s;\n", arg.reg, value);
+            break;
+        case DCOY_ARG_RLOOKUP:
+            sprintf(addr, "d->reg[%d]", arg.reg);
+            emit_store(out, addr, value, start, size);
+            break;
+        case DCOY_ARG_ROFFSET:
+            sprintf(addr, "(dcoy_word)(d->reg[%d] + 0x%04x)",
+                    arg.reg, arg.data);
+            emit_store(out, addr, value, start, size);
+            break;
+        case DCOY_ARG_PUSHPOP:
+            emit_store(out, "--d->sp", value, start, size);
+            break;
+        case DCOY_ARG_PEEK:
+            emit_store(out, "d->sp", value, start, size);
+            break;
+        case DCOY_ARG_PICK:
+            sprintf(addr, "(dcoy_word)(d->sp + 0x%04x)", arg.data);
+            emit_store(out, addr, value, start, size);
+            break;
+        case DCOY_ARG_SP:
+            fprintf(out, "        d->sp = %s;\n", value);
+            break;
+        case DCOY_ARG_PC:
+            fprintf(out, "        d->pc = %s;\n", value);
+            break;
+        case DCOY_ARG_EX:
+            fprintf(out, "        dcoy_dcpu_ex_set(d, %s);\n", value);
+            break;
+        case DCOY_ARG_LOOKUP:
+            sprintf(addr, "0x%04x", arg.data);
+            emit_store(out, addr, value, start, size);
+            break;
+        default:
+            /* writes to literals are ignored */
+            break;
+    }
+}
+
+
+/* Emits the body of a standard instruction, after its PC update.
+ * These mirror the cases in dcoy_dcpu_exec. */
+static void emit_standard (FILE *out, dcoy_inst inst,
+                           unsigned int start, unsigned int size) {
+    const char *math = NULL;
+    const char *ex = NULL;
+    const char *skip_if = NULL;
+
+    switch (inst.opcode) {
+        case SET:   emit_get(out, inst.a, "a");
+                    emit_set(out, inst.b, "a", start, size);
+                    return;
+
+        case ADD:   math = "a + b";     ex = "res >> 16";               break;
+        case SUB:   math = "b - a";     ex = "res >> 16";               break;
+        case MUL:   math = "DCOY_MUL(b, a)";
+                    ex = "(res >> 16) & 0xffff";
+                    break;
+        case MLI:   math = "DCOY_SIGN(b) * DCOY_SIGN(a)";
+                    ex = "(res >> 16) & 0xffff";
+                    break;
+        case DIV:   math = "a == 0 ? 0 : b / a";
+                    ex = "a == 0 ? 0 : (DCOY_SHL(b, 16) / a) & 0xffff";
+                    break;
+        case DVI:   math = "a == 0 ? 0 : DCOY_SIGN(b) / DCOY_SIGN(a)";
+                    ex = "a == 0 ? 0 : DCOY_SDIV(DCOY_SHL(DCOY_SIGN(b), 16),"
+                         " DCOY_SIGN(a)) & 0xffff";
+                    break;
+        case MOD:   math = "a == 0 ? 0 : b % a";                        break;
+        case MDI:   math = "a == 0 ? 0 : DCOY_SIGN(b) % DCOY_SIGN(a)";
+                    break;
+        case AND:   math = "b & a";                                     break;
+        case BOR:   math = "b | a";                                     break;
+        case XOR:   math = "b ^ a";                                     break;
+        case SHR:   math = "DCOY_SHR(b, a)";
+                    ex = "DCOY_ASHR(DCOY_SHL(b, 16), a) & 0xffff";
+                    break;
+        case ASR:   math = "DCOY_ASHR(b, a)";
+                    ex = "DCOY_SHR(DCOY_SHL(b, 16), a) & 0xffff";
+                    break;
+        case SHL:   math = "DCOY_SHL(b, a)";
+                    ex = "DCOY_ASHR(DCOY_SHL(b, 16), a) & 0xffff";
+                    break;
+
+        case IFB:   skip_if = "!(b & a)";                               break;
+        case IFC:   skip_if = "b & a";                                  break;
+        case IFE:   skip_if = "b != a";                                 break;
+        case IFN:   skip_if = "b == a";                                 break;
+        case IFG:   skip_if = "b <= a";                                 break;
+        case IFA:   skip_if = "DCOY_SIGN(b) <= DCOY_SIGN(a)";    break;
+        case IFL:   skip_if = "b >= a";                                 break;
+        case IFU:   skip_if = "DCOY_SIGN(b) >= DCOY_SIGN(a)";    break;
+
+        case ADX:   math = "a + b + d->ex";     ex = "res >> 16";       break;
+        case SBX:   math = "b - a + d->ex";     ex = "res >> 16";       break;
+
+        case STI:
+        case STD:   emit_get(out, inst.a, "a");
+                    emit_set(out, inst.b, "a", start, size);
+                    fprintf(out, "        d->reg[%d]%s;\n", I,
+                            inst.opcode == STI ? "++" : "--");
+                    fprintf(out, "        d->reg[%d]%s;\n", J,
+                            inst.opcode == STI ? "++" : "--");
+                    return;
+
+        default:    return;
+    }
+
+    emit_get(out, inst.a, "a");
+    emit_get(out, inst.b, "b");
+
+    if (skip_if) {
+        fprintf(out, "        skip = %s;\n", skip_if);
+        return;
+    }
+
+    fprintf(out, "        res = %s;\n", math);
+    if (ex) {
+        fprintf(out, "        ex = %s;\n", ex);
+    }
+    emit_set(out, inst.b, "res", start, size);
+    if (ex) {
+        fprintf(out, "        dcoy_dcpu_ex_set(d, ex);\n");
+    }
+}
+
+
+/* Emits the body of a special instruction, after its PC update.
+ * These mirror the cases in dcoy_dcpu_exec. */
+static void emit_special (FILE *out, dcoy_inst inst,
+                          unsigned int start, unsigned int size) {
+    switch (inst.opcode) {
+        case JSR:   emit_get(out, inst.a, "a");
+                    emit_store(out, "--d->sp", "d->pc", start, size);
+                    fprintf(out, "        d->pc = a;\n");
+                    break;
+
+        case IAG:   emit_set(out, inst.a, "d->ia", start, size);
+                    break;
+
+        case IAS:   emit_get(out, inst.a, "a");
+                    fprintf(out, "        d->ia = a;\n");
+                    break;
+
+        case RFI:   fprintf(out, "        dcoy_dcpu_flag_unset(d, "
+                                 "DCOY_DCPU_FLAG_IAQ);\n"
+                                 "        d->reg[%d] = d->mem[d->sp++];\n"
+                                 "        d->pc = d->mem[d->sp++];\n", A);
+                    break;
+
+        case IAQ:   emit_get(out, inst.a, "a");
+                    fprintf(out, "        if (a) {\n"
+                                 "            dcoy_dcpu_flag_set(d, "
+                                 "DCOY_DCPU_FLAG_IAQ);\n"
+                                 "        } else {\n"
+                                 "            dcoy_dcpu_flag_unset(d, "
+                                 "DCOY_DCPU_FLAG_IAQ);\n"
+                                 "        }\n");
+                    break;
+    }
+}
+
+
+/* Compiles the block starting at `start`, following the same control
+ * flow the interpreter would. Returns false if not even the first
+ * instruction could be compiled. */
+static bool compile_block (FILE *out, unsigned int start) {
+    dcoy_inst insts[MAX_BLOCK_INSTS];
+    unsigned int addrs[MAX_BLOCK_INSTS];
+    unsigned int count = 0;
+    unsigned int end = start;
+    unsigned int addr = start;
+
+    /* First pass: find the extent of the block */
+    while (count < MAX_BLOCK_INSTS) {
+        dcoy_inst inst;
+        unsigned int size = read_inst(&inst, addr);
+
+        if (size == 0) {
+            break;
+        }
+        if (!compilable(inst)) {
+            /* the interpreter runs it, then comes back to us */
+            if (dcoy_inst_base_cost(inst)) discover(addr + size);
+            break;
+        }
+
+        unsigned int extra;
+        if (is_if(inst) && skip_target(addr + size, &extra) < 0) {
+            break;
+        }
+
+        insts[count] = inst;
+        addrs[count] = addr;
+        count++;
+        addr += size;
+        if (addr > end) end = addr;
+
+        if (is_if(inst)) {
+            unsigned int target = skip_target(addr, &extra);
+            discover(target);
+            if (target > end) end = target;
+        }
+
+        if (writes_pc(inst)) {
+            if (inst.special && inst.opcode == JSR) {
+                discover(addr);
+                if (is_literal(inst.a)) discover(inst.a.data);
+            } else if (!inst.special && inst.opcode == SET &&
+                       is_literal(inst.a)) {
+                discover(inst.a.data);
+            }
+            break;
+        }
+
+        if (inst.special && inst.opcode == IAS && is_literal(inst.a)) {
+            discover(inst.a.data);
+        }
+    }
+
+    if (count == 0) {
+        return false;
+    }
+    if (count == MAX_BLOCK_INSTS) {
+        discover(addr);
+    }
+
+    unsigned int size = end - start;
+    sizes[start] = size;
+
+    /* Second pass: emit the code, and what it was compiled from */
+    fprintf(out, "static const dcoy_word code_%04x[] = {", start);
+    for (unsigned int i = 0; i < size; i++) {
+        fprintf(out, "%s0x%04x,", i % 8 ? " " : "\n    ", image[start + i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static void block_%04x (dcoy_dcpu16 *d) {\n"
+                 "    bool modified = false;\n"
+                 "    dcoy_word w = 0;\n"
+                 "    (void)w;\n\n",
+            start);
+
+    for (unsigned int i = 0; i < count; i++) {
+        dcoy_inst inst = insts[i];
+        unsigned int next = addrs[i] + read_inst(&inst, addrs[i]);
+        unsigned int cost = dcoy_inst_base_cost(inst);
+        char dis[64];
+
+        dcoy_inst_write(inst, dis);
+        fprintf(out, "    /* %04x: %s */\n"
+                     "    d->pc = 0x%04x;\n"
+                     "    {\n"
+                     "        dcoy_word a = 0, b = 0;\n"
+                     "        dcoy_dword res = 0;\n"
+                     "        dcoy_word ex = 0;\n"
+                     "        bool skip = false;\n"
+                     "        (void)a; (void)b; (void)res; (void)ex; "
+                     "(void)skip;\n",
+                addrs[i], dis, next & 0xffff);
+
+        if (inst.special) {
+            emit_special(out, inst, start, size);
+        } else {
+            emit_standard(out, inst, start, size);
+        }
+
+        if (is_if(inst)) {
+            unsigned int extra;
+            unsigned int target = skip_target(next, &extra);
+            fprintf(out, "        if (skip) {\n"
+                         "            d->pc = 0x%04x;\n"
+                         "            d->cycles += %u;\n"
+                         "            d->retired += %u;\n"
+                         "            return;\n"
+                         "        }\n",
+                    target & 0xffff, cost + extra, i + 1);
+        }
+
+        fprintf(out, "    }\n"
+                     "    d->cycles += %u;\n", cost);
+
+        /* every exit counts the instructions run up to it */
+        if (writes_pc(inst) || i == count - 1) {
+            fprintf(out, "    d->retired += %u;\n"
+                         "    return;\n", i + 1);
+        } else {
+            fprintf(out, "    if (modified || DCOY_AOT_PENDING(d)) {\n"
+                         "        d->retired += %u;\n"
+                         "        return;\n"
+                         "    }\n\n", i + 1);
+        }
+    }
+
+    fprintf(out, "}\n\n");
+    return true;
+}
+
+
+int main (int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("usage: dcoy-aot IMAGE OUTPUT.c [ENTRY...]\n"
+               "then:  cc -O2 -shared -fPIC -Isrc -o IMAGE.so OUTPUT.c\n");
+        return 1;
+    }
+
+    image_size = dcoy_dcpu_load_image(image, DCOY_MEM_WORDS, argv[1]);
+    if (image_size < 0) {
+        printf("can't read image from %s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        printf("can't write to %s: %s\n", argv[2], strerror(errno));
+        return 2;
+    }
+
+    discover(0);
+    for (int i = 3; i < argc; i++) {
+        discover(strtoul(argv[i], NULL, 0));
+    }
+
+    fprintf(out, "/* Compiled by dcoy-aot from %s */\n\n"
+                 "#include <stdbool.h>\n"
+                 "#include \"dcoy/aot.h\"\n"
+                 "#include \"dcoy/dcpu.h\"\n\n",
+            argv[1]);
+
+    while (worklist_size) {
+        dcoy_word start = worklist[--worklist_size];
+        if (compile_block(out, start)) {
+            compiled[compiled_count++] = start;
+        }
+    }
+
+    fprintf(out, "static const dcoy_aot_block blocks[] = {\n");
+    for (unsigned int i = 0; i < compiled_count; i++) {
+        dcoy_word start = compiled[i];
+        fprintf(out, "    {0x%04x, %u, code_%04x, block_%04x},\n",
+                start, sizes[start], start, start);
+    }
+    fprintf(out, "};\n\n"
+                 "const dcoy_aot_image dcoy_aot_compiled = {\n"
+                 "    DCOY_AOT_ABI, sizeof(dcoy_dcpu16), %u, blocks\n"
+                 "};\n",
+            compiled_count);
+
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * tools/dcoy-asm.c
+ *
+ * Assembles a source file into a DCPU image, and optionally writes a
+ * symbol map for dcoy-prof
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dcoy/asm.h"
+#include "dcoy/specs.h"
+
+char *load_source (const char *filename, size_t *length) {
+    FILE *fd = fopen(filename, "r");
+    if (!fd) {
+        return NULL;
+    }
+
+    size_t size = 4096;
+    char *src = malloc(size);
+    *length = 0;
+
+    while (src) {
+        *length += fread(src + *length, 1, size - *length, fd);
+        if (*length < size || ferror(fd)) break;
+        char *bigger = realloc(src, size *= 2);
+        if (!bigger) free(src);
+        src = bigger;
+    }
+
+    if (src && ferror(fd)) {
+        free(src);
+        src = NULL;
+    }
+    fclose(fd);
+    return src;
+}
+
+
+int main (int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("usage: dcoy-asm SOURCE IMAGE [SYMBOLS]\n");
+        return 1;
+    }
+
+    size_t length;
+    char *src = load_source(argv[1], &length);
+    if (!src) {
+        printf("can't read source from %s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    static dcoy_word image[DCOY_MEM_WORDS];
+    dcoy_asm *a = dcoy_asm_create();
+
+    if (!dcoy_asm_assemble(a, src, length, image, DCOY_MEM_WORDS)) {
+        printf("%s:%u: %s\n", argv[1], a->error_line, a->error);
+        return 3;
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out || fwrite(image, 2, a->end, out) != a->end || fclose(out)) {
+        printf("can't write image to %s: %s\n", argv[2], strerror(errno));
+        return 2;
+    }
+
+    if (argc > 3) {
+        out = fopen(argv[3], "w");
+        if (!out || !dcoy_asm_write_symbols(a, out) || fclose(out)) {
+            printf("can't write symbols to %s: %s\n", argv[3],
+                   strerror(errno));
+            return 2;
+        }
+    }
+
+    dcoy_asm_destroy(a);
+    free(src);
+    return 0;
+}
@@ -16,22 +16,6 @@
 #include "dcoy/constants.h"
 #include "dcoy/specs.h"
 
-int load_image (dcoy_dcpu16 *d, const char *filename) {
-    FILE *fd = fopen(filename, "r");
-    if (!fd) {
-        return -1;
-    }
-
-    int image_size = fread(d->mem, 2, DCOY_MEM_WORDS, fd);
-    if (ferror(fd)) {
-        return -1;
-    }
-    fclose(fd);
-
-    return image_size;
-}
-
-
 int main (int argc, char *argv[]) {
     if (argc < 2) {
         printf("usage: dcoy-demu IMAGE\n");
@@ -39,7 +23,7 @@ int main (int argc, char *argv[]) {
     }
 
     dcoy_dcpu16 *d = dcoy_dcpu_create();
-    int image_size = load_image(d, argv[1]);
+    int image_size = dcoy_dcpu_load_image(d->mem, DCOY_MEM_WORDS, argv[1]);
 
     if (image_size < 0) {
         printf("can't read image from %s: %s\n", argv[1], strerror(errno));
@@ -62,7 +46,7 @@ int main (int argc, char *argv[]) {
             "%-6d  %04x  %04x %04x %04x %04x %04x %04x %04x %04x %04x  %s\n",
             d->cycles, d->pc,
             d->reg[A], d->reg[B], d->reg[C], d->reg[X], d->reg[Y], d->reg[Z],
-            d->reg[I], d->reg[J], d->ex,
+            d->reg[I], d->reg[J], dcoy_dcpu_ex(d),
             disassembled
         );
         (void)dcoy_dcpu_step(d);
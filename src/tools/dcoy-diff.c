@@ -0,0 +1,137 @@
+/**
+ * tools/dcoy-diff.c
+ *
+ * Checks an interpreter variant, or a compiled image, against the
+ * reference interpreter on DCPU images or random programs
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dcoy/aot.h"
+#include "dcoy/dcpu.h"
+#include "dcoy/diff.h"
+#include "dcoy/specs.h"
+
+#define DEFAULT_LIMIT   1000000
+#define DEFAULT_WORDS   512
+
+static bool check (dcoy_diff *df, const dcoy_dcpu16 *start,
+                   const dcoy_diff_engine *e, unsigned long limit,
+                   const char *name) {
+    dcoy_diff_result r;
+
+    if (dcoy_diff_run(df, start, e, limit, &r)) {
+        printf("ok %s: %lu instructions, %u cycles\n", name,
+               r.instructions, r.cycles);
+        return true;
+    }
+
+    printf("diverged %s: %s", name, r.field);
+    if (strcmp(r.field, "register") == 0) {
+        printf(" %c", dcoy_register_names[r.index]);
+    } else if (strcmp(r.field, "memory") == 0 ||
+               strcmp(r.field, "queue") == 0) {
+        printf(" [0x%04x]", r.index);
+    }
+    printf(" should be 0x%04x, not 0x%04x, after %lu instructions, "
+           "at 0x%04x: %s\n", r.expected, r.actual, r.instructions, r.pc,
+           r.inst);
+    return false;
+}
+
+
+int main (int argc, char *argv[]) {
+    int variant = DCOY_DCPU_VARIANT_FAST;
+    unsigned int quantum = 0, words = DEFAULT_WORDS, programs = 0;
+    unsigned long limit = DEFAULT_LIMIT;
+    uint64_t seed = 1;
+    const char *compiled = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v:a:q:l:n:s:w:")) != -1) {
+        switch (opt) {
+            case 'v':   variant = dcoy_dcpu_variant_find(optarg);
+                        if (variant < 0) goto usage;
+                        break;
+            case 'a':   compiled = optarg;                          break;
+            case 'q':   quantum = strtoul(optarg, NULL, 0);         break;
+            case 'l':   limit = strtoul(optarg, NULL, 0);           break;
+            case 'n':   programs = strtoul(optarg, NULL, 0);        break;
+            case 's':   seed = strtoull(optarg, NULL, 0);           break;
+            case 'w':   words = strtoul(optarg, NULL, 0);           break;
+            default:    goto usage;
+        }
+    }
+
+    if ((optind == argc && programs == 0) ||
+        (compiled && (programs || argc - optind != 1))) {
+usage:
+        printf("usage: dcoy-diff [-v VARIANT] [-q QUANTUM] [-l LIMIT] "
+               "IMAGE...\n"
+               "       dcoy-diff -a COMPILED.so [options] IMAGE\n"
+               "       dcoy-diff [options] -n PROGRAMS [-s SEED] "
+               "[-w WORDS]\n"
+               "VARIANT is full, no-cycles, no-interrupts, trap or fast.\n"
+               "LIMIT counts cycles for compiled images, and "
+               "instructions otherwise.\n"
+               "Compiled code only runs on the image it was compiled from, "
+               "so -a can't be used\nwith -n.\n");
+        return 1;
+    }
+
+    dcoy_diff_engine e;
+    dcoy_aot *aot = NULL;
+
+    if (compiled) {
+        const char *error;
+        aot = dcoy_aot_load(compiled, &error);
+        if (!aot) {
+            printf("can't load %s: %s\n", compiled, error);
+            return 2;
+        }
+        dcoy_diff_engine_aot(&e, aot);
+    } else {
+        dcoy_diff_engine_variant(&e, variant);
+    }
+
+    dcoy_diff *df = dcoy_diff_create(quantum);
+    dcoy_dcpu16 *start = dcoy_dcpu_create();
+    unsigned int failed = 0;
+
+    for (int i = optind; i < argc; i++) {
+        dcoy_dcpu_initialize(start);
+        if (dcoy_dcpu_load_image(start->mem, DCOY_MEM_WORDS, argv[i]) < 0) {
+            printf("can't read image from %s: %s\n", argv[i],
+                   strerror(errno));
+            failed++;
+            continue;
+        }
+        failed += !check(df, start, &e, limit, argv[i]);
+    }
+
+    for (unsigned int i = 0; i < programs; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "random #%u (seed %llu)", i,
+                 (unsigned long long)seed);
+
+        dcoy_dcpu_initialize(start);
+        dcoy_diff_generate(start->mem, words < DCOY_MEM_WORDS
+                                       ? words : DCOY_MEM_WORDS, &seed);
+        failed += !check(df, start, &e, limit, name);
+    }
+
+    if (aot) {
+        dcoy_aot_unload(aot);
+    }
+    dcoy_dcpu_destroy(start);
+    dcoy_diff_destroy(df);
+    return failed ? 3 : 0;
+}
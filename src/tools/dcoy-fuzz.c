@@ -0,0 +1,177 @@
+/**
+ * tools/dcoy-fuzz.c
+ *
+ * Runs a DCPU image up to a fork point once, then runs many inputs from
+ * there, classifying how each run ended
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/coverage.h"
+#include "dcoy/fuzz.h"
+#include "dcoy/specs.h"
+
+#define MAX_INPUT       (DCOY_MEM_WORDS * 2)
+#define FORK_CYCLES     100000000
+#define SERVE_BUFFER    65536
+
+static const char *results[] = {
+    "error", "fire", "halted", "exited", "timeout", "yielded"
+};
+
+
+static void report (dcoy_fuzz *f, const char *name, unsigned int result,
+                    uint8_t *total) {
+    bool new_edges = f->coverage && dcoy_coverage_merge(total, f->coverage);
+
+    printf("%s: %s", name, results[result]);
+    if (result == DCOY_FUZZ_ERROR) {
+        printf(" 0x%02x at 0x%04x", f->work.error_code, f->work.error_pc);
+    }
+    printf(" cycles=%u%s\n", f->work.cycles - f->base.cycles,
+           new_edges ? " new-coverage" : "");
+}
+
+
+/* Without input files, inputs are read from stdin, each preceded by its
+ * length as a 32-bit little-endian number, and each result is written
+ * back to stdout as a single byte. Results are only flushed when the
+ * server is about to wait for more input, so a client that sends a
+ * batch of inputs before reading their results gets them back in one
+ * write, rather than paying for a pair of system calls per input. */
+
+static struct {
+    uint8_t data[SERVE_BUFFER];
+    size_t start;
+    size_t end;
+} in;
+
+/* Copies the next `size` bytes of stdin to `to` (or skips them, if it's
+ * NULL). Returns false at the end of input. */
+static bool take (uint8_t *to, size_t size) {
+    while (size) {
+        if (in.start == in.end) {
+            fflush(stdout);
+            ssize_t got = read(STDIN_FILENO, in.data, sizeof(in.data));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            in.start = 0;
+            in.end = got;
+        }
+
+        size_t n = in.end - in.start < size ? in.end - in.start : size;
+        if (to) {
+            memcpy(to, in.data + in.start, n);
+            to += n;
+        }
+        in.start += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+static unsigned long serve (dcoy_fuzz *f) {
+    static uint8_t input[MAX_INPUT];
+    static char out[SERVE_BUFFER];
+    unsigned long runs = 0;
+    uint8_t header[4];
+
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+
+    while (take(header, 4)) {
+        size_t size = header[0] | header[1] << 8 | header[2] << 16 |
+                      (size_t)header[3] << 24;
+        size_t kept = size < MAX_INPUT ? size : MAX_INPUT;
+
+        if (!take(input, kept) || !take(NULL, size - kept)) break;
+
+        putchar(dcoy_fuzz_run(f, input, kept));
+        runs++;
+    }
+
+    fflush(stdout);
+    return runs;
+}
+
+
+int main (int argc, char *argv[]) {
+    if (argc < 6) {
+        printf("usage: dcoy-fuzz IMAGE FORK_PC INPUT_ADDR INPUT_WORDS "
+               "CYCLES [INPUT...]\n"
+               "environment: DCOY_FUZZ_EXIT_PC, DCOY_FUZZ_VARIANT\n");
+        return 1;
+    }
+
+    dcoy_dcpu16 *d = dcoy_dcpu_create();
+    if (dcoy_dcpu_load_image(d->mem, DCOY_MEM_WORDS, argv[1]) < 0) {
+        printf("can't read image from %s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    dcoy_fuzz *f = dcoy_fuzz_create();
+    dcoy_fuzz_input(f, strtoul(argv[3], NULL, 0), strtoul(argv[4], NULL, 0));
+    f->cycles = strtoul(argv[5], NULL, 0);
+
+    const char *exit_pc = getenv("DCOY_FUZZ_EXIT_PC");
+    if (exit_pc) {
+        dcoy_fuzz_exit_pc(f, strtoul(exit_pc, NULL, 0));
+    }
+    const char *variant = getenv("DCOY_FUZZ_VARIANT");
+    if (variant) {
+        int v = dcoy_dcpu_variant_find(variant);
+        if (v < 0) {
+            printf("no such variant: %s\n", variant);
+            return 1;
+        }
+        f->variant = v;
+    }
+
+    dcoy_word fork_pc = strtoul(argv[2], NULL, 0);
+    if (!dcoy_fuzz_fork(f, d, fork_pc, FORK_CYCLES)) {
+        printf("never reached the fork point 0x%04x\n", fork_pc);
+        return 3;
+    }
+
+    if (argc == 6) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unsigned long runs = serve(f);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double secs = (end.tv_sec - start.tv_sec)
+                    + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%lu runs in %.3f s (%.0f/s)\n",
+                runs, secs, secs > 0 ? runs / secs : 0);
+        return 0;
+    }
+
+    static uint8_t input[MAX_INPUT];
+    uint8_t *total = dcoy_coverage_create();
+    f->coverage = dcoy_coverage_create();
+
+    for (int i = 6; i < argc; i++) {
+        FILE *fd = fopen(argv[i], "r");
+        if (!fd) {
+            printf("%s: can't read: %s\n", argv[i], strerror(errno));
+            continue;
+        }
+        size_t size = fread(input, 1, MAX_INPUT, fd);
+        fclose(fd);
+
+        report(f, argv[i], dcoy_fuzz_run(f, input, size), total);
+    }
+
+    printf("%u edges covered\n", dcoy_coverage_count(total));
+    return 0;
+}
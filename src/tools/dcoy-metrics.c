@@ -0,0 +1,34 @@
+/**
+ * tools/dcoy-metrics.c
+ *
+ * Prints the counters another process publishes in shared memory, in
+ * the Prometheus text format
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "dcoy/metrics.h"
+
+int main (int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("usage: dcoy-metrics NAME\n");
+        return 1;
+    }
+
+    errno = 0;
+    dcoy_metrics *m = dcoy_metrics_open(argv[1]);
+    if (!m) {
+        fprintf(stderr, "can't open metrics %s: %s\n", argv[1],
+                errno ? strerror(errno) : "not a metrics region");
+        return 2;
+    }
+
+    bool ok = dcoy_metrics_write_text(m, stdout);
+    dcoy_metrics_close(m);
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,55 @@
+/**
+ * tools/dcoy-prof.c
+ *
+ * Runs a DCPU image with the sampling profiler, and writes the samples
+ * as folded stacks for flame graph tools
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/profile.h"
+#include "dcoy/specs.h"
+
+/* instructions run between checks of the cycle limit */
+#define BATCH   256
+
+int main (int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("usage: dcoy-prof IMAGE CYCLES PERIOD [SYMBOLS]\n");
+        return 1;
+    }
+
+    dcoy_dcpu16 *d = dcoy_dcpu_create();
+    if (dcoy_dcpu_load_image(d->mem, DCOY_MEM_WORDS, argv[1]) < 0) {
+        printf("can't read image from %s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    unsigned int cycles = strtoul(argv[2], NULL, 0);
+    dcoy_profile *p = dcoy_profile_create(strtoul(argv[3], NULL, 0));
+
+    if (argc > 4 && dcoy_profile_symbols_load(p, argv[4]) < 0) {
+        printf("can't read symbols from %s: %s\n", argv[4], strerror(errno));
+        return 2;
+    }
+
+    dcoy_profile_start(p, d);
+    while (d->cycles < cycles && dcoy_dcpu_ready(d)) {
+        dcoy_dcpu_run(d, BATCH);
+    }
+    dcoy_profile_stop(p, d);
+
+    dcoy_profile_write_folded(p, stdout);
+    fprintf(stderr, "%lu samples, %u stacks, %u cycles\n",
+            p->samples, p->stack_count, d->cycles);
+
+    dcoy_profile_destroy(p);
+    dcoy_dcpu_destroy(d);
+    return 0;
+}
@@ -0,0 +1,286 @@
+/**
+ * tools/dcoy-run.c
+ *
+ * Runs a batch of DCPU images across all cores, and writes a summary of
+ * how each one ended as a line of JSON
+ *
+ * (C) 2013, Matthew Frazier
+ * Released under the MIT license - see LICENSE for details
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dcoy/dcpu.h"
+#include "dcoy/constants.h"
+#include "dcoy/specs.h"
+
+#define DEFAULT_CYCLES  1000000
+
+/* instructions run between checks of the cycle limit */
+#define BATCH           256
+
+#define REASON_ERROR        0
+#define REASON_FIRE         1
+#define REASON_HALTED       2
+#define REASON_CYCLE_LIMIT  3
+#define REASON_UNREADABLE   4
+
+static const char *reasons[] = {
+    "error", "fire", "halted", "cycle-limit", "unreadable"
+};
+
+
+/* Jobs
+ * Each file named on the command line is a job. Workers take the next
+ * job from a shared counter and keep only the final state of the DCPU,
+ * which is printed in command line order as soon as every job before
+ * it is done. */
+
+typedef struct job {
+    const char *filename;
+    bool done;
+
+    unsigned int reason;
+    int load_errno;
+
+    unsigned int cycles;
+    dcoy_word reg[DCOY_REG_COUNT];
+    dcoy_word pc, sp, ex, ia;
+
+    unsigned int error_code;
+    const char *error_message;
+    dcoy_word error_data;
+    dcoy_word error_pc;
+} job;
+
+static struct {
+    job *jobs;
+    unsigned int count;
+
+    /* with a base image, each file is an input loaded over it */
+    dcoy_dcpu16 *base;
+    dcoy_word input_addr;
+
+    unsigned int cycles;
+    unsigned int variant;
+
+    pthread_mutex_t lock;
+    unsigned int next_job;
+    unsigned int next_output;
+    FILE *out;
+} batch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cycles = DEFAULT_CYCLES
+};
+
+
+/* Loading */
+
+/* An image has to have something in it, but an input over a base image
+ * may be empty. Either fails if it can't be read in full. */
+static int load (dcoy_dcpu16 *d, const char *filename, dcoy_word addr,
+                 bool input) {
+    int words = dcoy_dcpu_load_image(d->mem + addr, DCOY_MEM_WORDS - addr,
+                                     filename);
+    if (words == 0 && !input) {
+        errno = ENODATA;
+        return -1;
+    }
+    return words < 0 ? -1 : 0;
+}
+
+
+/* Output */
+
+static void write_string (FILE *out, const char *s) {
+    putc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            putc(c, out);
+        }
+    }
+    putc('"', out);
+}
+
+
+static void write_job (FILE *out, const job *j) {
+    fputs("{\"image\":", out);
+    write_string(out, j->filename);
+    fprintf(out, ",\"reason\":\"%s\"", reasons[j->reason]);
+
+    if (j->reason == REASON_UNREADABLE) {
+        fputs(",\"message\":", out);
+        write_string(out, strerror(j->load_errno));
+        fputs("}\n", out);
+        return;
+    }
+
+    fprintf(out, ",\"cycles\":%u,\"registers\":{", j->cycles);
+    for (unsigned int r = 0; r < DCOY_REG_COUNT; r++) {
+        fprintf(out, "\"%c\":%u,", "ABCXYZIJ"[r], j->reg[r]);
+    }
+    fprintf(out, "\"PC\":%u,\"SP\":%u,\"EX\":%u,\"IA\":%u}",
+            j->pc, j->sp, j->ex, j->ia);
+
+    fprintf(out, ",\"error\":%u", j->error_code);
+    if (j->error_code) {
+        /* variants that trap errors don't record the rest */
+        if (dcoy_dcpu_variant_reports_errors(batch.variant)) {
+            fputs(",\"message\":", out);
+            write_string(out, j->error_message ? j->error_message : "");
+            fprintf(out, ",\"data\":%u", j->error_data);
+        }
+        fprintf(out, ",\"error_pc\":%u", j->error_pc);
+    }
+    fputs("}\n", out);
+}
+
+
+/* Running */
+
+static void run (dcoy_dcpu16 *d, job *j) {
+    if (batch.base) {
+        *d = *batch.base;
+    } else {
+        dcoy_dcpu_initialize(d);
+    }
+
+    if (load(d, j->filename, batch.input_addr, batch.base != NULL) < 0) {
+        j->reason = REASON_UNREADABLE;
+        j->load_errno = errno;
+        return;
+    }
+    dcoy_dcpu_variant_set(d, batch.variant);
+
+    /* variants that don't count cycles are limited by instruction */
+    bool counts_cycles = dcoy_dcpu_variant_counts_cycles(batch.variant);
+    unsigned int start = d->cycles;
+    unsigned int spent = 0;
+
+    while (spent < batch.cycles && dcoy_dcpu_ready(d) &&
+           !dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_ON_FIRE)) {
+        unsigned int done = dcoy_dcpu_run(d, BATCH);
+        spent = counts_cycles ? d->cycles - start : spent + done;
+    }
+
+    if (dcoy_dcpu_flag(d, DCOY_DCPU_FLAG_ON_FIRE)) {
+        j->reason = REASON_FIRE;
+    } else if (dcoy_dcpu_running(d)) {
+        j->reason = REASON_CYCLE_LIMIT;
+    } else {
+        j->reason = d->error_code ? REASON_ERROR : REASON_HALTED;
+    }
+
+    j->cycles = spent;
+    memcpy(j->reg, d->reg, sizeof(j->reg));
+    j->pc = d->pc;
+    j->sp = d->sp;
+    j->ex = dcoy_dcpu_ex(d);
+    j->ia = d->ia;
+    j->error_code = d->error_code;
+    j->error_message = d->error_message;
+    j->error_data = d->error_data;
+    j->error_pc = d->error_pc;
+}
+
+
+static void *worker (void *arg) {
+    (void)arg;
+    dcoy_dcpu16 *d = dcoy_dcpu_create();
+
+    pthread_mutex_lock(&batch.lock);
+    while (batch.next_job < batch.count) {
+        job *j = &batch.jobs[batch.next_job++];
+        pthread_mutex_unlock(&batch.lock);
+
+        run(d, j);
+
+        pthread_mutex_lock(&batch.lock);
+        j->done = true;
+        while (batch.next_output < batch.count &&
+               batch.jobs[batch.next_output].done) {
+            write_job(batch.out, &batch.jobs[batch.next_output++]);
+        }
+    }
+    pthread_mutex_unlock(&batch.lock);
+
+    dcoy_dcpu_destroy(d);
+    return NULL;
+}
+
+
+int main (int argc, char *argv[]) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *output = NULL;
+    const char *base = NULL;
+    int opt, variant;
+
+    while ((opt = getopt(argc, argv, "j:c:o:b:a:v:")) != -1) {
+        switch (opt) {
+            case 'j':   threads = strtol(optarg, NULL, 0);          break;
+            case 'c':   batch.cycles = strtoul(optarg, NULL, 0);    break;
+            case 'o':   output = optarg;                            break;
+            case 'b':   base = optarg;                              break;
+            case 'a':   batch.input_addr = strtoul(optarg, NULL, 0); break;
+            case 'v':   variant = dcoy_dcpu_variant_find(optarg);
+                        if (variant < 0) goto usage;
+                        batch.variant = variant;                    break;
+            default:    goto usage;
+        }
+    }
+
+    if (optind == argc) {
+usage:
+        printf("usage: dcoy-run [-j JOBS] [-c CYCLES] [-v VARIANT] "
+               "[-o OUTPUT] IMAGE...\n"
+               "       dcoy-run [options] -b IMAGE [-a ADDR] INPUT...\n"
+               "VARIANT is full, no-cycles, no-interrupts, trap or fast.\n");
+        return 1;
+    }
+
+    if (base) {
+        batch.base = dcoy_dcpu_create();
+        if (load(batch.base, base, 0, false) < 0) {
+            printf("can't read image from %s: %s\n", base, strerror(errno));
+            return 2;
+        }
+    } else {
+        batch.input_addr = 0;
+    }
+
+    batch.out = output ? fopen(output, "w") : stdout;
+    if (!batch.out) {
+        printf("can't write to %s: %s\n", output, strerror(errno));
+        return 2;
+    }
+
+    batch.count = argc - optind;
+    batch.jobs = calloc(batch.count, sizeof(job));
+    for (unsigned int i = 0; i < batch.count; i++) {
+        batch.jobs[i].filename = argv[optind + i];
+    }
+
+    if (threads < 1) threads = 1;
+    if ((unsigned long)threads > batch.count) threads = batch.count;
+
+    pthread_t *pool = malloc(threads * sizeof(pthread_t));
+    for (long t = 0; t < threads; t++) {
+        pthread_create(&pool[t], NULL, worker, NULL);
+    }
+    for (long t = 0; t < threads; t++) {
+        pthread_join(pool[t], NULL);
+    }
+
+    fclose(batch.out);
+    return 0;
+}